@@ -0,0 +1,375 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* Measures the cost of the dispatch loop on loop-heavy bytecode.
+ *
+ * This file is built twice, as bench_dispatch_goto and bench_dispatch_switch,
+ * with HS_VM_DISPATCH set to each mode. Run both to compare them:
+ *
+ *   ./bench_dispatch_goto 20000
+ *   ./bench_dispatch_switch 20000
+ *
+ * The argument is the number of iterations, in thousands. Each kernel runs
+ * twice, without superinstructions and with all of them. The ops count the
+ * opcodes before fusing, so fused runs show the time saved per opcode.
+ * The call kernels then compare the cost of a call with an argument block
+ * against a call through a call site.
+ *
+ * With --jit first, functions are compiled to machine code on their first
+ * call, where the platform and their opcodes allow it:
+ *
+ *   ./bench_dispatch_goto --jit 20000
+ *
+ * With --osr, the kernels start interpreted and move to machine code in the
+ * middle of their loop, once it has run a thousand times.
+ *
+ * Every run checks its result against the one worked out here, and fails
+ * if they differ. The edge kernel leaves hs_int on its last iteration, so
+ * with --jit or --osr it also checks the exit from machine code back to the
+ * interpreter, which finishes the operation with a BIGINT.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hs/vm.h"
+#include "hs/bigint.h"
+
+/* The hs_state.jit_threshold of every run, set by --jit */
+static uint32_t jit_threshold;
+/* The hs_state.osr_threshold of every run, set by --osr */
+static uint16_t osr_threshold;
+
+static uint32_t
+encode(uint8_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.u8[0] = a;
+  params.u8[1] = b;
+  params.u8[2] = c;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+static uint32_t
+encode_uint(uint8_t op, uint8_t reg, uint16_t value)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.set.u8  = reg;
+  params.set.u16 = value;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+/* r0 counts from 0 to r1, r4 accumulates a mix of integer operations. It
+ * adds 3 and mixes in r0, so it stays below 2^29 for any count the argument
+ * allows, and the kernel never measures BIGINTs */
+static size_t
+int_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 6, 3);
+  /* loop: */
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 6);
+  code[n++] = encode(HS_OP_INT_XOR, 4, 4, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 6);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* r0 counts from 0 to r1, r4 accumulates floats through a local variable */
+static size_t
+float_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode(HS_OP_INT2FLOAT, 4, 4, 0);
+  code[n++] = encode_uint(HS_OP_STORE_LOCAL, 4, 0);
+  /* loop: */
+  code[n++] = encode_uint(HS_OP_LOAD_LOCAL, 4, 0);
+  code[n++] = encode(HS_OP_INT2FLOAT, 3, 0, 0);
+  code[n++] = encode(HS_OP_FLOAT_ADD, 4, 4, 3);
+  code[n++] = encode_uint(HS_OP_STORE_LOCAL, 4, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 7);
+  code[n++] = encode_uint(HS_OP_LOAD_LOCAL, 4, 0);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* r0 counts from 0 to r1, r4 counts down from INT32_MIN + r1 - 1. It only
+ * leaves hs_int on the last iteration, where it becomes INT32_MIN - 1, so the
+ * loop runs on FIXINTs and ends with the promotion to a BIGINT */
+static size_t
+edge_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  /* r4 <- ( 0 - 32768 ) * 256 * 256 + r1 - 1 */
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 32768);
+  code[n++] = encode(HS_OP_INT_SUB, 4, 0, 4);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 256);
+  code[n++] = encode(HS_OP_INT_MUL, 4, 4, 2);
+  code[n++] = encode(HS_OP_INT_MUL, 4, 4, 2);
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 1);
+  code[n++] = encode(HS_OP_INT_DEC, 4, 0, 0);
+  /* loop: */
+  code[n++] = encode(HS_OP_INT_DEC, 4, 0, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 11);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* Gets an integer result as an int64, fails if it is not an integer */
+static int
+result_to_i64(hs_object result, int64_t *value)
+{
+  if (HS_TAG(result) == HS_OBJECT_BIGINT)
+    return hs_bigint_to_i64(&HS_AS_BOX(result)->value.as_bigint, value);
+  if (HS_TAG(result) != HS_OBJECT_FIXINT) return 1;
+  *value = HS_AS_INT(result);
+  return 0;
+}
+
+/* The result of int_kernel, worked out with the wrapping of an hs_int */
+static int
+int_check(hs_object result, uint16_t thousands)
+{
+  uint32_t acc = 0;
+  for (uint32_t i = 0; i < thousands * 1000u; ++i) acc = ( acc + 3 ) ^ i;
+  return HS_TAG(result) != HS_OBJECT_FIXINT ||
+         (uint32_t)HS_AS_INT(result) != acc;
+}
+
+/* The result of float_kernel, added in the same order and precision */
+static int
+float_check(hs_object result, uint16_t thousands)
+{
+  volatile hs_float acc = 0;
+  for (uint32_t i = 0; i < thousands * 1000u; ++i) acc += (hs_float)i;
+  return HS_TAG(result) != HS_OBJECT_FLOAT || HS_AS_FLOAT(result) != acc;
+}
+
+/* The result of edge_kernel, the same for every count */
+static int
+edge_check(hs_object result, uint16_t thousands)
+{
+  int64_t value;
+  (void)thousands;
+  return HS_TAG(result) != HS_OBJECT_BIGINT ||
+         result_to_i64(result, &value) || value != (int64_t)INT32_MIN - 1;
+}
+
+/* The function called by the call kernels: r0 + r1 */
+static const uint32_t add_code[] = {
+  ( (uint32_t)HS_OP_INT_ADD << 24 ) | ( 0 << 16 ) | ( 0 << 8 ) | 1,
+  ( (uint32_t)HS_OP_RETURN << 24 ),
+  ( (uint32_t)HS_OP_END_BYTECODE << 24 )
+};
+
+/* r4 <- add(r4, r3) for r0 from 0 to r1, with arguments.push(). r3 is 1,
+ * so r4 counts the calls and never leaves hs_int */
+static size_t
+args_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  code[n++] = encode_uint(HS_OP_DECLARE_FUNCTION, 6, 1);
+  /* loop: */
+  code[n++] = encode_uint(HS_OP_RESERVE_ARGS, 0, 2);
+  code[n++] = encode_uint(HS_OP_SET_ARG, 4, 0);
+  code[n++] = encode_uint(HS_OP_SET_ARG, 3, 1);
+  code[n++] = encode(HS_OP_LOCAL_CALL, 4, 6, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 7);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* The same loop, with the arguments moved into place for call site 0 */
+static size_t
+site_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  code[n++] = encode_uint(HS_OP_DECLARE_FUNCTION, 6, 1);
+  /* loop: */
+  code[n++] = encode(HS_OP_MOVE, 7, 4, 0);
+  code[n++] = encode(HS_OP_MOVE, 8, 3, 0);
+  code[n++] = encode_uint(HS_OP_LOCAL_CALL_SITE, 4, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 7);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+static int
+run_calls(const char *name, size_t (*build)(uint32_t *, uint16_t),
+          uint16_t thousands)
+{
+  uint32_t     code[32];
+  hs_call_site site = { 6, 0, 7, 2, NULL, NULL, NULL, 0, 0 };
+  hs_function  fns[2];
+  hs_module    module = { fns, 2, NULL, 0, 0, &site, 1 };
+  hs_state     state;
+  hs_object    result;
+  clock_t      start;
+  double       seconds, calls;
+
+  if (hs_function_init(fns, &module, code, build(code, thousands), 0))
+    return 1;
+  if (hs_function_init(fns + 1, &module, add_code, 3, 0)) return 1;
+  if (hs_state_init(&state)) return 1;
+  state.jit_threshold = jit_threshold;
+  state.osr_threshold = osr_threshold;
+  start = clock();
+  if (hs_vm_run(&state, fns, &result))
+  {
+    fprintf(stderr, "%s: error %d\n", name, HS_AS_INT(state.error));
+    hs_state_end(&state);
+    return 1;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  calls = (double)thousands * 1000.0;
+  if (HS_TAG(result) != HS_OBJECT_FIXINT ||
+      HS_AS_INT(result) != thousands * 1000)
+  {
+    fprintf(stderr, "%s: wrong result\n", name);
+    hs_state_end(&state);
+    return 1;
+  }
+  printf("%-6s %-6s %-5s %10.0f calls %6.3f s %8.2f ns/call\n",
+         HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO ? "goto" : "switch",
+         name, "call", calls, seconds, seconds * 1e9 / calls);
+  hs_state_end(&state);
+  hs_function_end(fns);
+  hs_function_end(fns + 1);
+  return 0;
+}
+
+static int
+run_kernel(const char *name, size_t (*build)(uint32_t *, uint16_t),
+           int (*check)(hs_object, uint16_t), uint16_t thousands,
+           size_t loop_size, unsigned fusions)
+{
+  uint32_t    code[32];
+  hs_module   module = { NULL, 0, NULL, 0, fusions, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, ops;
+
+  if (hs_function_init(&fn, &module, code, build(code, thousands), 1))
+    return 1;
+  if (hs_state_init(&state)) return 1;
+  state.jit_threshold = jit_threshold;
+  state.osr_threshold = osr_threshold;
+  start = clock();
+  if (hs_vm_run(&state, &fn, &result))
+  {
+    fprintf(stderr, "%s: error %d\n", name, HS_AS_INT(state.error));
+    hs_state_end(&state);
+    return 1;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  ops = (double)thousands * 1000.0 * loop_size;
+  if (check(result, thousands))
+  {
+    fprintf(stderr, "%s: wrong result\n", name);
+    hs_state_end(&state);
+    return 1;
+  }
+  printf("%-6s %-6s %-5s %10.0f ops %8.3f s %8.2f ns/op\n",
+         HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO ? "goto" : "switch",
+         name, fn.jit_entry ? "jit" : fn.osr_entry ? "osr" :
+               fusions ? "fused" : "plain", ops,
+         seconds, seconds * 1e9 / ops);
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  long thousands;
+  int  arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg)
+  {
+    if (strcmp(argv[arg], "--jit") == 0)
+      jit_threshold = 1;
+    else if (strcmp(argv[arg], "--osr") == 0)
+      osr_threshold = 1000;
+    else
+      break;
+  }
+  thousands = arg < argc ? atol(argv[arg]) : 10000;
+  if (thousands < 1 || thousands > UINT16_MAX)
+  {
+    fprintf(stderr,
+            "usage: %s [--jit] [--osr] [thousands of iterations, up to %d]\n",
+            argv[0], UINT16_MAX);
+    return 1;
+  }
+  for (unsigned fusions = 0; fusions <= HS_VM_FUSE_ALL;
+       fusions += HS_VM_FUSE_ALL)
+  {
+    if (run_kernel("int", int_kernel, int_check, (uint16_t)thousands, 5,
+                   fusions))
+      return 1;
+    if (run_kernel("float", float_kernel, float_check, (uint16_t)thousands,
+                   7, fusions))
+      return 1;
+    if (run_kernel("edge", edge_kernel, edge_check, (uint16_t)thousands, 4,
+                   fusions))
+      return 1;
+  }
+  if (run_calls("args", args_kernel, (uint16_t)thousands)) return 1;
+  if (run_calls("site", site_kernel, (uint16_t)thousands)) return 1;
+  return 0;
+}
\ No newline at end of file
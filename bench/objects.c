@@ -0,0 +1,532 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along
+ * with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* Checks and measures the arrays, ranges and strings of the virtual machine.
+ *
+ *   ./bench_objects 1000
+ *
+ * The argument is the number of elements, in thousands. Each array kernel
+ * fills an array through ARRAY_SET and returns it; the array is then
+ * checked against the values stored, with the kind it should have ended
+ * with. The bytes show the memory each element takes, with the room left
+ * to grow.
+ *
+ * The ranges are first checked against the elements they stand for, and
+ * against the limit of INT32_MAX elements, then the range kernels walk one
+ * with FOR_IN and test it with RANGE_INCLUDES.
+ * The boxes show what a kernel allocated, whatever the size of the range.
+ *
+ * The interned strings are checked for identity and type, texts holding null
+ * characters and growth of the table, then looked up again and again.
+ * Interning before the table is prepared must fail.
+ *
+ * A wrong value, kind, element or string makes the program fail.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hs/string.h"
+#include "hs/vm.h"
+
+static uint32_t
+encode(uint8_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.u8[0] = a;
+  params.u8[1] = b;
+  params.u8[2] = c;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+static uint32_t
+encode_uint(uint8_t op, uint8_t reg, uint16_t value)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.set.u8  = reg;
+  params.set.u16 = value;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+/* The value each kernel stores at an index */
+typedef enum fill_value
+{
+  FILL_INT,
+  FILL_FLOAT,
+  FILL_MIXED
+} fill_value;
+
+/* r2[r0] <- r0 for r0 from 0 to r1, starting from an empty array. Floats
+ * store float(r0) instead, and mixed ones replace r2[0] with null at the
+ * end, moving a packed array to generic */
+static size_t
+array_kernel(uint32_t *code, uint16_t thousands, fill_value fill)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_ARRAY_NEW, 2, 0);
+  /* loop: */
+  if (fill == FILL_FLOAT)
+  {
+    code[n++] = encode(HS_OP_INT2FLOAT, 3, 0, 0);
+    code[n++] = encode(HS_OP_ARRAY_SET, 2, 0, 3);
+  }
+  else
+  {
+    code[n++] = encode(HS_OP_ARRAY_SET, 2, 0, 0);
+  }
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 5);
+  if (fill == FILL_MIXED)
+  {
+    code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+    code[n++] = encode(HS_OP_LOAD_NULL, 3, 0, 0);
+    code[n++] = encode(HS_OP_ARRAY_SET, 2, 0, 3);
+  }
+  code[n++] = encode(HS_OP_RETURN, 2, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* Checks that element i of the array holds what the kernel stored there */
+static int
+check_array(hs_object array, size_t size, fill_value fill)
+{
+  static const hs_elements_kind kinds[] = {
+    HS_ELEMENTS_INT, HS_ELEMENTS_FLOAT, HS_ELEMENTS_GENERIC
+  };
+  const hs_elements *el;
+  hs_object          value;
+  if (HS_TAG(array) != HS_OBJECT_ARRAY) return 1;
+  el = &HS_AS_BOX(array)->value.as_array;
+  if (el->kind != kinds[fill] || el->size != size) return 1;
+  for (size_t i = 0; i < size; ++i)
+  {
+    if (hs_elements_get(el, i, &value)) return 1;
+    if (fill == FILL_MIXED && i == 0)
+    {
+      if (HS_TAG(value) != HS_OBJECT_NULL) return 1;
+    }
+    else if (fill == FILL_FLOAT)
+    {
+      if (HS_TAG(value) != HS_OBJECT_FLOAT ||
+          HS_AS_FLOAT(value) != (hs_float)i)
+        return 1;
+    }
+    else if (HS_TAG(value) != HS_OBJECT_FIXINT ||
+             HS_AS_INT(value) != (hs_int)i)
+      return 1;
+  }
+  return 0;
+}
+
+static int
+run_array(const char *name, uint16_t thousands, fill_value fill)
+{
+  static const size_t widths[] = {
+    sizeof(hs_int), sizeof(hs_float), sizeof(hs_object)
+  };
+  uint32_t    code[32];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, size, bytes = 0;
+  int         failed;
+
+  if (hs_function_init(&fn, &module, code,
+                       array_kernel(code, thousands, fill), 0))
+    return 1;
+  if (hs_state_init(&state)) return 1;
+  start = clock();
+  if (hs_vm_run(&state, &fn, &result))
+  {
+    fprintf(stderr, "%s: error %d\n", name, HS_AS_INT(state.error));
+    hs_state_end(&state);
+    return 1;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  size = (double)thousands * 1000.0;
+  failed = check_array(result, (size_t)size, fill);
+  if (!failed)
+    bytes = (double)( HS_AS_BOX(result)->value.as_array.capa * widths[fill] );
+  printf("%-6s %-6s %10.0f elements %6.3f s %6.2f ns/element %5.2f bytes %s\n",
+         "array", name, size, seconds, seconds * 1e9 / size, bytes / size,
+         failed ? "FAILED" : "ok");
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* r4 <- r4 ^ i for i in 1..r1, walked by FOR_IN */
+static size_t
+for_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  code[n++] = encode(HS_OP_RANGE_NEW, 2, 3, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  /* loop: */
+  code[n++] = encode(HS_OP_FOR_IN, 6, 2, 0);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 11);
+  code[n++] = encode(HS_OP_INT_XOR, 4, 4, 6);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 7);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* r4 counts the r0 from 0 to r1 in r1 / 4 ... r1 / 2, like a case/when */
+static size_t
+when_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 250);
+  code[n++] = encode(HS_OP_INT_MUL, 7, 3, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 500);
+  code[n++] = encode(HS_OP_INT_MUL, 8, 3, 2);
+  code[n++] = encode(HS_OP_RANGE_NEW_EXCLUSIVE, 2, 7, 8);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  /* loop: */
+  code[n++] = encode(HS_OP_RANGE_INCLUDES, 6, 2, 0);
+  code[n++] = encode_uint(HS_OP_JUMP_EQ_ZERO, 6, 14);
+  code[n++] = encode(HS_OP_INT_INC, 4, 4, 0);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 11);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* 1 ^ 2 ^ ... ^ n, which repeats with a period of 4 */
+static hs_int
+xor_up_to(hs_int n)
+{
+  switch (n % 4)
+  {
+    case 0:  return n;
+    case 1:  return 1;
+    case 2:  return n + 1;
+    default: return 0;
+  }
+}
+
+static int
+run_range(const char *name, size_t (*build)(uint32_t *, uint16_t),
+          uint16_t thousands, hs_int expect)
+{
+  uint32_t    code[32];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, size;
+  int         failed;
+
+  if (hs_function_init(&fn, &module, code, build(code, thousands), 0))
+    return 1;
+  if (hs_state_init(&state)) return 1;
+  start = clock();
+  if (hs_vm_run(&state, &fn, &result))
+  {
+    fprintf(stderr, "%s: error %d\n", name, HS_AS_INT(state.error));
+    hs_state_end(&state);
+    return 1;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  size = (double)thousands * 1000.0;
+  failed = HS_TAG(result) != HS_OBJECT_FIXINT || HS_AS_INT(result) != expect;
+  printf("%-6s %-6s %10.0f elements %6.3f s %6.2f ns/element %5zu boxes %s\n",
+         "range", name, size, seconds, seconds * 1e9 / size, state.area.size,
+         failed ? "FAILED" : "ok");
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* first..bound, or first...bound, keeping every step-th element */
+typedef struct range_case
+{
+  hs_int first;
+  hs_int bound;
+  int    exclusive;
+  hs_int step;
+} range_case;
+
+static const range_case range_cases[] = {
+  {   1,  10, 0, 1 }, {   1,  10, 1, 1 }, {   1,  10, 0, 3 },
+  {   1,  10, 1, 3 }, {  10,   1, 0, 1 }, {  10,   1, 1, 1 },
+  {  10,   1, 0, 4 }, {  -5,   5, 1, 2 }, {   5,  -5, 0, 3 },
+  {   3,   3, 0, 1 }, {   3,   3, 1, 1 }, {   0,   1, 1, 7 }
+};
+
+/* Lists the elements of a range case the long way, one by one */
+static size_t
+range_elements(const range_case *c, hs_int *elements)
+{
+  hs_int direction = c->bound < c->first ? -1 : 1;
+  size_t n = 0, kept = 0;
+  for (hs_int x = c->first; ; x += direction, ++n)
+  {
+    if (c->exclusive && x == c->bound) break;
+    if (n % (size_t)c->step == 0) elements[kept++] = x;
+    if (x == c->bound) break;
+  }
+  return kept;
+}
+
+/* Checks indexing, includes and slicing of every range case against the
+ * elements it stands for */
+static int
+check_ranges(void)
+{
+  hs_int elements[32];
+  for (size_t k = 0; k < sizeof range_cases / sizeof *range_cases; ++k)
+  {
+    const range_case *c = range_cases + k;
+    hs_range          r, indexes, slice;
+    size_t            size = range_elements(c, elements);
+    if (hs_range_init(&r, c->first, c->bound, c->exclusive) ||
+        hs_range_step(&r, c->step) || r.size != (int64_t)size)
+      return 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+      if (r.first + (int64_t)i * r.step != elements[i]) return 1;
+    }
+    for (hs_int x = -20; x <= 20; ++x)
+    {
+      int found = 0;
+      for (size_t i = 0; i < size; ++i) found |= elements[i] == x;
+      if (!hs_range_includes(&r, x) != !found) return 1;
+    }
+    if (size == 0) continue;
+    /* (size - 1)..0 reverses the range */
+    if (hs_range_init(&indexes, (hs_int)size - 1, 0, 0) ||
+        hs_range_slice(&slice, &r, &indexes) ||
+        slice.size != (int64_t)size)
+      return 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+      if (slice.first + (int64_t)i * slice.step != elements[size - 1 - i])
+        return 1;
+    }
+    /* An index past the end is out of the range */
+    if (hs_range_init(&indexes, 0, (hs_int)size, 0) ||
+        !hs_range_slice(&slice, &r, &indexes))
+      return 1;
+  }
+  printf("%-6s %-6s %10zu cases ok\n", "range", "checks",
+         sizeof range_cases / sizeof *range_cases);
+  return 0;
+}
+
+/* r1 <- INT32_MAX, then either r4 counts the elements FOR_IN finds from
+ * index INT32_MAX - 3 of 0...INT32_MAX, or too_big asks for the range
+ * INT32_MIN..INT32_MAX, of 2^32 elements */
+static size_t
+limit_kernel(uint32_t *code, int too_big)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 32767);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 256);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 65535);
+  code[n++] = encode(HS_OP_INT_ADD, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  if (too_big)
+  {
+    code[n++] = encode(HS_OP_INT_SUB, 5, 3, 1);
+    code[n++] = encode(HS_OP_INT_DEC, 5, 0, 0);
+    code[n++] = encode(HS_OP_RANGE_NEW, 2, 5, 1);
+    code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+    code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+    return n;
+  }
+  code[n++] = encode(HS_OP_RANGE_NEW_EXCLUSIVE, 2, 3, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 3);
+  code[n++] = encode(HS_OP_INT_SUB, 0, 1, 0);
+  /* loop: */
+  code[n++] = encode(HS_OP_FOR_IN, 6, 2, 0);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 15);
+  code[n++] = encode(HS_OP_INT_INC, 4, 0, 0);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 11);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* Checks that no range holds more than INT32_MAX elements, and that FOR_IN
+ * ends on the last element of the biggest one instead of wrapping */
+static int
+check_range_limits(void)
+{
+  uint32_t    code[32];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  hs_range    r;
+  int         failed;
+
+  if (hs_range_init(&r, 0, INT32_MAX, 1) || r.size != INT32_MAX ||
+      !hs_range_init(&r, 0, INT32_MAX, 0) ||
+      !hs_range_init(&r, INT32_MAX, INT32_MIN, 1))
+    return 1;
+  for (int too_big = 0; too_big <= 1; ++too_big)
+  {
+    if (hs_function_init(&fn, &module, code, limit_kernel(code, too_big), 0))
+      return 1;
+    if (hs_state_init(&state)) return 1;
+    if (too_big)
+      failed = !hs_vm_run(&state, &fn, &result) ||
+               HS_AS_INT(state.error) != HS_VM_ERROR_RANGE;
+    else
+      failed = hs_vm_run(&state, &fn, &result) ||
+               HS_TAG(result) != HS_OBJECT_FIXINT || HS_AS_INT(result) != 3;
+    hs_state_end(&state);
+    hs_function_end(&fn);
+    if (failed) return 1;
+  }
+  printf("%-6s %-6s %10d elements ok\n", "range", "limits", INT32_MAX);
+  return 0;
+}
+
+/* The number of names interned to make the table grow, it starts at 256 */
+#define NAMES 1000
+
+/* Checks that each text has a single box, whatever buffer it comes from */
+static int
+check_interning(hs_object *names)
+{
+  /* Texts that only differ after a null character */
+  static const char  texts[]   = "a\0b" "a\0c";
+  static const size_t sizes[]  = { 3, 3, 1, 2, 0 };
+  static const size_t starts[] = { 0, 3, 0, 0, 0 };
+  hs_object           first, again, other[5];
+  char                copy[16];
+  strcpy(copy, "name");
+  if (hs_intern_cstr(&first, "name") || hs_intern_cstr(&again, copy))
+    return 1;
+  if (HS_AS_BOX(first) != HS_AS_BOX(again) || !hs_key_equals(first, again) ||
+      HS_AS_BOX(first)->type != HS_OBJECT_STRING)
+    return 1;
+  if (hs_intern_cstr(&again, "names") || HS_AS_BOX(first) == HS_AS_BOX(again))
+    return 1;
+  for (size_t i = 0; i < 5; ++i)
+  {
+    const hs_string *str;
+    if (hs_intern(other + i, texts + starts[i], sizes[i])) return 1;
+    str = &HS_AS_BOX(other[i])->value.as_string;
+    if (str->size != sizes[i] ||
+        memcmp(HS_STRING_DATA(str), texts + starts[i], sizes[i]) != 0)
+      return 1;
+    for (size_t j = 0; j < i; ++j)
+    {
+      if (HS_AS_BOX(other[i]) == HS_AS_BOX(other[j])) return 1;
+    }
+  }
+  if (hs_intern(&again, "a\0b", 3) || HS_AS_BOX(again) != HS_AS_BOX(other[0]))
+    return 1;
+  /* Past 128 names the table grows, more than once */
+  for (size_t i = 0; i < NAMES; ++i)
+  {
+    snprintf(copy, sizeof copy, "name%zu", i);
+    if (hs_intern_cstr(names + i, copy)) return 1;
+  }
+  for (size_t i = 0; i < NAMES; ++i)
+  {
+    snprintf(copy, sizeof copy, "name%zu", i);
+    if (hs_intern_cstr(&again, copy) ||
+        HS_AS_BOX(again) != HS_AS_BOX(names[i]) ||
+        hs_key_hash(again) != hs_key_hash(names[i]))
+      return 1;
+  }
+  if (hs_intern_cstr(&again, "name") || HS_AS_BOX(first) != HS_AS_BOX(again))
+    return 1;
+  return 0;
+}
+
+static int
+run_interning(uint16_t thousands)
+{
+  static char texts[NAMES][16];
+  hs_object   names[NAMES], found;
+  clock_t     start;
+  double      seconds, size = (double)thousands * 1000.0;
+  int         failed;
+
+  /* Without the table there is nothing to intern into */
+  if (!hs_intern_cstr(&found, "name") || hs_intern_init()) return 1;
+  failed = check_interning(names);
+  for (size_t i = 0; i < NAMES; ++i)
+  {
+    snprintf(texts[i], sizeof texts[i], "name%zu", i);
+  }
+  start = clock();
+  for (size_t i = 0; !failed && i < (size_t)size; ++i)
+  {
+    failed = hs_intern_cstr(&found, texts[i % NAMES]) ||
+             HS_AS_BOX(found) != HS_AS_BOX(names[i % NAMES]);
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%-6s %-6s %10.0f lookups %7.3f s %6.2f ns/lookup %s\n",
+         "string", "intern", size, seconds, seconds * 1e9 / size,
+         failed ? "FAILED" : "ok");
+  hs_intern_end();
+  return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+  long thousands = argc > 1 ? atol(argv[1]) : 1000;
+  if (thousands < 1 || thousands > UINT16_MAX)
+  {
+    fprintf(stderr, "usage: %s [thousands of elements, up to %d]\n",
+            argv[0], UINT16_MAX);
+    return 1;
+  }
+  if (run_array("int", (uint16_t)thousands, FILL_INT)) return 1;
+  if (run_array("float", (uint16_t)thousands, FILL_FLOAT)) return 1;
+  if (run_array("mixed", (uint16_t)thousands, FILL_MIXED)) return 1;
+  if (check_ranges()) return 1;
+  if (check_range_limits()) return 1;
+  if (run_range("for", for_kernel, (uint16_t)thousands,
+                xor_up_to((hs_int)thousands * 1000)))
+    return 1;
+  if (run_range("when", when_kernel, (uint16_t)thousands,
+                (hs_int)thousands * 250))
+    return 1;
+  if (run_interning((uint16_t)thousands)) return 1;
+  return 0;
+}
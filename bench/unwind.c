@@ -0,0 +1,425 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along
+ * with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* Checks and measures the exception tables of functions.
+ *
+ *   ./bench_unwind 1000
+ *
+ * The argument is the number of iterations, in thousands. The checks throw
+ * inside a function and across frames, with handlers that take the type
+ * thrown and handlers that don't, errors of the virtual machine itself and
+ * values nothing catches. Tables with entries outside the code must be
+ * refused.
+ *
+ * The kernels then compare a loop with and without a handler covering it,
+ * which should cost the same, and measure a throw caught in the same
+ * function and one caught by the caller.
+ *
+ * A wrong result, stack or error makes the program fail.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hs/vm.h"
+
+static uint32_t
+encode(uint8_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.u8[0] = a;
+  params.u8[1] = b;
+  params.u8[2] = c;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+static uint32_t
+encode_uint(uint8_t op, uint8_t reg, uint16_t value)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.set.u8  = reg;
+  params.set.u16 = value;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+static hs_handler
+handler(uint32_t start, uint32_t end, uint32_t target, uint32_t stack,
+        hs_object_type type)
+{
+  hs_handler h;
+  h.start  = start;
+  h.end    = end;
+  h.target = target;
+  h.stack  = stack;
+  if (type == HS_OBJECT_FLOAT) HS_SET_FLOAT(h.type, 0);
+  else HS_SET_NULL(h.type);
+  return h;
+}
+
+/* Initializes a function and gives it its table, if it has one */
+static int
+load(hs_function *fn, hs_module *module, const uint32_t *code, size_t size,
+     const hs_handler *handlers, size_t count)
+{
+  if (hs_function_init(fn, module, code, size, 0)) return 1;
+  if (count && hs_function_set_handlers(fn, handlers, count))
+  {
+    hs_function_end(fn);
+    return 1;
+  }
+  return 0;
+}
+
+/* Checks that a run ended with the integer expected */
+static int
+is_int(hs_object result, hs_int expect)
+{
+  return HS_TAG(result) == HS_OBJECT_FIXINT && HS_AS_INT(result) == expect;
+}
+
+/* r1 <- 7 is thrown and caught two instructions later, on r0 */
+static int
+check_local(void)
+{
+  uint32_t    code[8];
+  hs_handler  h[1];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  size_t      n = 0;
+  int         failed;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 7);
+  code[n++] = encode(HS_OP_THROW, 1, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  /* handler: */
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  h[0] = handler(0, 3, 3, 0, HS_OBJECT_NULL);
+  if (load(&fn, &module, code, n, h, 1)) return 1;
+  if (hs_state_init(&state)) return 1;
+  failed = hs_vm_run(&state, &fn, &result) || !is_int(result, 7);
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* Each function pushes its number on the value stack and calls the next
+ * one, the last throws 9. The middle one only catches floats, so the
+ * first one catches the value, and keeps its own push */
+static int
+check_frames(void)
+{
+  uint32_t    code[3][12];
+  size_t      sizes[3];
+  hs_handler  h[3][1];
+  hs_function fns[3];
+  hs_module   module = { fns, 3, NULL, 0, 0, NULL, 0 };
+  hs_state    state;
+  hs_object   result;
+  int         failed;
+
+  for (uint16_t f = 0; f < 2; ++f)
+  {
+    size_t n = 0;
+    code[f][n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, f + 1);
+    code[f][n++] = encode(HS_OP_STACK_PUSH, 1, 0, 0);
+    code[f][n++] = encode_uint(HS_OP_DECLARE_FUNCTION, 6, f + 1);
+    code[f][n++] = encode(HS_OP_LOCAL_CALL, 4, 6, 0);
+    code[f][n++] = encode(HS_OP_RETURN, 4, 0, 0);
+    /* handler: */
+    code[f][n++] = encode(HS_OP_RETURN, 0, 0, 0);
+    code[f][n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+    sizes[f] = n;
+    h[f][0] = handler(3, 4, 5, 1, f ? HS_OBJECT_FLOAT : HS_OBJECT_NULL);
+  }
+  sizes[2] = 0;
+  code[2][sizes[2]++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 3);
+  code[2][sizes[2]++] = encode(HS_OP_STACK_PUSH, 1, 0, 0);
+  code[2][sizes[2]++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 9);
+  code[2][sizes[2]++] = encode(HS_OP_THROW, 2, 0, 0);
+  code[2][sizes[2]++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  for (size_t f = 0; f < 3; ++f)
+  {
+    if (load(fns + f, &module, code[f], sizes[f], h[f], f < 2 ? 1 : 0))
+    {
+      while (f > 0) hs_function_end(fns + --f);
+      return 1;
+    }
+  }
+  if (hs_state_init(&state)) return 1;
+  failed = hs_vm_run(&state, fns, &result) || !is_int(result, 9) ||
+           state.stack_size != 1 || !is_int(state.stack[0], 1) ||
+           state.frame != NULL;
+  hs_state_end(&state);
+  for (size_t f = 0; f < 3; ++f) hs_function_end(fns + f);
+  return failed;
+}
+
+/* A division by zero is thrown as HS_VM_ERROR_ZERO_DIVISION */
+static int
+check_error(void)
+{
+  uint32_t    code[8];
+  hs_handler  h[1];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  size_t      n = 0;
+  int         failed;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 0);
+  code[n++] = encode(HS_OP_INT_DIV, 3, 1, 2);
+  code[n++] = encode(HS_OP_RETURN, 3, 0, 0);
+  /* handler: */
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  h[0] = handler(2, 3, 4, 0, HS_OBJECT_NULL);
+  if (load(&fn, &module, code, n, h, 1)) return 1;
+  if (hs_state_init(&state)) return 1;
+  failed = hs_vm_run(&state, &fn, &result) ||
+           !is_int(result, HS_VM_ERROR_ZERO_DIVISION);
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* A value nothing catches ends the run with it as the error, and leaves
+ * the state ready for the next run */
+static int
+check_uncaught(void)
+{
+  uint32_t    code[2][8];
+  hs_function fns[2];
+  hs_module   module = { fns, 2, NULL, 0, 0, NULL, 0 };
+  hs_state    state;
+  hs_object   result;
+  size_t      n = 0;
+  int         failed;
+
+  code[0][n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 5);
+  code[0][n++] = encode(HS_OP_STACK_PUSH, 1, 0, 0);
+  code[0][n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 9);
+  code[0][n++] = encode(HS_OP_THROW, 2, 0, 0);
+  code[0][n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  if (load(fns, &module, code[0], n, NULL, 0)) return 1;
+  n = 0;
+  code[1][n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 4);
+  code[1][n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[1][n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  if (load(fns + 1, &module, code[1], n, NULL, 0))
+  {
+    hs_function_end(fns);
+    return 1;
+  }
+  if (hs_state_init(&state)) return 1;
+  failed = !hs_vm_run(&state, fns, &result) || !is_int(state.error, 9) ||
+           state.frame != NULL || state.registers_size != 0 ||
+           hs_vm_run(&state, fns + 1, &result) || !is_int(result, 4);
+  hs_state_end(&state);
+  hs_function_end(fns);
+  hs_function_end(fns + 1);
+  return failed;
+}
+
+/* Entries outside the code, or with a target inside a wide load, are
+ * refused, and the function keeps the table it had */
+static int
+check_tables(void)
+{
+  uint32_t    code[8];
+  hs_handler  bad[4], good[1];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  size_t      n = 0;
+  int         failed = 0;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_WIDE, 0, 0);
+  code[n++] = encode(HS_OP_EXTRA_ARG, 0, 0, 0);
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  bad[0]  = handler(0, 5, 2, 0, HS_OBJECT_NULL);
+  bad[1]  = handler(2, 1, 2, 0, HS_OBJECT_NULL);
+  bad[2]  = handler(0, 2, 4, 0, HS_OBJECT_NULL);
+  bad[3]  = handler(0, 2, 1, 0, HS_OBJECT_NULL);
+  good[0] = handler(0, 2, 2, 0, HS_OBJECT_NULL);
+  if (hs_function_init(&fn, &module, code, n, 0)) return 1;
+  if (hs_function_set_handlers(&fn, good, 1)) failed = 1;
+  for (size_t i = 0; i < sizeof bad / sizeof *bad; ++i)
+  {
+    if (!hs_function_set_handlers(&fn, bad + i, 1)) failed = 1;
+  }
+  if (fn.handlers != good || fn.handler_count != 1) failed = 1;
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* r0 counts from 0 to r1, r4 adds r3 on each iteration */
+static size_t
+loop_kernel(uint32_t *code, uint16_t thousands)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  /* loop: */
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 3);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 6);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  /* handler: */
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* r7 counts from 0 to r1, each one is thrown and caught, or thrown by
+ * function 1 when by_call is set, and r4 adds what is caught */
+static size_t
+throw_kernel(uint32_t *code, uint16_t thousands, int by_call)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 7, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode_uint(HS_OP_DECLARE_FUNCTION, 6, 1);
+  /* loop: */
+  code[n++] = encode_uint(HS_OP_RESERVE_ARGS, 0, 1);
+  code[n++] = encode_uint(HS_OP_SET_ARG, 7, 0);
+  if (by_call) code[n++] = encode(HS_OP_LOCAL_CALL, 8, 6, 0);
+  else         code[n++] = encode(HS_OP_THROW, 7, 0, 0);
+  /* handler: */
+  code[n++] = encode(HS_OP_INT_XOR, 4, 4, 0);
+  code[n++] = encode(HS_OP_INT_INC, 7, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 7, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 6);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+/* The function called by the throw kernel: throws its argument */
+static const uint32_t thrower_code[] = {
+  ( (uint32_t)HS_OP_THROW << 24 ),
+  ( (uint32_t)HS_OP_END_BYTECODE << 24 )
+};
+
+/* 0 ^ 1 ^ ... ^ n, which repeats with a period of 4 */
+static hs_int
+xor_up_to(hs_int n)
+{
+  switch (n % 4)
+  {
+    case 0:  return n;
+    case 1:  return 1;
+    case 2:  return n + 1;
+    default: return 0;
+  }
+}
+
+/* Runs the loop kernel, covered by a handler if covered is set */
+static int
+run_loop(const char *name, uint16_t thousands, int covered)
+{
+  uint32_t    code[32];
+  hs_handler  h[1];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, ops = (double)thousands * 1000.0 * 4;
+  int         failed;
+
+  h[0] = handler(6, 10, 11, 0, HS_OBJECT_NULL);
+  if (load(&fn, &module, code, loop_kernel(code, thousands), h, covered))
+    return 1;
+  if (hs_state_init(&state)) return 1;
+  start = clock();
+  failed = hs_vm_run(&state, &fn, &result);
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  failed = failed || !is_int(result, (hs_int)thousands * 1000);
+  printf("%-6s %-6s %10.0f ops    %6.3f s %8.2f ns/op    %s\n",
+         "unwind", name, ops, seconds, seconds * 1e9 / ops,
+         failed ? "FAILED" : "ok");
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* Runs the throw kernel, catching in the same function or the caller */
+static int
+run_throw(const char *name, uint16_t thousands, int by_call)
+{
+  uint32_t    code[32];
+  hs_handler  h[1];
+  hs_function fns[2];
+  hs_module   module = { fns, 2, NULL, 0, 0, NULL, 0 };
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, throws = (double)thousands * 1000.0;
+  int         failed;
+
+  h[0] = handler(8, 9, 9, 0, HS_OBJECT_NULL);
+  if (load(fns, &module, code, throw_kernel(code, thousands, by_call), h, 1))
+    return 1;
+  if (load(fns + 1, &module, thrower_code, 2, NULL, 0)) return 1;
+  if (hs_state_init(&state)) return 1;
+  start = clock();
+  failed = hs_vm_run(&state, fns, &result);
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  failed = failed ||
+           !is_int(result, xor_up_to((hs_int)thousands * 1000 - 1));
+  printf("%-6s %-6s %10.0f throws %6.3f s %8.2f ns/throw %s\n",
+         "unwind", name, throws, seconds, seconds * 1e9 / throws,
+         failed ? "FAILED" : "ok");
+  hs_state_end(&state);
+  hs_function_end(fns);
+  hs_function_end(fns + 1);
+  return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+  long thousands = argc > 1 ? atol(argv[1]) : 1000;
+  int  failed;
+  if (thousands < 1 || thousands > UINT16_MAX)
+  {
+    fprintf(stderr, "usage: %s [thousands of iterations, up to %d]\n",
+            argv[0], UINT16_MAX);
+    return 1;
+  }
+  failed = check_local() || check_frames() || check_error() ||
+           check_uncaught() || check_tables();
+  printf("%-6s %-6s %10d cases  %s\n", "unwind", "checks", 5,
+         failed ? "FAILED" : "ok");
+  if (failed) return 1;
+  if (run_loop("plain", (uint16_t)thousands, 0)) return 1;
+  if (run_loop("table", (uint16_t)thousands, 1)) return 1;
+  if (run_throw("local", (uint16_t)thousands, 0)) return 1;
+  if (run_throw("caller", (uint16_t)thousands, 1)) return 1;
+  return 0;
+}
@@ -0,0 +1,342 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along
+ * with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* Checks and measures the bytecode verifier.
+ *
+ *   ./bench_verify 1000
+ *
+ * The argument is the number of iterations, in thousands. The checks give
+ * the loader code with jumps outside the code or into the operand of a
+ * wide load, which must be refused, and code where the verifier must, or
+ * must not, move an instruction to its unchecked form. A function that
+ * meets its first BIGINT must go back to the checked forms, and still give
+ * the right result.
+ *
+ * The kernels then run the same loop verified, and with a computed jump
+ * that leaves it unverified, so the difference is the cost of the checks.
+ *
+ * A wrong form, result or verdict makes the program fail.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hs/vm.h"
+
+static uint32_t
+encode(uint8_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.u8[0] = a;
+  params.u8[1] = b;
+  params.u8[2] = c;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+static uint32_t
+encode_uint(uint8_t op, uint8_t reg, uint16_t value)
+{
+  union hs_opcode_params params;
+  uint32_t code;
+  params.set.u8  = reg;
+  params.set.u16 = value;
+  HS_OP_ENCODE(op, params, code);
+  return code;
+}
+
+/* Checks that the loader refuses a piece of code */
+static int
+refused(const uint32_t *code, size_t size)
+{
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  if (!hs_function_init(&fn, &module, code, size, 0))
+  {
+    hs_function_end(&fn);
+    return 0;
+  }
+  return 1;
+}
+
+/* Jumps outside the code, into the operand of a wide load, or behind a
+ * computed jump, and a wide load without its operand */
+static int
+check_refused(void)
+{
+  uint32_t code[8];
+  size_t   n = 0;
+  int      failed = 0;
+
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 9);
+  code[n++] = encode(HS_OP_RETURN_NULL, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  failed |= !refused(code, n);
+  n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_WIDE, 0, 0);
+  code[n++] = encode(HS_OP_EXTRA_ARG, 0, 0, 0);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 0, 1);
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  failed |= !refused(code, n);
+  n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_WIDE, 0, 0);
+  code[n++] = encode(HS_OP_RETURN, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  failed |= !refused(code, n);
+  n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 3);
+  code[n++] = encode(HS_OP_JUMP_INDIRECT, 1, 0, 0);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 40);
+  code[n++] = encode(HS_OP_RETURN_NULL, 0, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  failed |= !refused(code, n);
+  return failed;
+}
+
+/* The register window covers the highest register named, so every
+ * register of the code is in it */
+static int
+check_window(void)
+{
+  uint32_t    code[4];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  size_t      n = 0;
+  int         failed;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 200, 5);
+  code[n++] = encode(HS_OP_RETURN, 200, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  if (hs_function_init(&fn, &module, code, n, 0)) return 1;
+  if (hs_state_init(&state)) return 1;
+  failed = fn.registers != 201 || hs_vm_run(&state, &fn, &result) ||
+           HS_TAG(result) != HS_OBJECT_FIXINT || HS_AS_INT(result) != 5;
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* Checks the opcode each instruction runs, 0 skips an instruction */
+static int
+has_forms(const hs_function *fn, const uint16_t *forms, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (forms[i] && fn->instructions[i].opcode != forms[i]) return 0;
+  }
+  return 1;
+}
+
+/* r2 is an integer on one path and a float on the other, so the add after
+ * they join keeps its checks, while r1 is an integer on both. The first
+ * pop may find the stack empty, the second one can't */
+static int
+check_forms(void)
+{
+  static const uint16_t forms[] = {
+    0, 0, 0, 0, 0, HS_OP_INT_ADD, HS_OP_INT_INC_UNCHECKED,
+    HS_OP_STACK_POP, 0, HS_OP_STACK_POP_UNCHECKED
+  };
+  uint32_t    code[16];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  size_t      n = 0;
+  int         failed;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_EQ_ZERO, 0, 4);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 2);
+  code[n++] = encode_uint(HS_OP_JUMP, 0, 5);
+  code[n++] = encode(HS_OP_INT2FLOAT, 2, 1, 0);
+  /* join: */
+  code[n++] = encode(HS_OP_INT_ADD, 3, 1, 2);
+  code[n++] = encode(HS_OP_INT_INC, 1, 0, 0);
+  code[n++] = encode(HS_OP_STACK_POP, 4, 0, 0);
+  code[n++] = encode(HS_OP_STACK_PUSH, 1, 0, 0);
+  code[n++] = encode(HS_OP_STACK_POP, 4, 0, 0);
+  code[n++] = encode(HS_OP_RETURN, 3, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  if (hs_function_init(&fn, &module, code, n, 0)) return 1;
+  failed = !fn.verified ||
+           !has_forms(&fn, forms, sizeof forms / sizeof *forms);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* A handler is a new way into the code, where nothing is known, so the add
+ * it lands on goes back to its checks */
+static int
+check_handlers(void)
+{
+  static const uint16_t before[] = { 0, 0, HS_OP_INT_ADD_UNCHECKED };
+  static const uint16_t after[]  = { 0, 0, HS_OP_INT_ADD };
+  uint32_t    code[8];
+  hs_handler  h[1];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  size_t      n = 0;
+  int         failed;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 2);
+  code[n++] = encode(HS_OP_INT_ADD, 3, 1, 2);
+  code[n++] = encode(HS_OP_RETURN, 3, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  h[0].start  = 0;
+  h[0].end    = 2;
+  h[0].target = 2;
+  h[0].stack  = 0;
+  HS_SET_NULL(h[0].type);
+  if (hs_function_init(&fn, &module, code, n, 0)) return 1;
+  failed = !fn.verified || !has_forms(&fn, before, 3) ||
+           hs_function_set_handlers(&fn, h, 1) || !fn.verified ||
+           !has_forms(&fn, after, 3);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* r4 <- INT32_MAX + 1, the add is proved on FIXINTs but makes a BIGINT,
+ * so the function must drop every proof. It runs twice, the second time
+ * on the checked forms from the start */
+static int
+check_bigint(void)
+{
+  uint32_t    code[16];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  int64_t     value;
+  size_t      n = 0, add;
+  int         failed = 0;
+
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 32767);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 256);
+  code[n++] = encode(HS_OP_INT_MUL, 4, 4, 2);
+  code[n++] = encode(HS_OP_INT_MUL, 4, 4, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 65535);
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  add = n;
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 3);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  if (hs_function_init(&fn, &module, code, n, 0)) return 1;
+  if (!fn.verified ||
+      fn.instructions[add].opcode != HS_OP_INT_ADD_UNCHECKED)
+    failed = 1;
+  if (hs_state_init(&state)) return 1;
+  for (int run = 0; run < 2 && !failed; ++run)
+  {
+    failed = hs_vm_run(&state, &fn, &result) ||
+             HS_TAG(result) != HS_OBJECT_BIGINT ||
+             hs_bigint_to_i64(&HS_AS_BOX(result)->value.as_bigint, &value) ||
+             value != (int64_t)INT32_MAX + 1 || fn.verified;
+    for (size_t i = 0; i < fn.size && !failed; ++i)
+    {
+      failed = fn.instructions[i].opcode >= HS_OP_INT_ADD_UNCHECKED;
+    }
+  }
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+/* r0 counts from 0 to r1, r4 adds r3 on each iteration. With indirect the
+ * loop is entered through a computed jump, so the function is not
+ * verified and every instruction keeps its checks */
+static size_t
+loop_kernel(uint32_t *code, uint16_t thousands, int indirect)
+{
+  size_t n = 0;
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 1, thousands);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 2, 1000);
+  code[n++] = encode(HS_OP_INT_MUL, 1, 1, 2);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 0, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 3, 1);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 4, 0);
+  code[n++] = encode_uint(HS_OP_LOAD_INT_CONST, 9, 8);
+  if (indirect) code[n++] = encode(HS_OP_JUMP_INDIRECT, 9, 0, 0);
+  else          code[n++] = encode_uint(HS_OP_JUMP, 0, 8);
+  /* loop: */
+  code[n++] = encode(HS_OP_INT_ADD, 4, 4, 3);
+  code[n++] = encode(HS_OP_INT_INC, 0, 0, 0);
+  code[n++] = encode(HS_OP_INT_CMP, 5, 0, 1);
+  code[n++] = encode_uint(HS_OP_JUMP_LT_ZERO, 5, 8);
+  code[n++] = encode(HS_OP_RETURN, 4, 0, 0);
+  code[n++] = encode(HS_OP_END_BYTECODE, 0, 0, 0);
+  return n;
+}
+
+static int
+run_loop(const char *name, uint16_t thousands, int indirect)
+{
+  static const uint16_t checked[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, HS_OP_INT_ADD, HS_OP_INT_INC, HS_OP_INT_CMP,
+    HS_OP_JUMP_LT_ZERO
+  };
+  static const uint16_t unchecked[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, HS_OP_INT_ADD_UNCHECKED, HS_OP_INT_INC_UNCHECKED,
+    HS_OP_INT_CMP_UNCHECKED, HS_OP_JUMP_LT_ZERO_UNCHECKED
+  };
+  uint32_t    code[32];
+  hs_module   module = { NULL, 0, NULL, 0, 0, NULL, 0 };
+  hs_function fn;
+  hs_state    state;
+  hs_object   result;
+  clock_t     start;
+  double      seconds, ops = (double)thousands * 1000.0 * 4;
+  int         failed;
+
+  if (hs_function_init(&fn, &module, code,
+                       loop_kernel(code, thousands, indirect), 0))
+    return 1;
+  if (hs_state_init(&state)) return 1;
+  failed = !fn.verified == !indirect ||
+           !has_forms(&fn, indirect ? checked : unchecked,
+                      sizeof checked / sizeof *checked);
+  start = clock();
+  failed = hs_vm_run(&state, &fn, &result) || failed;
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  failed = failed || HS_TAG(result) != HS_OBJECT_FIXINT ||
+           HS_AS_INT(result) != (hs_int)thousands * 1000;
+  printf("%-6s %-9s %10.0f ops   %6.3f s %6.2f ns/op %s\n",
+         "verify", name, ops, seconds, seconds * 1e9 / ops,
+         failed ? "FAILED" : "ok");
+  hs_state_end(&state);
+  hs_function_end(&fn);
+  return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+  long thousands = argc > 1 ? atol(argv[1]) : 1000;
+  int  failed;
+  if (thousands < 1 || thousands > UINT16_MAX)
+  {
+    fprintf(stderr, "usage: %s [thousands of iterations, up to %d]\n",
+            argv[0], UINT16_MAX);
+    return 1;
+  }
+  failed = check_refused() || check_window() || check_forms() ||
+           check_handlers() || check_bigint();
+  printf("%-6s %-9s %10d cases %s\n", "verify", "checks", 5,
+         failed ? "FAILED" : "ok");
+  if (failed) return 1;
+  if (run_loop("checked", (uint16_t)thousands, 1)) return 1;
+  if (run_loop("unchecked", (uint16_t)thousands, 0)) return 1;
+  return 0;
+}
@@ -22,7 +22,7 @@
   name##_end( name *array );                                                   \
                                                                                \
   size_t                                                                       \
-  name##_size( array );                                                        \
+  name##_size( name *array );                                                  \
                                                                                \
   int                                                                          \
   name##_insert( name *array, size_t at, type value );                         \
@@ -106,7 +106,7 @@
   }                                                                            \
                                                                                \
   size_t                                                                       \
-  name##_size( array )                                                         \
+  name##_size( name *array )                                                   \
   {                                                                            \
     return array->size;                                                        \
   }                                                                            \
@@ -216,7 +216,7 @@
         array[i] = t;                                                          \
       }                                                                        \
     }                                                                          \
-    t = array[l];                                                             \
+    t = array[l];                                                              \
     array[l] = array[last];                                                    \
     array[last] = t;                                                           \
     name##_sort_r(array, l, last-1, ctx, cmp);                                 \
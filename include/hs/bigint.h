@@ -57,7 +57,7 @@ hs_bigint_init(hs_bigint *bi, const size_t capa);
  * @return 0 on success, a non zero value on failure.
  */
 int
-hs_bigint_from_i32(hs_bigint *bi, const uint32_t value);
+hs_bigint_from_u32(hs_bigint *bi, const uint32_t value);
 
 /**
  * @brief starts and integer, from an int32.
@@ -89,6 +89,16 @@ hs_bigint_from_u64(hs_bigint *bi, const uint64_t value);
 int
 hs_bigint_from_i64(hs_bigint *bi, const int64_t value);
 
+/**
+ * @brief gets the value of an integer as an int64, if it fits.
+ *
+ * @param bi a big int pointer to convert.
+ * @param value A place to store the number.
+ * @return 0 on success, a non zero value if the number does not fit.
+ */
+int
+hs_bigint_to_i64(const hs_bigint *bi, int64_t *value);
+
 /**
  * @brief copys a bigint into another bigint.
  *
@@ -209,7 +219,7 @@ hs_bigint_div(const hs_bigint *a, const hs_bigint *b, hs_bigint *dst);
  * @brief performs a left shift, storing the result in dst. (dst = a << b)
  *
  * @param a The left number to shift.
- * @param b The number of times to shift a, b must be bigger than 0.
+ * @param b The number of times to shift a, b must not be negative.
  * @param dst a destination where the result is stored.
  * @return A non zero value on error, zero if the function succeeds
  * @warning remember to call hs_bigint_end() with dst if the functions succeeds.
@@ -222,7 +232,7 @@ hs_bigint_shl(const hs_bigint *a, const hs_bigint *b, hs_bigint *dst);
  * @brief performs a arithmetic right shift, storing the result in dst. (dst = a >> b)
  *
  * @param a The left number to shift.
- * @param b The number of times to shift a, b must be bigger than 0.
+ * @param b The number of times to shift a, b must not be negative.
  * @param dst a destination where the result is stored.
  * @return A non zero value on error, zero if the function succeeds
  * @warning remember to call hs_bigint_end() with dst if the functions succeeds.
@@ -235,7 +245,7 @@ hs_bigint_shr(const hs_bigint *a, const hs_bigint *b, hs_bigint *dst);
  * @brief performs a logical right shift, storing the result in dst. (dst = a >>> b)
  *
  * @param a The left number to shift.
- * @param b The number of times to shift a, b must be bigger than 0.
+ * @param b The number of times to shift a, b must not be negative.
  * @param dst a destination where the result is stored.
  * @return A non zero value on error, zero if the function succeeds
  * @warning remember to call hs_bigint_end() with dst if the functions succeeds.
@@ -465,7 +475,7 @@ hs_bigint_self_div(hs_bigint *a, const hs_bigint *b);
  * @brief performs a left shift between a and b, storing the result in a (a <<= b)
  *
  * @param a The left operand
- * @param b The right operand, must be bigger than zero.
+ * @param b The right operand, must not be negative.
  * @return A non zero value on error, zero if the function succeeds
  * @warning Please be aware than even if the function fails, the value in a may be altered
  * @see hs_bigint_shl
@@ -477,7 +487,7 @@ hs_bigint_self_shl(hs_bigint *a, const hs_bigint *b);
  * @brief performs a right arithmetic shift between a and b, storing the result in a (a >>= b)
  *
  * @param a The left operand
- * @param b The right operand, must be bigger than zero.
+ * @param b The right operand, must not be negative.
  * @return A non zero value on error, zero if the function succeeds
  * @warning Please be aware than even if the function fails, the value in a may be altered
  * @see hs_bigint_shr
@@ -489,7 +499,7 @@ hs_bigint_self_shr(hs_bigint *a, const hs_bigint *b);
  * @brief performs a  left logical shift between a and b, storing the result in a (a <<<= b)
  *
  * @param a The left operand
- * @param b The right operand, must be bigger than zero.
+ * @param b The right operand, must not be negative.
  * @return A non zero value on error, zero if the function succeeds
  * @warning Please be aware than even if the function fails, the value in a may be altered
  * @see hs_bigint_ushr
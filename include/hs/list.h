@@ -13,7 +13,11 @@
 
 #define HS_DEFINE_LIST(type, name)                                             \
                                                                                \
-  typedef struct { type value; struct name##_node *links[2]; } name_##node;    \
+  typedef struct name##_node                                                   \
+  {                                                                            \
+    type value;                                                                \
+    struct name##_node *links[2];                                              \
+  } name##_node;                                                               \
   typedef struct { size_t size; name##_node *first; name##_node *last; } name; \
                                                                                \
   int                                                                          \
@@ -23,7 +27,7 @@
   name##_end( name *list );                                                    \
                                                                                \
   size_t                                                                       \
-  name##_size( list );                                                         \
+  name##_size( name *list );                                                   \
                                                                                \
   int                                                                          \
   name##_insert( name *list, size_t at, type value );                          \
@@ -100,7 +104,7 @@
   }                                                                            \
                                                                                \
   size_t                                                                       \
-  name##_size( list )                                                          \
+  name##_size( name *list )                                                    \
   {                                                                            \
     return 0;                                                                  \
   }                                                                            \
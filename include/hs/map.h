@@ -34,7 +34,7 @@
   typedef struct { size_t size; N##_pair *root; N##_cmp cmp; void *ctx; } N;   \
                                                                                \
   int                                                                          \
-  N##_init( N *map N##_cmp cmp, void *ctx );                                   \
+  N##_init( N *map, N##_cmp cmp, void *ctx );                                  \
                                                                                \
   int                                                                          \
   N##_end( N *map );                                                           \
@@ -101,7 +101,7 @@
 #define HS_IMPLEMENT_MAP(K, V, N)                                              \
                                                                                \
   int                                                                          \
-  N##_init( N *map N##_cmp cmp, void *ctx )                                    \
+  N##_init( N *map, N##_cmp cmp, void *ctx )                                   \
   {                                                                            \
   }                                                                            \
                                                                                \
@@ -184,7 +184,7 @@
   HS_IMPLEMENT_ARRAY_EXTENSIONS( V, N##_value_array )                          \
   HS_IMPLEMENT_ARRAY_EXTENSIONS( N##_pair *, N##_pair_array )
   
-#define HS_DEFINE_MAP_ARRAY_ITERATORS(K, V, N)                                 \
+#define HS_IMPLEMENT_MAP_ARRAY_ITERATORS(K, V, N)                              \
                                                                                \
   HS_IMPLEMENT_ARRAY_ITERATORS( K, N##_key_array )                             \
   HS_IMPLEMENT_ARRAY_ITERATORS( V, N##_value_array )                           \
@@ -0,0 +1,452 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#ifndef HS_OBJECT_H
+#define HS_OBJECT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hs/types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hs_shape    hs_shape;
+typedef struct hs_instance hs_instance;
+
+/**
+ * @brief The integer operations that may not fit in an hs_int.
+ */
+typedef enum hs_integer_op
+{
+  HS_INTEGER_ADD,
+  HS_INTEGER_SUB,
+  HS_INTEGER_MUL,
+  /** Truncates towards zero, the divisor must not be zero */
+  HS_INTEGER_DIV,
+  /** The remainder of a division rounded down, it takes the divisor sign */
+  HS_INTEGER_MOD,
+  /** The remainder of HS_INTEGER_DIV, it takes the dividend sign */
+  HS_INTEGER_REM,
+  /** Raises to a power, negative ones give 0 unless the base is 1 or -1 */
+  HS_INTEGER_POW,
+  /** Shifts left, the count must not be negative */
+  HS_INTEGER_SHL,
+  /** Shifts right rounding down, the count must not be negative */
+  HS_INTEGER_SHR,
+  /** Shifts the low 32 bits right, as unsigned, and gives them as an
+   *  hs_int. The count must not be negative */
+  HS_INTEGER_LSR,
+  /** The bitwise operations work on two's complement, as if the sign bit
+   *  was repeated forever */
+  HS_INTEGER_AND,
+  HS_INTEGER_OR,
+  HS_INTEGER_XOR,
+  /** Gives -1, 0 or 1, always as a FIXINT */
+  HS_INTEGER_CMP
+} hs_integer_op;
+
+/**
+ * @brief The layout shared by objects with the same properties.
+ *
+ * A shape maps property names to slot indexes. Shapes form a tree: each one
+ * adds a single property to its parent, and remembers the shapes created
+ * from it (its transitions). Objects that get the same properties in the
+ * same order end on the same shape, so they only store their values.
+ */
+struct hs_shape
+{
+  /** The shape before the last property was added, NULL on the root */
+  hs_shape  *parent;
+  /** The property added by this shape */
+  hs_object  key;
+  /** The number of properties, the slot of key is size - 1 */
+  size_t     size;
+  /** The shapes created by adding a property to this one */
+  hs_shape **children;
+  size_t     child_count;
+  size_t     child_capa;
+};
+
+/**
+ * @brief An object created by HS_OP_NEW or HS_OP_EXTEND.
+ *
+ * An object made by HS_OP_EXTEND starts without properties of its own, and
+ * reads the ones it lacks from its prototype. Setting a property always
+ * stores it on the object itself, so the prototype is never written.
+ */
+struct hs_instance
+{
+  /** The shape giving the name of each slot */
+  hs_shape    *shape;
+  /** The values of the properties, in the order of the shape */
+  hs_object   *slots;
+  /** The number of slots allocated */
+  size_t       capa;
+  /** The object missing properties are read from, NULL if there is none */
+  hs_instance *proto;
+};
+
+/** @defgroup Shape functions
+ */
+/**@{ */
+/**
+ * @brief Creates an empty shape, the root of a shape tree.
+ *
+ * @return The new shape, or NULL if there is no memory.
+ */
+hs_shape *
+hs_shape_new(void);
+
+/**
+ * @brief Releases a shape, with every shape created from it.
+ *
+ * @param shape The root of the tree to release.
+ */
+void
+hs_shape_free(hs_shape *shape);
+
+/**
+ * @brief Finds the slot of a property.
+ *
+ * @param shape The shape to search.
+ * @param key The name of the property.
+ * @param slot A place to store the slot index.
+ * @return 0 if the property was found, a non zero value otherwise.
+ */
+int
+hs_shape_find(const hs_shape *shape, hs_object key, size_t *slot);
+
+/**
+ * @brief Gets the shape with one more property.
+ *
+ * The transition is created the first time, and reused after that.
+ *
+ * @param shape The shape to extend.
+ * @param key The name of the new property.
+ * @return The new shape, or NULL if there is no memory.
+ */
+hs_shape *
+hs_shape_add(hs_shape *shape, hs_object key);
+
+/**
+ * @brief Checks if two values name the same property.
+ *
+ * @param a The first name.
+ * @param b The second name.
+ * @return A non zero value if they are the same.
+ */
+int
+hs_key_equals(hs_object a, hs_object b);
+
+/**
+ * @brief Gets a hash of a property name.
+ *
+ * Names that are equal by hs_key_equals() always have the same hash.
+ *
+ * @param key The name.
+ * @return The hash of the name.
+ */
+size_t
+hs_key_hash(hs_object key);
+/**@} */
+
+/** @defgroup Instance functions
+ */
+/**@{ */
+/**
+ * @brief Creates an object without properties.
+ *
+ * @param root The empty shape the object starts with.
+ * @return The new object, or NULL if there is no memory.
+ */
+hs_instance *
+hs_instance_new(hs_shape *root);
+
+/**
+ * @brief Creates an object that inherits the properties of another.
+ *
+ * Nothing is copied: the new object reads through proto until each
+ * property is set on it, so proto must outlive it. Changes made to proto
+ * later are seen by the properties the object has not set.
+ *
+ * @param root The empty shape the object starts with.
+ * @param proto The object to inherit from.
+ * @return The new object, or NULL if there is no memory.
+ */
+hs_instance *
+hs_instance_extend(hs_shape *root, hs_instance *proto);
+
+/**
+ * @brief Creates an object with the same properties as another.
+ *
+ * The new object shares the shape and the prototype of proto, only the
+ * values are copied.
+ *
+ * @param proto The object to copy.
+ * @return The new object, or NULL if there is no memory.
+ */
+hs_instance *
+hs_instance_clone(const hs_instance *proto);
+
+/**
+ * @brief Releases an object.
+ *
+ * @param obj The object to release.
+ */
+void
+hs_instance_free(hs_instance *obj);
+
+/**
+ * @brief Gets a property of an object, or of its prototypes.
+ *
+ * @param obj The object.
+ * @param key The name of the property.
+ * @param dst A place to store the value.
+ * @return 0 on success, a non zero value if there is no such property.
+ */
+int
+hs_instance_get(const hs_instance *obj, hs_object key, hs_object *dst);
+
+/**
+ * @brief Sets a property of an object, adding it if needed.
+ *
+ * @param obj The object.
+ * @param key The name of the property.
+ * @param value The value to set.
+ * @return 0 on success, a non zero value if there is no memory.
+ */
+int
+hs_instance_set(hs_instance *obj, hs_object key, hs_object value);
+/**@} */
+
+/** @defgroup Object areas
+ *
+ * Values that don't fit in an hs_object are boxed, and every box belongs
+ * to an area. Boxes are shared by copying the hs_object, so none of them
+ * is released on its own: they all live until their area ends.
+ */
+/**@{ */
+/**
+ * @brief Starts an empty area.
+ *
+ * @param area The area.
+ */
+void
+hs_object_area_init(hs_object_area *area);
+
+/**
+ * @brief Creates a box owned by an area, with its value zeroed.
+ *
+ * @param area The area.
+ * @param type The type of the value the box will hold.
+ * @return The box, NULL if there is no memory.
+ */
+hs_box *
+hs_object_area_box(hs_object_area *area, hs_object_type type);
+
+/**
+ * @brief Releases every box of an area, and the values they hold.
+ *
+ * @param area The area.
+ */
+void
+hs_object_area_end(hs_object_area *area);
+/**@} */
+
+/** @defgroup Integer functions
+ *
+ * Integers are FIXINTs while they fit in an hs_int, and BIGINTs, boxing an
+ * hs_bigint, when they don't. A result always takes the smallest of both.
+ */
+/**@{ */
+/**
+ * @brief Stores an integer, as a BIGINT if it does not fit in an hs_int.
+ *
+ * @param area The area owning the box of a BIGINT.
+ * @param dst A place to store the integer.
+ * @param value The value.
+ * @return 0 on success, a non zero value if there is no memory.
+ */
+int
+hs_integer_from_i64(hs_object_area *area, hs_object *dst, int64_t value);
+
+/**
+ * @brief Runs an operation on two integers of any size.
+ *
+ * The virtual machine does it on FIXINTs itself, and only calls this when
+ * the result leaves hs_int or an operand is a BIGINT.
+ *
+ * @param area The area owning the box of a BIGINT result.
+ * @param dst A place to store the result, a FIXINT when it fits.
+ * @param a The left operand, a FIXINT or a BIGINT.
+ * @param b The right operand, a FIXINT or a BIGINT.
+ * @param op The operation.
+ * @return 0 on success, a non zero value if there is no memory, the
+ *         divisor is zero or a shift count is negative.
+ */
+int
+hs_integer_compute(hs_object_area *area, hs_object *dst, hs_object a,
+                   hs_object b, hs_integer_op op);
+
+/**
+ * @brief Gets the sign of an integer.
+ *
+ * @param a A FIXINT or a BIGINT.
+ * @return -1 if a is negative, 0 if it is zero and 1 if it is positive.
+ */
+int
+hs_integer_sign(hs_object a);
+
+/**
+ * @brief Converts an integer to the nearest float.
+ *
+ * @param a A FIXINT or a BIGINT.
+ * @return The float, an infinity if a is out of the range of hs_float.
+ */
+hs_float
+hs_integer_to_float(hs_object a);
+/**@} */
+
+/** @defgroup Array functions
+ *
+ * An HS_OBJECT_ARRAY boxes an hs_elements. Indexes go from 0 to the size,
+ * and storing on the index equal to the size appends an element.
+ */
+/**@{ */
+/**
+ * @brief Creates an empty array.
+ *
+ * @param area The area owning the box of the array.
+ * @param dst A place to store the array.
+ * @param capa The number of elements to make room for.
+ * @return 0 on success, a non zero value if there is no memory.
+ */
+int
+hs_elements_new(hs_object_area *area, hs_object *dst, size_t capa);
+
+/**
+ * @brief Releases the elements of an array, leaving it empty.
+ *
+ * @param el The elements.
+ */
+void
+hs_elements_end(hs_elements *el);
+
+/**
+ * @brief Gets an element of an array.
+ *
+ * @param el The elements.
+ * @param at The index of the element.
+ * @param dst A place to store the value.
+ * @return 0 on success, a non zero value if at is out of range.
+ */
+int
+hs_elements_get(const hs_elements *el, size_t at, hs_object *dst);
+
+/**
+ * @brief Sets or appends an element of an array.
+ *
+ * Moves the array to a more general kind when its kind can't hold value.
+ *
+ * @param el The elements.
+ * @param at The index of the element, up to the size of the array.
+ * @param value The value to store.
+ * @return 0 on success, a non zero value if at is out of range or there is
+ *         no memory.
+ */
+int
+hs_elements_set(hs_elements *el, size_t at, hs_object value);
+
+/**
+ * @brief Removes an element of an array, moving the next ones down.
+ *
+ * @param el The elements.
+ * @param at The index of the element.
+ * @return 0 on success, a non zero value if at is out of range.
+ */
+int
+hs_elements_remove(hs_elements *el, size_t at);
+/**@} */
+
+/** @defgroup Range functions
+ *
+ * Ranges are integer sequences, like 1..10, 1...10 and 1..10\2. They are
+ * never stored as arrays: each operation works on the first element, the
+ * step and the size.
+ */
+/**@{ */
+/**
+ * @brief Sets up a range between two integers, by steps of one.
+ *
+ * The range goes up when bound is not below first, and down otherwise.
+ * Elements are indexed by an hs_int, so a range holds at most INT32_MAX of
+ * them, and steps and slices only make it smaller.
+ *
+ * @param r The range.
+ * @param first The first element.
+ * @param bound The last element, or the first one left out if exclusive.
+ * @param exclusive Non zero to leave bound out, like a...b.
+ * @return 0 on success, a non zero value if the range would hold more than
+ *         INT32_MAX elements.
+ */
+int
+hs_range_init(hs_range *r, hs_int first, hs_int bound, int exclusive);
+
+/**
+ * @brief Keeps every step-th element of a range, like a..b\step.
+ *
+ * @param r The range.
+ * @param step The number of elements from each one kept to the next.
+ * @return 0 on success, a non zero value if step is below one.
+ */
+int
+hs_range_step(hs_range *r, hs_int step);
+
+/**
+ * @brief Gets the elements of a range at the indexes given by another.
+ *
+ * @param dst A place to store the slice, can be r or indexes.
+ * @param r The range.
+ * @param indexes The indexes to keep.
+ * @return 0 on success, a non zero value if an index is out of r.
+ */
+int
+hs_range_slice(hs_range *dst, const hs_range *r, const hs_range *indexes);
+
+/**
+ * @brief Checks if a value is an element of a range.
+ *
+ * @param r The range.
+ * @param value The value.
+ * @return A non zero value if it is.
+ */
+int
+hs_range_includes(const hs_range *r, hs_int value);
+
+/**
+ * @brief Stores a range on an HS_OBJECT_RANGE.
+ *
+ * @param area The area owning the box of the range.
+ * @param dst A place to store the object.
+ * @param r The range to copy.
+ * @return 0 on success, a non zero value if there is no memory.
+ */
+int
+hs_range_new(hs_object_area *area, hs_object *dst, const hs_range *r);
+/**@} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HS_OBJECT_H */
@@ -9,8 +9,11 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 #ifndef HS_OPCODE_H
+#define HS_OPCODE_H
 
-#define __cplusplus
+#include <stdint.h>
+
+#ifdef __cplusplus
 extern "C" {
 #endif
 
@@ -19,6 +22,7 @@ enum hs_opcode
   HS_OP_NOP                       =   1, /* wait() */
   HS_OP_BREAKPOINT                =   2, /* breakpoint() */
   HS_OP_HALT                      =   3, /* halt() */
+  HS_OP_EXTRA_ARG                 =   4, /* extra( <int24> ) */
  
   HS_OP_LOAD_NULL                 =  10, /* <reg> <- null */
   HS_OP_LOAD_FALSE                =  11, /* <reg> <- false */
@@ -32,6 +36,8 @@ enum hs_opcode
   HS_OP_LOAD_LOCAL_CONST          =  19, /* <reg> <- module [ <uint16> ] */
   HS_OP_LOAD_LOCAL_CONST_INDIRECT =  20, /* <reg> <- module [ <reg> ] */
   HS_OP_LOAD_INT_CONST            =  21, /* <reg> <- <uint16> */
+  HS_OP_LOAD_CONST_WIDE           =  22, /* <reg> <- module [ extra ] */
+  HS_OP_LOAD_INT_WIDE             =  23, /* <reg> <- extra */
   
   HS_OP_STORE_LOCAL               =  30, /* context [ <uint16> ] <- <reg> */
   HS_OP_STORE_LOCAL_INDIRECT      =  31, /* context [ <reg> ] <- <reg> */
@@ -69,6 +75,9 @@ enum hs_opcode
   HS_OP_RETURN                    =  90, /* return( <reg> ) */
   HS_OP_RETURN_NULL               =  91, /* return( null ) */
   HS_OP_RETURN_SELF               =  92, /* return( self ) */
+  HS_OP_TAIL_CALL                 =  93, /* return( call( this, <reg> ) ) */
+  HS_OP_TAIL_LOCAL_CALL           =  94, /* return( call( module, <reg> ) ) */
+  HS_OP_TAIL_DYNAMIC_CALL         =  95, /* return( call( <reg>, <reg> ) ) */
   
   HS_OP_RESERVE_ARGS              = 100, /* arguments.push( <uint16> ) */
   HS_OP_RESERVE_ARGS_INDIRECT     = 101, /* arguments.push( <reg> ) */
@@ -77,6 +86,9 @@ enum hs_opcode
   HS_OP_CALL                      = 104, /* <reg> <- call( this, <reg> )  */
   HS_OP_LOCAL_CALL                = 105, /* <reg> <- call( module, <reg> )  */
   HS_OP_DYNAMIC_CALL              = 106, /* <reg> <- call( <reg>, <reg> )  */
+  HS_OP_CALL_SITE                 = 107, /* <reg> <- call( this, site <uint16> ) */
+  HS_OP_LOCAL_CALL_SITE           = 108, /* <reg> <- call( module, site <uint16> ) */
+  HS_OP_DYNAMIC_CALL_SITE         = 109, /* <reg> <- call( site <uint16> ) */
   
   HS_OP_SET_THIS                  = 110, /* this   <- <reg> */
   HS_OP_SET_MODULE                = 111, /* module <- <reg> */
@@ -89,6 +101,11 @@ enum hs_opcode
   HS_OP_BOOL_XOR                  = 132, /* <reg> <- bool : <reg> ^ <reg> */
   HS_OP_BOOL_CMP                  = 133, /* <reg> <- bool : <reg> <=> <reg> */
   HS_OP_BOOL_NOT                  = 134, /* <reg> <- bool : not <reg> */
+  HS_OP_ADD                       = 135, /* <reg> <- <reg> + <reg> */
+  HS_OP_SUB                       = 136, /* <reg> <- <reg> - <reg> */
+  HS_OP_MUL                       = 137, /* <reg> <- <reg> * <reg> */
+  HS_OP_DIV                       = 138, /* <reg> <- <reg> / <reg> */
+  HS_OP_CMP                       = 139, /* <reg> <- <reg> <=> <reg> */
   
   HS_OP_INT_ADD                   = 140, /* <reg> <- int : <reg> + <reg> */
   HS_OP_INT_SUB                   = 141, /* <reg> <- int : <reg> - <reg> */
@@ -106,7 +123,7 @@ enum hs_opcode
   HS_OP_INT_CMP                   = 153, /* <reg> <- int : <reg> <=> <reg> */
   HS_OP_INT_NEG                   = 154, /* <reg> <- int : -<reg> */
   HS_OP_INT_CPL                   = 155, /* <reg> <- int : ~<reg> */
-  HS_OP_INT_POW                   = 142, /* <reg> <- int : <reg> ** <reg> */
+  HS_OP_INT_POW                   = 156, /* <reg> <- int : <reg> ** <reg> */
   
   HS_OP_FLOAT_ADD                 = 160, /* <reg> <- float : <reg> + <reg> */
   HS_OP_FLOAT_SUB                 = 161, /* <reg> <- float : <reg> - <reg> */
@@ -149,6 +166,11 @@ enum hs_opcode
   HS_OP_ARRAY_GET                 = 222, /* <reg> <- <reg>[<reg>] */
   HS_OP_ARRAY_SET                 = 223, /* <reg> [<reg>] <- <reg> */
   HS_OP_ARRAY_DELETE              = 224, /* delete( <reg>[<reg>] ) */
+  HS_OP_RANGE_NEW                 = 225, /* <reg> <- <reg> .. <reg> */
+  HS_OP_RANGE_NEW_EXCLUSIVE       = 226, /* <reg> <- <reg> ... <reg> */
+  HS_OP_RANGE_STEP                = 227, /* <reg> <- <reg> \ <reg> */
+  HS_OP_RANGE_INCLUDES            = 228, /* <reg> <- <reg> includes <reg> */
+  HS_OP_FOR_IN                    = 229, /* for <reg> in <reg> at <reg> */
   
   HS_OP_NEW_TRY_CONTEXT           = 230, /* try( <uint16> ) */
   HS_OP_NEW_TRY_CONTEXT_INDIRECT  = 231, /* try( <reg> ) */
@@ -168,8 +190,66 @@ enum hs_opcode
   
   HS_OP_END_BYTECODE              = 255, /* (no opcode, auto appended) */
   
+  /* Superinstructions, they don't fit in an opcode, so they are only created
+   * by the virtual machine when a function is loaded. */
+  
+  HS_OP_LOCAL_INT_INC             = 256, /* <reg> <- inc( context [ <uint16> ] ) */
+  HS_OP_LOCAL_INT_DEC             = 257, /* <reg> <- dec( context [ <uint16> ] ) */
+  HS_OP_INT_JUMP_EQ               = 258, /* if <reg> = <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_NE               = 259, /* if <reg> <> <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_LT               = 260, /* if <reg> < <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_LE               = 261, /* if <reg> <= <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_GT               = 262, /* if <reg> > <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_GE               = 263, /* if <reg> >= <reg> then jump( <uint16> ) */
+  HS_OP_LOCAL_LOAD_CALL           = 264, /* <reg> <- call( module, context [ <uint16> ] ) */
+  /* Quickened forms of the generic opcodes, they guard the operand types and
+   * go back to the generic opcode when the guard fails. */
+  HS_OP_ADD_INT                   = 265, /* <reg> <- int : <reg> + <reg> */
+  HS_OP_ADD_FLOAT                 = 266, /* <reg> <- float : <reg> + <reg> */
+  HS_OP_SUB_INT                   = 267, /* <reg> <- int : <reg> - <reg> */
+  HS_OP_SUB_FLOAT                 = 268, /* <reg> <- float : <reg> - <reg> */
+  HS_OP_MUL_INT                   = 269, /* <reg> <- int : <reg> * <reg> */
+  HS_OP_MUL_FLOAT                 = 270, /* <reg> <- float : <reg> * <reg> */
+  HS_OP_DIV_INT                   = 271, /* <reg> <- int : <reg> / <reg> */
+  HS_OP_DIV_FLOAT                 = 272, /* <reg> <- float : <reg> / <reg> */
+  HS_OP_CMP_INT                   = 273, /* <reg> <- int : <reg> <=> <reg> */
+  HS_OP_CMP_FLOAT                 = 274, /* <reg> <- float : <reg> <=> <reg> */
+  HS_OP_FIELD_CALL                = 275, /* <reg> <- call( this, this [ <uint16> ] ) */
+  /* Forms without runtime checks, used where the verifier proved the
+   * operand types, or the depth of the stack, when the code was loaded. */
+  HS_OP_INT_ADD_UNCHECKED         = 276, /* <reg> <- int : <reg> + <reg> */
+  HS_OP_INT_SUB_UNCHECKED         = 277, /* <reg> <- int : <reg> - <reg> */
+  HS_OP_INT_MUL_UNCHECKED         = 278, /* <reg> <- int : <reg> * <reg> */
+  HS_OP_INT_AND_UNCHECKED         = 279, /* <reg> <- int : <reg> & <reg> */
+  HS_OP_INT_OR_UNCHECKED          = 280, /* <reg> <- int : <reg> | <reg> */
+  HS_OP_INT_XOR_UNCHECKED         = 281, /* <reg> <- int : <reg> ^ <reg> */
+  HS_OP_INT_CMP_UNCHECKED         = 282, /* <reg> <- int : <reg> <=> <reg> */
+  HS_OP_INT_INC_UNCHECKED         = 283, /* inc( int : <reg> ) */
+  HS_OP_INT_DEC_UNCHECKED         = 284, /* dec( int : <reg> ) */
+  HS_OP_FLOAT_ADD_UNCHECKED       = 285, /* <reg> <- float : <reg> + <reg> */
+  HS_OP_FLOAT_SUB_UNCHECKED       = 286, /* <reg> <- float : <reg> - <reg> */
+  HS_OP_FLOAT_MUL_UNCHECKED       = 287, /* <reg> <- float : <reg> * <reg> */
+  HS_OP_FLOAT_DIV_UNCHECKED       = 288, /* <reg> <- float : <reg> / <reg> */
+  HS_OP_JUMP_EQ_ZERO_UNCHECKED    = 289, /* if <reg> = 0 then jump( <uint16> ) */
+  HS_OP_JUMP_NE_ZERO_UNCHECKED    = 290, /* if <reg> <> 0 then jump( <uint16> ) */
+  HS_OP_JUMP_LT_ZERO_UNCHECKED    = 291, /* if <reg> < 0 then jump( <uint16> ) */
+  HS_OP_JUMP_LE_ZERO_UNCHECKED    = 292, /* if <reg> <= 0 then jump( <uint16> ) */
+  HS_OP_JUMP_GT_ZERO_UNCHECKED    = 293, /* if <reg> > 0 then jump( <uint16> ) */
+  HS_OP_JUMP_GE_ZERO_UNCHECKED    = 294, /* if <reg> >= 0 then jump( <uint16> ) */
+  HS_OP_INT_JUMP_EQ_UNCHECKED     = 295, /* if <reg> = <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_NE_UNCHECKED     = 296, /* if <reg> <> <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_LT_UNCHECKED     = 297, /* if <reg> < <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_LE_UNCHECKED     = 298, /* if <reg> <= <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_GT_UNCHECKED     = 299, /* if <reg> > <reg> then jump( <uint16> ) */
+  HS_OP_INT_JUMP_GE_UNCHECKED     = 300, /* if <reg> >= <reg> then jump( <uint16> ) */
+  HS_OP_STACK_POP_UNCHECKED       = 301, /* <reg> <- stack.pop() */
+  HS_OP_STACK_PEEK_UNCHECKED      = 302, /* <reg> <- stack.peek() */
+  
 };
 
+/* The number of opcodes, including superinstructions */
+#define HS_OPCODE_COUNT 303
+
 /* This file:
  *
  *  1 | x : 2
@@ -218,15 +298,18 @@ extern const char HS_OPCODE_PARAM_TYPE[];
 #define HS_OPCODE_THREE_REG_PARAMS 3
 #define HS_OPCODE_UINT_PARAMS 4
 #define HS_OPCODE_UINT_AND_REG_PARAMS 5
+/* The 24 bits of HS_OP_EXTRA_ARG, u8[0] holds the highest byte */
+#define HS_OPCODE_INT24_PARAMS 6
 
 #define HS_OP_DECODE(opcode, instruction, params)                              \
   do                                                                           \
   {                                                                            \
     uint32_t o_opcode_ = (opcode);                                             \
     uint16_t o_ta_, o_tb_;                                                     \
-    instruction = (uint8_t)( ( o_opcode_ >> 24) && 255 );                      \
+    instruction = (uint8_t)( ( o_opcode_ >> 24) & 255 );                       \
     switch (HS_OPCODE_PARAM_TYPE[instruction])                                 \
-    {                                                                          \                                                               \
+    {                                                                          \
+      case HS_OPCODE_INT24_PARAMS:                                             \
       case HS_OPCODE_THREE_REG_PARAMS:                                         \
         (params).u8[2] = (uint8_t)(  o_opcode_        & 255 );                 \
       case HS_OPCODE_TWO_REG_PARAMS:                                           \
@@ -249,20 +332,21 @@ extern const char HS_OPCODE_PARAM_TYPE[];
 #define HS_OP_ENCODE(instruction, params, opcode)                              \
   do                                                                           \
   {                                                                            \
-    opcode = ( ((instruction) & 255) << 24 );                                  \
+    opcode = ( ((uint32_t)(instruction) & 255) << 24 );                        \
     switch (HS_OPCODE_PARAM_TYPE[instruction])                                 \
     {                                                                          \
+      case HS_OPCODE_INT24_PARAMS:                                             \
       case HS_OPCODE_THREE_REG_PARAMS:                                         \
         opcode |= (params).u8[2];                                              \
       case HS_OPCODE_TWO_REG_PARAMS:                                           \
         opcode |= (params).u8[1] << 8;                                         \
       case HS_OPCODE_ONE_REG_PARAMS:                                           \
-        opcode |= (params).u8[1] << 16;                                        \
+        opcode |= (params).u8[0] << 16;                                        \
         break;                                                                 \
       case HS_OPCODE_UINT_AND_REG_PARAMS:                                      \
         opcode |= (params).set.u8 << 16;                                       \
       case HS_OPCODE_UINT_PARAMS:                                              \
-        opcode |= ( (params).set.u16 << 8 ) << 8;                              \
+        opcode |= ( ( (params).set.u16 >> 8 ) & 255 ) << 8;                    \
         opcode |= (params).set.u16 & 255;                                      \
         break;                                                                 \
       default:                                                                 \
@@ -271,7 +355,7 @@ extern const char HS_OPCODE_PARAM_TYPE[];
   }                                                                            \
   while (0)
     
-#define __cplusplus
+#ifdef __cplusplus
 }
 #endif
 
@@ -0,0 +1,57 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#ifndef HS_SET_H
+#define HS_SET_H
+
+#include <hs/array.h>
+
+/** @defgroup Set functions
+ *
+ *  This set generates the basic functions to use a set.
+ *  Arguments:
+ *    - type : the type of the values of the set
+ *    - name : the name the set will receive
+ *
+ *  The values are kept sorted by the comparator given to name_init(), so
+ *  a lookup is a binary search.
+ *
+ *  @{
+ */
+
+#define HS_DEFINE_SET(type, name)                                              \
+                                                                               \
+  typedef int ( *name##_cmp )( void*, type, type );                            \
+  typedef struct                                                               \
+  {                                                                            \
+    size_t size; size_t capa; type *data; name##_cmp cmp; void *ctx;           \
+  } name;                                                                      \
+                                                                               \
+  int                                                                          \
+  name##_init( name *set, name##_cmp cmp, void *ctx );                         \
+                                                                               \
+  void                                                                         \
+  name##_end( name *set );                                                     \
+                                                                               \
+  size_t                                                                       \
+  name##_size( name *set );                                                    \
+                                                                               \
+  int                                                                          \
+  name##_has( name *set, type value );                                         \
+                                                                               \
+  int                                                                          \
+  name##_add( name *set, type value );                                         \
+                                                                               \
+  int                                                                          \
+  name##_remove( name *set, type value );
+
+/** @} */
+
+#endif /* HS_SET_H */
@@ -1,32 +1,125 @@
-/* Humming Script - Collection of libraries to build a scripting language
- * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
- *
- * To the extent possible under law, the author(s) have dedicated all copyright 
- * and related and neighboring rights to this software to the public domain 
- * worldwide. This software is distributed without any warranty.
- * You should have received a copy of the CC0 Public Domain Dedication along 
- * with this software. If not, see 
- * <http://creativecommons.org/publicdomain/zero/1.0/>.
- */
 #ifndef HS_STRING_H
 #define HS_STRING_H
 
 #include <stdlib.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct hs_string hs_string;
 
+struct hs_object;
 
+/** The longest text a string holds inside itself, without the null */
+#define HS_STRING_INLINE 23
 
+/*
+ * A null terminated text. Short ones live in the string itself, so they
+ * take no allocation of their own; only longer texts go to the heap. Read
+ * the characters with HS_STRING_DATA(), which picks the member by size.
+ */
 struct hs_string
 {
+  /** The number of characters, without the null */
   size_t size;
-  char  *data;
+  union
+  {
+    /** The characters, when size > HS_STRING_INLINE */
+    char *heap;
+    /** The characters, when size <= HS_STRING_INLINE */
+    char  local[HS_STRING_INLINE + 1];
+  } data;
 };
 
+#define HS_STRING_DATA(s)                                                      \
+  ( (s)->size <= HS_STRING_INLINE ? (s)->data.local : (s)->data.heap )
+
+/**
+ * @brief Copies a null terminated string.
+ *
+ * @param str The string to initialize.
+ * @param data The characters to copy.
+ * @return zero on success, a non zero value on error.
+ */
 int
 hs_string_init(hs_string *str, const char *data);
 
+/**
+ * @brief Copies some characters, that may hold null characters.
+ *
+ * @param str The string to initialize.
+ * @param data The characters to copy.
+ * @param size The number of characters.
+ * @return zero on success, a non zero value on error.
+ */
+int
+hs_string_init_size(hs_string *str, const char *data, size_t size);
+
+/**
+ * @brief Releases the characters of a string.
+ *
+ * @param str The string to end.
+ */
 void
 hs_string_end(hs_string *str);
 
-#endif /* HS_STRING_H */
\ No newline at end of file
+/** @defgroup String interning
+ *
+ *  Every HS_OBJECT_STRING is interned: a single box holds each text, shared
+ *  by the whole process. Identifiers, field names and map keys are then
+ *  compared by pointer, which keeps shape transitions and inline caches to
+ *  a single compare. The lexer, the constant pool of a module and native
+ *  code looking up a property should all build their strings here.
+ *  @{
+ */
+/**
+ * @brief Prepares the table of interned strings.
+ *
+ * Call it once, before any thread interns a string.
+ *
+ * @return zero on success, a non zero value on error.
+ */
+int
+hs_intern_init(void);
+
+/**
+ * @brief Releases the table, with every interned string.
+ *
+ * Call it once no thread uses strings anymore. Without a table, it does
+ * nothing.
+ */
+void
+hs_intern_end(void);
+
+/**
+ * @brief Gets the string holding some text.
+ *
+ * The first call with a text creates its box, and later ones give the same
+ * box back. It is safe to call from several threads at once.
+ *
+ * @param dst A place to store the HS_OBJECT_STRING.
+ * @param data The characters of the text, it may hold null characters.
+ * @param size The number of characters.
+ * @return zero on success, a non zero value on error, or if the table was
+ *         not prepared with hs_intern_init().
+ */
+int
+hs_intern(struct hs_object *dst, const char *data, size_t size);
+
+/**
+ * @brief Gets the string holding a null terminated text.
+ *
+ * @param dst A place to store the HS_OBJECT_STRING.
+ * @param data The characters of the text.
+ * @return zero on success, a non zero value on error.
+ */
+int
+hs_intern_cstr(struct hs_object *dst, const char *data);
+/**@} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HS_STRING_H */
@@ -24,7 +24,7 @@ typedef int (*hs_thread_func)(void *);
 typedef HANDLE hs_mutex;
 
 #else
-#include <pthreads.h>
+#include <pthread.h>
 
 /** The type used for mutex objects on POSIX-like systems. */
 typedef pthread_mutex_t hs_mutex;
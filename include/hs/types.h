@@ -15,6 +15,7 @@
 #include <stdlib.h>
 
 #include "hs/bigint.h"
+#include "hs/string.h"
 #include "hs/array.h"
 #include "hs/list.h"
 #include "hs/set.h"
@@ -27,16 +28,104 @@ struct hs_state;
 
 typedef struct hs_object hs_object;
 typedef struct hs_state hs_state;
-
-HS_DEFINE_ARRAY(hs_object, hs_array)
-HS_DEFINE_LIST(hs_object, hs_array)
-HS_DEFINE_SET(hs_object, hs_array)
-HS_DEFINE_MAP(hs_object, hs_object, hs_array)
+typedef struct hs_box hs_box;
+typedef struct hs_object_area hs_object_area;
 
 typedef int (*hs_native_fn)(hs_state *, hs_object *);
 
 
 
+/** The type of a value, read with HS_TAG() */
+typedef enum hs_object_type
+{
+  
+  HS_OBJECT_NULL,
+  HS_OBJECT_BOOLEAN,
+  
+  HS_OBJECT_FIXINT,
+  HS_OBJECT_BIGINT,
+  
+  HS_OBJECT_FLOAT,
+  HS_OBJECT_BIGDECIMAL,
+  
+  HS_OBJECT_STRING,
+  
+  HS_OBJECT_ARRAY,
+  HS_OBJECT_LIST,
+  HS_OBJECT_SET,
+  HS_OBJECT_MAP,
+  HS_OBJECT_RANGE,
+  
+  HS_OBJECT_NATIVE_FUNCTION,
+  HS_OBJECT_CODE_FUNCTION,
+  
+  HS_OBJECT_BOXED,
+  
+  HS_OBJECT_INSTANCE,
+  
+  HS_OBJECT_CUSTOM,
+  
+} hs_object_type;
+
+/*
+ * A value is read and written with the HS_TAG(), HS_AS_*() and HS_SET_*()
+ * macros, so the code works with both layouts. Setters may evaluate the
+ * object more than once. Zeroed memory holds nulls on both.
+ */
+#ifdef HS_NAN_BOXING
+
+/*
+ * One 64 bit word, laid out like the NaN space of a double: the tag on the
+ * top 16 bits, the payload on the low 48. Integers and floats keep their
+ * 32 bits on the low half, pointers their address, which user space keeps
+ * under 48 bits.
+ */
+struct hs_object
+{
+  uint64_t bits;
+};
+
+/* The bits of a float, to move it in and out of the payload */
+typedef union hs_float_bits
+{
+  hs_float value;
+  uint32_t bits;
+} hs_float_bits;
+
+#define HS_NAN_TAG(t)       ( (uint64_t)(t) << 48 )
+#define HS_NAN_PAYLOAD      UINT64_C(0xFFFFFFFFFFFF)
+#define HS_NAN_POINTER(o, type)                                                \
+  ( (type)(uintptr_t)( (o).bits & HS_NAN_PAYLOAD ) )
+
+#define HS_TAG(o)           ( (hs_object_type)( (o).bits >> 48 ) )
+#define HS_AS_INT(o)        ( (hs_int)(uint32_t)(o).bits )
+#define HS_AS_FLOAT(o)                                                         \
+  ( ( (hs_float_bits){ .bits = (uint32_t)(o).bits } ).value )
+#define HS_AS_NATIVE_FN(o)  HS_NAN_POINTER(o, hs_native_fn)
+#define HS_AS_CLOSURE(o)    HS_NAN_POINTER(o, struct hs_closure *)
+#define HS_AS_INSTANCE(o)   HS_NAN_POINTER(o, struct hs_instance *)
+#define HS_AS_BOX(o)        HS_NAN_POINTER(o, struct hs_box *)
+
+#define HS_SET_NULL(o)      ( (o).bits = 0 )
+#define HS_SET_BOOL(o, v)                                                      \
+  ( (o).bits = HS_NAN_TAG(HS_OBJECT_BOOLEAN) | (uint64_t)!!(v) )
+#define HS_SET_INT(o, v)                                                       \
+  ( (o).bits = HS_NAN_TAG(HS_OBJECT_FIXINT) | (uint32_t)(hs_int)(v) )
+#define HS_SET_FLOAT(o, v)                                                     \
+  ( (o).bits = HS_NAN_TAG(HS_OBJECT_FLOAT) |                                   \
+               ( (hs_float_bits){ .value = (v) } ).bits )
+#define HS_SET_POINTER(o, t, p)                                                \
+  ( (o).bits = HS_NAN_TAG(t) | (uint64_t)(uintptr_t)(p) )
+#define HS_SET_NATIVE_FN(o, f) HS_SET_POINTER(o, HS_OBJECT_NATIVE_FUNCTION, f)
+#define HS_SET_CLOSURE(o, p)   HS_SET_POINTER(o, HS_OBJECT_CODE_FUNCTION, p)
+#define HS_SET_INSTANCE(o, p)  HS_SET_POINTER(o, HS_OBJECT_INSTANCE, p)
+#define HS_SET_BOX(o, t, p)    HS_SET_POINTER(o, t, p)
+
+#else
+
+/*
+ * A payload and a tag, 16 bytes with padding.
+ */
 struct hs_object
 {
   union
@@ -44,49 +133,118 @@ struct hs_object
     hs_int         as_int;
     hs_float       as_float;
     hs_native_fn   as_native_fn;
+    struct hs_closure *as_closure;
+    struct hs_instance *as_instance;
     struct hs_box *as_box;
   } value;
-  enum
+  hs_object_type tag;
+};
+
+#define HS_TAG(o)           ( (o).tag )
+#define HS_AS_INT(o)        ( (o).value.as_int )
+#define HS_AS_FLOAT(o)      ( (o).value.as_float )
+#define HS_AS_NATIVE_FN(o)  ( (o).value.as_native_fn )
+#define HS_AS_CLOSURE(o)    ( (o).value.as_closure )
+#define HS_AS_INSTANCE(o)   ( (o).value.as_instance )
+#define HS_AS_BOX(o)        ( (o).value.as_box )
+
+#define HS_SET_NULL(o)      ( (o).tag = HS_OBJECT_NULL )
+#define HS_SET_BOOL(o, v)                                                      \
+  ( (o).tag = HS_OBJECT_BOOLEAN, (o).value.as_int = !!(v) )
+#define HS_SET_INT(o, v)                                                       \
+  ( (o).tag = HS_OBJECT_FIXINT, (o).value.as_int = (v) )
+#define HS_SET_FLOAT(o, v)                                                     \
+  ( (o).tag = HS_OBJECT_FLOAT, (o).value.as_float = (v) )
+#define HS_SET_NATIVE_FN(o, f)                                                 \
+  ( (o).tag = HS_OBJECT_NATIVE_FUNCTION, (o).value.as_native_fn = (f) )
+#define HS_SET_CLOSURE(o, p)                                                   \
+  ( (o).tag = HS_OBJECT_CODE_FUNCTION, (o).value.as_closure = (p) )
+#define HS_SET_INSTANCE(o, p)                                                  \
+  ( (o).tag = HS_OBJECT_INSTANCE, (o).value.as_instance = (p) )
+#define HS_SET_BOX(o, t, p)                                                    \
+  ( (o).tag = (t), (o).value.as_box = (p) )
+
+#endif
+
+/* The containers hold values, so they come after hs_object is complete */
+HS_DEFINE_ARRAY(hs_object, hs_array)
+HS_DEFINE_LIST(hs_object, hs_list)
+HS_DEFINE_SET(hs_object, hs_set)
+HS_DEFINE_MAP(hs_object, hs_object, hs_map)
+
+/** The kind of the elements of an array, from the most packed */
+typedef enum hs_elements_kind
+{
+  HS_ELEMENTS_INT,     /* hs_int values, without tags */
+  HS_ELEMENTS_FLOAT,   /* hs_float values, without tags */
+  HS_ELEMENTS_GENERIC  /* hs_object values of any type */
+} hs_elements_kind;
+
+/*
+ * The values of an HS_OBJECT_ARRAY. An empty array takes the kind of the
+ * first value stored, and integers and floats stay packed while every
+ * element has that type. Storing a value of another type moves the whole
+ * array to HS_ELEMENTS_GENERIC.
+ */
+typedef struct hs_elements
+{
+  /** Which member of data holds the elements */
+  hs_elements_kind kind;
+  /** The number of elements */
+  size_t           size;
+  /** The number of elements allocated, in the width of the kind */
+  size_t           capa;
+  /** The elements, read through the member of the kind */
+  union
   {
-    
-    HS_OBJECT_
-    
-    HS_OBJECT_FIXINT,
-    HS_OBJECT_BIGINT,
-    
-    HS_OBJECT_FLOAT,
-    HS_OBJECT_BIGDECIMAL,
-    
-    HS_OBJECT_STRING,
-    
-    HS_OBJECT_ARRAY,
-    HS_OBJECT_LIST,
-    HS_OBJECT_SET,
-    HS_OBJECT_MAP,
-    
-    HS_OBJECT_NATIVE_FUNCTION,
-    HS_OBJECT_CODE_FUNCTION,
-    
-    HS_OBJECT_BOXED,
-    
-    HS_OBJECT_CUSTOM,
-    
-  } tag;
+    hs_int    *as_int;
+    hs_float  *as_float;
+    hs_object *as_object;
+  } data;
+} hs_elements;
 
-};
+/*
+ * The values of an HS_OBJECT_RANGE: element i is first + i * step, worked
+ * out when it is read, so a range takes the same memory at any size.
+ */
+typedef struct hs_range
+{
+  /** The first element */
+  hs_int  first;
+  /** The number of elements */
+  int64_t size;
+  /** The distance from each element to the next one, never zero */
+  int64_t step;
+} hs_range;
 
 struct hs_box
 {
   hs_object_area *area;
   hs_box         *links[2]; 
+  /** The type of the value, which says how it is released */
+  hs_object_type  type;
   union
   {
-    hs_bigint as_bigint;
-    hs_array  as_array;
-    hs_list   as_list;
-    hs_set    as_set;
-    hs_map    as_map;
+    hs_bigint   as_bigint;
+    hs_string   as_string;
+    hs_elements as_array;
+    hs_range    as_range;
+    hs_list     as_list;
+    hs_set      as_set;
+    hs_map      as_map;
   } value;
 };
 
+/*
+ * The owner of boxes. Each box created in an area is chained on it, through
+ * links[0], and lives until the area ends, which releases them all.
+ */
+struct hs_object_area
+{
+  /** The last box created, the first of the chain */
+  hs_box *boxes;
+  /** The number of boxes in the chain */
+  size_t  size;
+};
+
 #endif /* HS_TYPES_H */
\ No newline at end of file
@@ -0,0 +1,875 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#ifndef HS_VM_H
+#define HS_VM_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hs/types.h"
+#include "hs/object.h"
+#include "hs/opcode.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup VM dispatch modes
+ *
+ *  The interpreter loop can be built in two ways:
+ *
+ *    - HS_VM_DISPATCH_SWITCH uses a central switch, it works on any compiler.
+ *    - HS_VM_DISPATCH_GOTO uses labels as values (a GNU extension), so every
+ *      handler jumps to the next one by itself. This gives one indirect
+ *      branch for each opcode, and the branch predictor can learn opcode
+ *      sequences instead of a single shared jump.
+ *
+ *  Define HS_VM_DISPATCH at build time to force one of them.
+ *  @{
+ */
+#define HS_VM_DISPATCH_SWITCH 0
+#define HS_VM_DISPATCH_GOTO   1
+
+#ifndef HS_VM_DISPATCH
+#if defined(__GNUC__)
+#define HS_VM_DISPATCH HS_VM_DISPATCH_GOTO
+#else
+#define HS_VM_DISPATCH HS_VM_DISPATCH_SWITCH
+#endif
+#endif
+/** @} */
+
+/** @defgroup VM profiling
+ *
+ *  Building with HS_VM_PROFILE defined makes the loop record, on the
+ *  hs_vm_profile given to state->profile, how many times each opcode runs,
+ *  the time spent on it, and the sequences of two and three opcodes it ran.
+ *  Superinstructions count as their own opcode.
+ *
+ *  Time is read from the cycle counter on x86 with GCC, and from the
+ *  monotonic clock elsewhere. An opcode is charged from its dispatch to the
+ *  next one, so the last opcode of a run gets no time.
+ *  @{
+ */
+/** The number of different opcode triples a profile can count */
+#define HS_VM_PROFILE_TRIPLES 4096
+
+/** A sequence of one to three opcodes, and how many times it ran */
+typedef struct hs_vm_sequence
+{
+  uint16_t ops[3];
+  uint64_t count;
+} hs_vm_sequence;
+
+typedef struct hs_vm_profile
+{
+  /** pairs[a][b] is how many times opcode b ran right after opcode a */
+  uint64_t pairs[HS_OPCODE_COUNT][HS_OPCODE_COUNT];
+  /** How many times each opcode ran */
+  uint64_t counts[HS_OPCODE_COUNT];
+  /** The clock ticks spent on each opcode */
+  uint64_t ticks[HS_OPCODE_COUNT];
+  /** A hash table of the triples, an entry is free while its count is 0 */
+  hs_vm_sequence triples[HS_VM_PROFILE_TRIPLES];
+  /** The triples not counted because the table was full */
+  uint64_t triples_lost;
+  /** The clock at the last dispatch */
+  uint64_t stamp;
+  /** The opcode before the running one, 0 at the start of a run */
+  uint16_t last;
+} hs_vm_profile;
+
+/**
+ * @brief Gets the name of an opcode, without the HS_OP_ prefix.
+ *
+ * @param opcode An opcode, from enum hs_opcode.
+ * @return The name, or "INVALID" if the virtual machine can't run it.
+ */
+const char *
+hs_vm_opcode_name(uint16_t opcode);
+
+/**
+ * @brief Finds the opcode sequences that ran the most.
+ *
+ * @param profile The counts gathered by a build with HS_VM_PROFILE.
+ * @param length The length of the sequences, from 1 to 3.
+ * @param top A place to store the sequences, the most frequent first.
+ * @param n The maximum number of sequences to store.
+ * @return The number of sequences stored.
+ */
+size_t
+hs_vm_profile_top(const hs_vm_profile *profile, size_t length,
+                  hs_vm_sequence *top, size_t n);
+
+/**
+ * @brief Writes a profile as JSON.
+ *
+ * Gives every opcode that ran, with its count and ticks, and the most
+ * frequent pairs and triples.
+ *
+ * @param profile The counts gathered by a build with HS_VM_PROFILE.
+ * @param file The file to write.
+ * @return zero on success, a non zero value if the file can't be written.
+ */
+int
+hs_vm_profile_write_json(const hs_vm_profile *profile, FILE *file);
+
+/**
+ * @brief Writes a profile as JSON when the program exits.
+ *
+ * Only one profile is written, a new call replaces the previous one.
+ *
+ * @param profile The profile, it must live until the program exits.
+ * @param path The file to create, or NULL to use stderr.
+ * @return zero on success, a non zero value if the exit hook can't be set.
+ */
+int
+hs_vm_profile_dump_at_exit(const hs_vm_profile *profile, const char *path);
+/** @} */
+
+/**
+ * Superinstructions the loader can create, as bits of a mask.
+ * Each one replaces a common sequence of opcodes with a single dispatch.
+ */
+enum hs_vm_fusion
+{
+  /* LOAD_LOCAL, INT_INC or INT_DEC, STORE_LOCAL on the same slot */
+  HS_VM_FUSE_LOCAL_INC  = 1 << 0,
+  /* INT_CMP followed by a JUMP_*_ZERO on its result */
+  HS_VM_FUSE_CMP_JUMP   = 1 << 1,
+  /* LOAD_LOCAL followed by a LOCAL_CALL of the loaded value */
+  HS_VM_FUSE_LOCAL_CALL = 1 << 2,
+  /* LOAD_FIELD followed by a CALL of the loaded value */
+  HS_VM_FUSE_FIELD_CALL = 1 << 3,
+  HS_VM_FUSE_ALL        = ( 1 << 4 ) - 1
+};
+
+/**
+ * Errors raised by the virtual machine itself.
+ * They are thrown as integers, so they can be caught like any other value.
+ */
+enum hs_vm_error
+{
+  HS_VM_ERROR_NONE = 0,
+  HS_VM_ERROR_OPCODE,        /* the opcode is unknown or not supported */
+  HS_VM_ERROR_REGISTER,      /* a register is outside the register file */
+  HS_VM_ERROR_TYPE,          /* a value has the wrong type for the opcode */
+  HS_VM_ERROR_ZERO_DIVISION, /* an integer division by zero */
+  HS_VM_ERROR_JUMP,          /* a jump outside of the function */
+  HS_VM_ERROR_INDEX,         /* an argument, local or constant out of range */
+  HS_VM_ERROR_STACK,         /* a pop or peek on an empty stack */
+  HS_VM_ERROR_MEMORY,        /* the system ran out of memory */
+  HS_VM_ERROR_INTERRUPTED,   /* a safepoint function stopped the run */
+  HS_VM_ERROR_RANGE,         /* a negative shift count or a range too big */
+};
+
+typedef struct hs_module  hs_module;
+typedef struct hs_function hs_function;
+typedef struct hs_context hs_context;
+typedef struct hs_closure hs_closure;
+typedef struct hs_frame   hs_frame;
+typedef struct hs_frame_chunk hs_frame_chunk;
+typedef struct hs_try     hs_try;
+typedef struct hs_call_site hs_call_site;
+
+/** @defgroup VM inline caches
+ *
+ *  Field opcodes remember the shapes they saw, with the slot of the property
+ *  on each one. After HS_VM_CACHE_WAYS different shapes an instruction is
+ *  megamorphic, and uses a table shared by the whole state instead.
+ *  Shapes without the property are remembered too, with HS_VM_CACHE_ABSENT,
+ *  so reads that fall through to a prototype skip the shape walk.
+ *  @{
+ */
+#define HS_VM_CACHE_WAYS       4
+#define HS_VM_MEGAMORPHIC_SIZE 1024
+#define HS_VM_CACHE_ABSENT     SIZE_MAX
+
+typedef struct hs_cache_entry
+{
+  /** The shape of the object, NULL on an empty entry */
+  const hs_shape *shape;
+  /** The name of the property */
+  hs_object       key;
+  /** The slot of the property on that shape, or HS_VM_CACHE_ABSENT */
+  size_t          slot;
+} hs_cache_entry;
+
+typedef struct hs_inline_cache
+{
+  hs_cache_entry entries[HS_VM_CACHE_WAYS];
+  /** The entries used, HS_VM_CACHE_WAYS once megamorphic */
+  size_t         count;
+} hs_inline_cache;
+
+/**
+ * @brief How well the inline caches of a state are working.
+ */
+typedef struct hs_vm_cache_stats
+{
+  /** Lookups found on the cache of the instruction */
+  uint64_t hits;
+  /** Lookups that missed it, and went to the shape */
+  uint64_t misses;
+  /** Lookups of megamorphic instructions found on the shared table */
+  uint64_t megamorphic_hits;
+  /** Lookups of megamorphic instructions that missed the shared table */
+  uint64_t megamorphic_misses;
+} hs_vm_cache_stats;
+/** @} */
+
+/**
+ * @brief An opcode, decoded once when its function is loaded.
+ *
+ * Registers and immediates are already taken out of the opcode, so running
+ * an instruction never needs HS_OPCODE_PARAM_TYPE.
+ *
+ * Generic arithmetic (HS_OP_ADD, HS_OP_CMP...) rewrites itself into a typed
+ * form after seeing its operand types, and back when the types change.
+ */
+typedef struct hs_instruction
+{
+  /** The address of the handler, or NULL on HS_VM_DISPATCH_SWITCH */
+  const void *handler;
+  /** The uint16 operand (or jump target), widened */
+  int32_t     imm;
+  /** The opcode, from enum hs_opcode */
+  uint16_t    opcode;
+  /** The registers, a also holds the register of <uint16> <reg> opcodes */
+  uint8_t     a;
+  uint8_t     b;
+  uint8_t     c;
+  /** How many times a quickened form of the opcode failed its guard */
+  uint8_t     deopts;
+  /** How many times the jump was taken backwards, counted towards
+   *  hs_state.osr_threshold */
+  uint16_t    hits;
+  /** The inline cache of field opcodes, NULL on the others */
+  hs_inline_cache *cache;
+} hs_instruction;
+
+/**
+ * @brief An entry of the exception table of a function.
+ *
+ * When an instruction inside [start, end) throws a value of the given type,
+ * the function continues on target, with the value on register 0. Nothing
+ * runs when entering or leaving the range.
+ */
+typedef struct hs_handler
+{
+  /** The first instruction covered */
+  uint32_t  start;
+  /** The instruction after the last one covered */
+  uint32_t  end;
+  /** Where the handler starts */
+  uint32_t  target;
+  /** The values the function keeps on the value stack at the handler,
+   *  the ones above are dropped */
+  uint32_t  stack;
+  /** The type caught, null catches everything */
+  hs_object type;
+} hs_handler;
+
+/** @defgroup VM sampling
+ *
+ *  A sampler interrupts the program every few microseconds of CPU time
+ *  (SIGPROF) and records the stack of script functions, with the line each
+ *  one is running. The signal only counts on state->sample_pending and
+ *  requests a safepoint, where every frame is complete and the loop takes
+ *  the sample. The stacks are written as folded stacks, one line per stack,
+ *  as read by flamegraph.pl and compatible tools.
+ *  @{
+ */
+/** The deepest stack recorded, deeper stacks keep their innermost frames */
+#define HS_SAMPLE_MAX_DEPTH 128
+
+/**
+ * @brief An entry of the line table of a function.
+ *
+ * The instructions from start to the start of the next entry come from
+ * the given source line.
+ */
+typedef struct hs_line
+{
+  /** The first instruction of the line */
+  uint32_t start;
+  /** The line on the source file */
+  uint32_t line;
+} hs_line;
+
+/** A frame of a sample: the function and the line it was running */
+typedef struct hs_sample_frame
+{
+  const hs_function *function;
+  /** The line, 0 if the function has no line table */
+  uint32_t           line;
+} hs_sample_frame;
+
+/** A different stack seen by a sampler */
+typedef struct hs_sample_stack
+{
+  /** The frames, the innermost first, NULL on a free entry */
+  hs_sample_frame *frames;
+  size_t           depth;
+  size_t           hash;
+  /** The number of samples that found this stack */
+  uint64_t         count;
+} hs_sample_stack;
+
+typedef struct hs_sampler
+{
+  /** The state being sampled */
+  hs_state        *state;
+  /** A hash table of the stacks seen */
+  hs_sample_stack *stacks;
+  size_t           stack_count;
+  size_t           stack_capa;
+  /** The number of samples recorded */
+  uint64_t         samples;
+  /** The samples lost because there was no memory to record them */
+  uint64_t         lost;
+} hs_sampler;
+/** @} */
+
+/** @defgroup VM compiler
+ *
+ *  On x86-64 Linux, functions can be compiled to machine code by copying a
+ *  stencil of machine code for each instruction and patching its operands
+ *  (see src/jit.c). Only the opcodes of numeric kernels have stencils, other
+ *  functions stay interpreted.
+ *  @{
+ */
+/** How compiled code gives control back to the interpreter */
+enum hs_jit_exit
+{
+  HS_JIT_RETURN = 0, /* the function returned, the result is set */
+  HS_JIT_RESUME,     /* the interpreter must run the instruction at *at */
+  HS_JIT_SAFEPOINT,  /* a safepoint was requested, resume at *at after it */
+  HS_JIT_DEOPT       /* a loop was entered with other types, resume at *at */
+};
+
+/**
+ * @brief The compiled code of a function.
+ *
+ * @param regs The register window of the call.
+ * @param result Where a returned value goes.
+ * @param at The instruction to start on, then the one where the code left.
+ * @param safepoint The safepoint flag of the state, polled on back-edges.
+ * @return One of hs_jit_exit.
+ */
+typedef int (*hs_jit_entry)(hs_object *regs, hs_object *result, uint32_t *at,
+                            volatile sig_atomic_t *safepoint);
+/** @} */
+
+/**
+ * @brief A piece of bytecode that can be called.
+ */
+struct hs_function
+{
+  /** The module where the function was declared */
+  hs_module      *module;
+  /** The raw opcodes, as encoded by HS_OP_ENCODE() */
+  const uint32_t *code;
+  /** The decoded opcodes, one for each opcode in code */
+  hs_instruction *instructions;
+  /** The inline caches of the field opcodes, they keep shape addresses, so
+   *  the function must not outlive the states that run it */
+  hs_inline_cache *caches;
+  /** The amount of opcodes inside code */
+  size_t          size;
+  /** The number of context slots the function needs on each call */
+  uint16_t        locals;
+  /** The size of the register window, found when the code is decoded */
+  uint16_t        registers;
+  /** Set when the verifier followed every path of the code, so the
+   *  instructions it proved safe run in their unchecked forms. Cleared
+   *  by the first BIGINT an integer opcode makes or meets */
+  uint8_t         verified;
+  /** The name of each parameter, used to place named arguments. NULL
+   *  when the function only takes positional arguments */
+  const hs_object *params;
+  /** The number of parameter names */
+  uint8_t         param_count;
+  /** The exception table, see hs_function_set_handlers() */
+  const hs_handler *handlers;
+  size_t          handler_count;
+  /** The name shown by profilers, NULL on anonymous functions */
+  const char     *name;
+  /** The line table, see hs_function_set_lines() */
+  const hs_line  *lines;
+  size_t          line_count;
+  /** The machine code of the function, NULL until it is compiled */
+  hs_jit_entry    jit_entry;
+  void           *jit_code;
+  size_t          jit_size;
+  /** The calls counted towards hs_state.jit_threshold */
+  uint32_t        jit_calls;
+  /** The machine code of a hot loop, entered from a running call on the
+   *  instruction osr_at, see hs_function_osr() */
+  hs_jit_entry    osr_entry;
+  void           *osr_code;
+  size_t          osr_size;
+  uint32_t        osr_at;
+};
+
+/**
+ * @brief How a call passes its arguments, referenced by site( <uint16> ).
+ *
+ * The caller computes the arguments straight into argc consecutive
+ * registers. Those registers become the first registers of the callee, so
+ * nothing is copied, and every register of the caller from args upwards
+ * is lost after the call.
+ *
+ * Named arguments are placed on the parameter with the same name. The slot
+ * of each one is resolved on the first call, and kept until the site calls
+ * another function.
+ */
+struct hs_call_site
+{
+  /** The register holding the function to call */
+  uint8_t            callee;
+  /** The register holding this, only used by HS_OP_DYNAMIC_CALL_SITE */
+  uint8_t            self;
+  /** The register of the first argument */
+  uint8_t            args;
+  /** The number of arguments */
+  uint8_t            argc;
+  /** The name of each argument, a null name passes it by position.
+   *  NULL if every argument is positional */
+  const hs_object   *names;
+  /** Room for argc slots, filled by the virtual machine when there are
+   *  names: the parameter receiving each argument */
+  uint8_t           *slots;
+  /** The function the slots were resolved for, set by the virtual machine */
+  const hs_function *resolved;
+  /** The number of parameters the resolved slots cover */
+  uint16_t           width;
+  /** Non zero if the resolved slots keep every argument in its place */
+  uint8_t            in_place;
+};
+
+/**
+ * @brief A compilation unit, with its functions and constants.
+ */
+struct hs_module
+{
+  /** The functions of the module, referenced by def( <uint16> ) */
+  hs_function *functions;
+  /** The number of functions inside the module */
+  size_t       function_count;
+  /**
+   * The constant pool of the module: ints, floats and boxed values such as
+   * bigints. Loaded by module [ <uint16> ], or module [ extra ] past 65535.
+   * Strings come from hs_intern(), so field names compare by pointer.
+   */
+  hs_object   *constants;
+  /** The number of constants inside the module */
+  size_t       constant_count;
+  /** The superinstructions used when loading functions, see hs_vm_fusion */
+  unsigned     fusions;
+  /** The call sites of the module, referenced by site( <uint16> ) */
+  hs_call_site *call_sites;
+  /** The number of call sites inside the module */
+  size_t       call_site_count;
+};
+
+/**
+ * @brief The local variables of a function call.
+ *
+ * Context slots are numbered from the innermost scope outwards, so an index
+ * bigger than the size of a context continues on its parent.
+ */
+struct hs_context
+{
+  /** The context of the enclosing scope */
+  hs_context *parent;
+  /** The number of slots */
+  size_t      size;
+  /** Non zero if a closure captured the context */
+  int         escaped;
+  /** The context that escaped before this one, in the chain of the state */
+  hs_context *next;
+  hs_object   slots[];
+};
+
+/**
+ * @brief A function, together with the context where it was declared.
+ */
+struct hs_closure
+{
+  hs_function *function;
+  hs_context  *context;
+  /** The closure created before this one, in the chain of the state */
+  hs_closure  *next;
+};
+
+/**
+ * @brief Called when a running state reaches a requested safepoint.
+ *
+ * The loop polls for safepoints on backward jumps, calls and returns, so
+ * every frame is complete and the code can be inspected, or a collection
+ * can run. Other threads and signal handlers ask for one with
+ * hs_state_request_safepoint().
+ *
+ * @param state The state stopped at the safepoint.
+ * @param data The data given with the function.
+ * @return zero to go on running, a non zero value to stop the run with
+ *         HS_VM_ERROR_INTERRUPTED, which can't be caught.
+ */
+typedef int (*hs_safepoint_fn)(hs_state *state, void *data);
+
+/**
+ * @brief The state of a virtual machine.
+ *
+ * Each thread runs its own state, they should never be shared.
+ */
+typedef struct hs_state
+{
+  /** The frame currently running */
+  hs_frame  *frame;
+  /** The chunk of the frame stack holding the top frame */
+  hs_frame_chunk *frames;
+  /** The value stack used by stack.push() and stack.pop() */
+  hs_object *stack;
+  size_t     stack_size;
+  size_t     stack_capa;
+  /** The register stack, each frame uses a window of it. The argument
+   *  blocks created by arguments.push() live on top of the running window,
+   *  and become the first registers of the called function. */
+  hs_object *registers;
+  size_t     registers_size;
+  size_t     registers_capa;
+  /** The index where the arguments of the next call start */
+  size_t     args_base;
+  /** The arguments of the running native function */
+  size_t     native_args;
+  size_t     native_argc;
+  /** The try contexts currently open */
+  hs_try    *tries;
+  size_t     tries_size;
+  size_t     tries_capa;
+  /** The value thrown when a run fails */
+  hs_object  error;
+  /** The owner of the boxes created while running, like arrays, ranges
+   *  and the BIGINTs of integer results that leave hs_int. They live until
+   *  hs_state_end(), so a result of hs_vm_run() can be read until then */
+  hs_object_area area;
+  /** The closures created by HS_OP_DECLARE_FUNCTION and the contexts they
+   *  captured, each chained from the last one. Like the boxes, they live
+   *  until hs_state_end() */
+  hs_closure *closures;
+  hs_context *escaped;
+  /** The empty shape, every object created by HS_OP_NEW starts there */
+  hs_shape  *shapes;
+  /** The cache shared by megamorphic field opcodes */
+  hs_cache_entry   *megamorphic;
+  /** The counters of the inline caches */
+  hs_vm_cache_stats cache_stats;
+  /** Where opcode pairs are counted, only used when built for profiling */
+  hs_vm_profile *profile;
+  /** The sampler recording this state, see hs_sampler_start() */
+  hs_sampler    *sampler;
+  /** The samples requested since the last one was taken */
+  volatile sig_atomic_t sample_pending;
+  /** Non zero when a safepoint was requested, the only flag the loop polls */
+  volatile sig_atomic_t safepoint;
+  /** Called on each requested safepoint, can be NULL */
+  hs_safepoint_fn on_safepoint;
+  void           *safepoint_data;
+  /** The calls after which a function is compiled, zero never compiles */
+  uint32_t        jit_threshold;
+  /** The backward jumps after which a running loop moves to machine code,
+   *  zero never moves */
+  uint16_t        osr_threshold;
+} hs_state;
+
+/**
+ * @brief Starts a function from a block of opcodes.
+ *
+ * The code is not copied, it must live as long as the function.
+ * The opcodes are decoded here, into the instructions of the function.
+ * A wide load must be followed by the HS_OP_EXTRA_ARG with its operand.
+ *
+ * The code is verified too: a jump to an immediate target must land on an
+ * instruction, and the opcodes whose operand types are known on every path
+ * drop their runtime checks.
+ *
+ * @param fn The function to initialize.
+ * @param module The module the function belongs to.
+ * @param code The opcodes of the function.
+ * @param size The amount of opcodes.
+ * @param locals The number of context slots used by the function.
+ * @return zero on success, a non zero value on failure.
+ */
+int
+hs_function_init(hs_function *fn, hs_module *module, const uint32_t *code,
+                 size_t size, uint16_t locals);
+
+/**
+ * @brief Gives a function its exception table.
+ *
+ * Handlers are searched in order, so a range must come before the ranges
+ * enclosing it. The table is not copied, it must live as long as the
+ * function. The handlers are new ways into the code, so it is verified
+ * again.
+ *
+ * @param fn The function.
+ * @param handlers The entries of the table.
+ * @param count The number of entries.
+ * @return zero on success, a non zero value if an entry is outside the code.
+ */
+int
+hs_function_set_handlers(hs_function *fn, const hs_handler *handlers,
+                         size_t count);
+
+/**
+ * @brief Gives a function its line table, used by the sampler.
+ *
+ * The table is not copied, it must live as long as the function.
+ *
+ * @param fn The function.
+ * @param lines The entries, sorted by start.
+ * @param count The number of entries.
+ * @return zero on success, a non zero value if the entries are not sorted
+ *         or start outside the code.
+ */
+int
+hs_function_set_lines(hs_function *fn, const hs_line *lines, size_t count);
+
+/**
+ * @brief Finds the source line of an instruction.
+ *
+ * @param fn The function.
+ * @param at The index of the instruction.
+ * @return The line, or 0 if the function has no line for it.
+ */
+uint32_t
+hs_function_line(const hs_function *fn, size_t at);
+
+/**
+ * @brief Releases the resources used by a function.
+ *
+ * @param fn The function to end.
+ */
+void
+hs_function_end(hs_function *fn);
+
+/**
+ * @brief Starts a virtual machine state.
+ *
+ * @param state The state to initialize.
+ * @return zero on success, a non zero value on failure.
+ */
+int
+hs_state_init(hs_state *state);
+
+/**
+ * @brief Releases the resources used by a state.
+ *
+ * @param state The state to end.
+ */
+void
+hs_state_end(hs_state *state);
+
+/**
+ * @brief Runs a function until it returns, or the code halts.
+ *
+ * If the function throws an error nobody catches, the run stops and the
+ * thrown value is left on state->error.
+ *
+ * @param state The state used to run the code.
+ * @param fn The function to run.
+ * @param result A place to store the returned value. Can be NULL.
+ * @return zero on success, a non zero value on failure.
+ */
+int
+hs_vm_run(hs_state *state, hs_function *fn, hs_object *result);
+
+/**
+ * @brief Picks the superinstructions worth using, from a profiling run.
+ *
+ * A superinstruction is picked when the opcode pair it starts with is at
+ * least min_share of all the pairs counted.
+ *
+ * @param profile The counts gathered by a build with HS_VM_PROFILE.
+ * @param min_share The minimum share, between 0 and 1.
+ * @return A mask of hs_vm_fusion values, to use as hs_module.fusions.
+ */
+unsigned
+hs_vm_select_fusions(const hs_vm_profile *profile, double min_share);
+
+/**
+ * @brief Gets the counters of the inline caches.
+ *
+ * @param state The state to inspect.
+ * @param stats A place to store the counters.
+ */
+void
+hs_vm_get_cache_stats(const hs_state *state, hs_vm_cache_stats *stats);
+
+/**
+ * @brief Sets the counters of the inline caches back to zero.
+ *
+ * @param state The state to reset.
+ */
+void
+hs_vm_reset_cache_stats(hs_state *state);
+
+/**
+ * @brief Gets the number of arguments passed to the running native function.
+ *
+ * @param state The state calling the native function.
+ * @return The number of arguments.
+ */
+size_t
+hs_vm_argc(hs_state *state);
+
+/**
+ * @brief Gets an argument passed to the running native function.
+ *
+ * @param state The state calling the native function.
+ * @param index The index of the argument.
+ * @param dst A place to store the argument.
+ * @return zero on success, a non zero value if there is no such argument.
+ */
+int
+hs_vm_arg(hs_state *state, size_t index, hs_object *dst);
+
+/**
+ * @brief Asks a state to stop at its next safepoint.
+ *
+ * Only sets a flag, so it can be called from a signal handler.
+ *
+ * @param state The state to stop.
+ */
+void
+hs_state_request_safepoint(hs_state *state);
+
+/**
+ * @brief Compiles a function to machine code.
+ *
+ * Later calls run the machine code, with the interpreter taking over when
+ * a check fails. hs_function_end() releases the code.
+ *
+ * @param fn The function to compile.
+ * @return zero on success, a non zero value if the platform, the object
+ *         layout (HS_NAN_BOXING) or an opcode of the function is not
+ *         supported.
+ */
+int
+hs_function_jit(hs_function *fn);
+
+/**
+ * @brief Compiles a loop of a running function, for the types its
+ *        registers hold now.
+ *
+ * The types are followed from the loop header, so the code drops the checks
+ * they prove. On the way in the code checks the types again, and gives
+ * HS_JIT_DEOPT when one differs. A function keeps one loop, compiling
+ * another releases it.
+ *
+ * @param fn The function.
+ * @param header The first instruction of the loop, where the code is
+ *        entered.
+ * @param regs The register window of the running call.
+ * @return zero on success, a non zero value if the platform or an opcode
+ *         the loop can reach is not supported.
+ */
+int
+hs_function_osr(hs_function *fn, uint32_t header, const hs_object *regs);
+
+/**
+ * @brief Releases the machine code of the loop of a function.
+ *
+ * @param fn The function.
+ */
+void
+hs_function_osr_end(hs_function *fn);
+
+/**
+ * @brief Releases the machine code of a function, it goes back to the
+ *        interpreter.
+ *
+ * @param fn The function.
+ */
+void
+hs_function_jit_end(hs_function *fn);
+
+/** @defgroup Sampler functions
+ */
+/**@{ */
+/**
+ * @brief Starts sampling a state.
+ *
+ * Only one sampler can run at a time, since it owns the SIGPROF handler
+ * and the profiling timer of the process. Only POSIX systems support it.
+ *
+ * @param sampler The sampler to start.
+ * @param state The state to sample.
+ * @param interval The microseconds of CPU time between samples.
+ * @return zero on success, a non zero value if the timer can't be set or
+ *         a sampler is running.
+ */
+int
+hs_sampler_start(hs_sampler *sampler, hs_state *state, unsigned interval);
+
+/**
+ * @brief Stops a sampler, the stacks recorded are kept.
+ *
+ * @param sampler The running sampler.
+ */
+void
+hs_sampler_stop(hs_sampler *sampler);
+
+/**
+ * @brief Records a stack.
+ *
+ * Called by the virtual machine when a sample is pending.
+ *
+ * @param sampler The sampler.
+ * @param frames The frames of the stack, the innermost first.
+ * @param depth The number of frames.
+ * @param weight The number of samples taken on this stack.
+ * @return zero on success, a non zero value if there is no memory.
+ */
+int
+hs_sampler_add(hs_sampler *sampler, const hs_sample_frame *frames,
+               size_t depth, uint64_t weight);
+
+/**
+ * @brief Writes the stacks recorded as folded stacks.
+ *
+ * Each line is the outermost function first, separated by semicolons,
+ * then the number of samples, such as "main:3;fib:7;fib:8 42".
+ *
+ * @param sampler The sampler.
+ * @param file The file to write.
+ * @return zero on success, a non zero value if the file can't be written.
+ */
+int
+hs_sampler_write_folded(const hs_sampler *sampler, FILE *file);
+
+/**
+ * @brief Releases the stacks of a stopped sampler.
+ *
+ * @param sampler The sampler to end.
+ */
+void
+hs_sampler_end(hs_sampler *sampler);
+/**@} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HS_VM_H */
@@ -9,8 +9,15 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 #include <stdint.h>
+#include <string.h>
 #include "hs/bigint.h"
 
+static int
+is_zero(const hs_bigint *bi);
+
+static int
+check_size( hs_bigint *bi, const size_t add );
+
 /**
  * @brief increments the value of a number by 1
  *
@@ -42,7 +49,7 @@ inc_bits(hs_bigint *bi)
   if ( check_size(bi, 1) ) 
   {
     while (i > 0) {
-      bi->data[i - 1] = UINT32_MAX;
+      bi->data[--i] = UINT32_MAX;
     }
     return 1;
   }
@@ -68,8 +75,10 @@ need_sub_inversion(const hs_bigint *a, const hs_bigint *b)
   /* we always want the bigger value to be on our left side */
   if ( a->size > b->size ) return 0;
   if ( a->size < b->size ) return 1;
-  size_t i = a->size - 1;
-  if ( a->data[i] < b->data[i] ) return 1;
+  for (size_t i = a->size; i > 0; --i) {
+    if ( a->data[i - 1] != b->data[i - 1] ) 
+      return a->data[i - 1] < b->data[i - 1];
+  }
   return 0;
 }
 
@@ -92,7 +101,7 @@ dec_bits(hs_bigint *bi)
   while ( i < bi->size ) {
     if ( bi->data[i] != 0 ) {
       --(bi->data[i]);
-      if (bi->data[i] == 0 && i > 0) bi->size -= 1;
+      if (bi->data[bi->size - 1] == 0 && bi->size > 1) bi->size -= 1;
       return 0;
     }
     bi->data[i] = UINT32_MAX;
@@ -115,36 +124,21 @@ dec_bits(hs_bigint *bi)
 static int
 add_bits(hs_bigint *a, const hs_bigint *b)
 {
-  uint32_t carry = 0;
-  uint64_t tmp;
-  uint32_t t;
-  size_t size = a->size > b->size ? b->size : a->size;
-  if (a->size < b->size)
-    if ( check_size(a, b->size - a->size) )
-    {
-     return 1;
-    }    
-    for (size_t j = a->size; j < b->size; ++j) {
-      a->data[j] = b->data[j];
-    }
-    a->size = b->size;
-  }    
-  for (size_t i = 0; i < size; ++i) {
-    tmp = (uint64_t)a->data[i] + (uint64_t)b->data[i];
-    carry = (uint32_t)(tmp >> 32);
-    a->data[i] = (uint32_t)( tmp && (uint64_t)UINT32_MAX );
+  uint64_t tmp, carry = 0;
+  size_t size = a->size > b->size ? a->size : b->size;
+  /* One more word for the last carry */
+  if ( check_size(a, size + 1 - a->size) ) return 1;
+  for (size_t i = a->size; i <= size; ++i) {
+    a->data[i] = 0;
   }
-  while (carry) {
-    if (size < a->size) {
-      tmp = (uint64_t)a->data[i] + (uint64_t)b->data[i];
-      carry = (uint32_t)(tmp >> 32);
-      a->data[i] = (uint32_t)( tmp && (uint64_t)UINT32_MAX );
-      ++size;
-    } else {
-      if ( check_size(a, 1) ) return 1;
-      ++(a->size);
-    }
+  for (size_t i = 0; i < size; ++i) {
+    tmp = (uint64_t)a->data[i] + carry;
+    if (i < b->size) tmp += (uint64_t)b->data[i];
+    a->data[i] = (uint32_t)( tmp & (uint64_t)UINT32_MAX );
+    carry = tmp >> 32;
   }
+  a->data[size] = (uint32_t)carry;
+  a->size = carry ? size + 1 : size;
   return 0;
 }
 
@@ -162,79 +156,102 @@ add_bits(hs_bigint *a, const hs_bigint *b)
 static int
 sub_bits(hs_bigint *a, const hs_bigint *b)
 {
-  uint64_t tmp;
-  uint32_t carry;
-  size_t i, j, size;
-  size = b->size;
-  carry = 0;
-  for (i = 0; i < size; ++i)
-  {
-    if ( a->data[i] < b->data[i] ) {
-      for ( j = i + 1; j < a->size; ++j ) {
-        if (a->data[j] != 0) {
-          --(a->data[j]);
-          j = a->size - 1;
-        } else
-          a->data[j] = UINT32_MAX;
-      }
-      tmp = (uint64_t)a->data[i] + (uint64_t)UINT32_MAX - (uint64_t)b->data[i];
-      a->data[i] = (uint32_t)tmp;
-    } else 
-      a->data[i] -= b->data[i];
-    
+  uint64_t tmp, borrow = 0;
+  /* a is never smaller than b, need_sub_inversion() sees to that */
+  for (size_t i = 0; i < a->size; ++i) {
+    tmp = (uint64_t)a->data[i] - borrow;
+    if (i < b->size) tmp -= (uint64_t)b->data[i];
+    a->data[i] = (uint32_t)( tmp & (uint64_t)UINT32_MAX );
+    borrow = (tmp >> 32) ? 1 : 0;
+  }
+  while (a->size > 1 && a->data[a->size - 1] == 0) {
+    --(a->size);
   }
+  return 0;
 }
 
 /**
- * @brief shifts to the right a bigint
+ * @brief removes the zero words on top of a number
  *
- * This is an arithmetic shift and does not check the sign after it finishes
+ * @param bi A number whose size may count zero words
+ */
+static void
+trim_size(hs_bigint *bi)
+{
+  while (bi->size > 1 && bi->data[bi->size - 1] == 0) {
+    --(bi->size);
+  }
+}
+
+/**
+ * @brief reads a shift count from a bigint
  *
- * @param a The left operand
- * @param b The right operand
- * @return A non zero value on error, zero if the function succeeds
+ * Counts too large for a size_t are clamped, a shift that long needs more
+ * memory than there is anyway.
+ *
+ * @param b The count
+ * @param count The place to store it
+ * @return A non zero value if the count is negative, zero if not
+ */
+static int
+shift_count(const hs_bigint *b, size_t *count)
+{
+  int64_t value;
+  if (b->negative && !is_zero(b)) return 1;
+  if (hs_bigint_to_i64(b, &value) || (uint64_t)value > SIZE_MAX)
+    *count = SIZE_MAX;
+  else
+    *count = (size_t)value;
+  return 0;
+}
+
+/**
+ * @brief shifts the bits of a bigint to the right
+ *
+ * Whole words are moved first, then the bits left inside a word. The sign
+ * is not looked at, hs_bigint_shr() and hs_bigint_ushr() take care of it.
+ *
+ * @param a The number to shift
+ * @param count The number of bits
+ * @return A non zero value if a one was shifted out, zero if not
  * @see hs_bigint_shr
  * @see hs_bigint_ushr
  */
 static int
-shift_right(hs_bigint *a, const hs_bigint *b)
-{
-  int carry;
-  int t;  
-  if (b->negative || is_zero(b)) return 1;
-  hs_bigint bi;
-  if ( hs_bigint_from_i32(&bi, 0) ) return 1;
-  while ( !hs_bigint_equals(&bi, b) )
-  {
-    carry = 0;
-    for (size_t i = 0; i < a->size; ++i) {
-      t = a->data[i] & 1;
-      a->data[i] = a->data[i] >> 1;
-      if (carry)
-        a->data[i] |= 0x80000000;
-      carry = t;
-    }
-    /* Passing down the sign, */
-    if (a->negative) a->data[a->size - 1] |= 0x80000000;
-    if ( (a->data[a->size - 1] == 0) && a->size > 1) --(a->size);
-    if ( hs_bigint_inc(&bi) ) {
-      hs_bigint_end(&bi);
-      return 1;
-    }
+shift_right(hs_bigint *a, size_t count)
+{
+  size_t   words = count / 32;
+  unsigned bits  = (unsigned)( count % 32 );
+  uint32_t high;
+  int      lost  = 0;
+  if (words >= a->size) {
+    lost = !is_zero(a);
+    a->size = 1;
+    a->data[0] = 0;
+    return lost;
   }
-  hs_bigint_end(&bi);
-  return 0;  
+  for (size_t i = 0; i < words; ++i) {
+    lost |= a->data[i] != 0;
+  }
+  if (bits) lost |= ( a->data[words] & ( ( (uint32_t)1 << bits ) - 1 ) ) != 0;
+  for (size_t i = 0; i + words < a->size; ++i) {
+    high = i + words + 1 < a->size ? a->data[i + words + 1] : 0;
+    a->data[i] = bits ? ( a->data[i + words] >> bits ) | ( high << (32 - bits) )
+                      : a->data[i + words];
+  }
+  a->size -= words;
+  trim_size(a);
+  return lost;
 }
 
 /**
  * @brief divides two numbers, returning both remainder and the result
  *
- * I don't really know how to do a faster division algorithm, so I take
- * the approach of how the division is defined, by subtracting "b" to "a" until 
- * "a" is less than "b", then return the number of times "b" was 
- * subtracted from "a".
- * The advantage of this is that the division and remainder functions are
- * basically the same. 
+ * This is the long division done by hand, in base 2: the bits of "a" go
+ * into the remainder one at a time, from the top, and "b" is subtracted
+ * from it each time it fits, setting that bit of the result.
+ * The result is truncated towards zero, and the remainder takes the sign
+ * of "a", so the division and remainder functions are basically the same.
  *
  * @param a The left operand
  * @param b The right operand
@@ -249,42 +266,34 @@ shift_right(hs_bigint *a, const hs_bigint *b)
 static int
 divrem(const hs_bigint *a, const hs_bigint *b, hs_bigint *accum, hs_bigint *rem)
 {
-  hs_bigint abs_b;
+  uint32_t carry, next;
   int accum_negative = a->negative ^ b->negative;
   int rem_negative   = a->negative;
   if (is_zero(b)) return 1;
-  if (is_zero(a)) {
-    if (hs_bigint_from_u32(accum, 0)) return 1;
-    if (hs_bigint_from_u32(rem, 0)) { hs_bigint_end(accum); return 1; }
-    return 0;
-  };
-  if (hs_bigint_from_i32(accum, 0)) return 1;
-  if (hs_bigint_copy(b, abs_b)) { hs_bigint_end(&accum); return 1; }
-  abs_b->negative = 0;
-  if (hs_bigint_copy(a, rem)) { 
-    hs_bigint_end(accum); 
-    hs_bigint_end(&abs_b); 
-    return 1; 
+  if (hs_bigint_init(accum, a->size)) return 1;
+  /* The remainder stays below b, so it is never more than one word longer */
+  if (hs_bigint_init(rem, b->size + 1)) {
+    hs_bigint_end(accum);
+    return 1;
   }
-  rem->negative = 0;
-  while ( hs_bigint_compare(rem, abs_b) >= 0 )
-  {
-    if (sub_bits(rem, b)) {  
-      hs_bigint_end(accum); 
-      hs_bigint_end(rem);
-      hs_bigint_end(&abs_b);
-      return 1;
-    };
-    if (hs_bigint_inc(accum)) {
-      hs_bigint_end(accum);
-      hs_bigint_end(rem);
-      hs_bigint_end(&abs_b);
-      return 1;
+  memset(accum->data, 0, a->size * sizeof(*(accum->data)));
+  accum->size = a->size;
+  for (size_t bit = a->size * 32; bit > 0; --bit) {
+    carry = ( a->data[(bit - 1) / 32] >> ( (bit - 1) % 32 ) ) & 1;
+    for (size_t i = 0; i < rem->size; ++i) {
+      next = rem->data[i] >> 31;
+      rem->data[i] = (rem->data[i] << 1) | carry;
+      carry = next;
+    }
+    if (carry) rem->data[(rem->size)++] = carry;
+    if (!need_sub_inversion(rem, b)) {
+      sub_bits(rem, b);
+      accum->data[(bit - 1) / 32] |= (uint32_t)1 << ( (bit - 1) % 32 );
     }
   }
-  hs_bigint_end(&abs_b);
-  accum->negative = accum_negative;
-  rem->negative = rem_negative;
+  trim_size(accum);
+  accum->negative = accum_negative && !is_zero(accum);
+  rem->negative = rem_negative && !is_zero(rem);
   return 0;
 } 
 
@@ -320,7 +329,7 @@ check_size( hs_bigint *bi, const size_t add )
   if (bi->size + add <= bi->capa) return 0;
   /* Let's add those bits */
   size_t new_capa = bi->capa + add;
-  uint32_t new_data = realloc(bi->data, new_capa * sizeof(*(bi->data)));
+  uint32_t *new_data = realloc(bi->data, new_capa * sizeof(*(bi->data)));
   if (!new_data) return 1;
   bi->data = new_data;
   bi->capa = new_capa;
@@ -341,7 +350,7 @@ hs_bigint_init(hs_bigint *bi, const size_t capa)
 }
 
 int
-hs_bigint_from_i32(hs_bigint *bi, const uint32_t value)
+hs_bigint_from_u32(hs_bigint *bi, const uint32_t value)
 {
   if (hs_bigint_init(bi, 1)) return 1;
   bi->data[0] = value;
@@ -352,7 +361,7 @@ int
 hs_bigint_from_i32(hs_bigint *bi, const int32_t value)
 {
   if (hs_bigint_init(bi, 1)) return 1;
-  bi->data[0] = (uint32_t)(value & (uint32_t)INT32_MAX);
+  bi->data[0] = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
   bi->negative = value < 0; 
   return 0;
 }
@@ -362,18 +371,32 @@ hs_bigint_from_u64(hs_bigint *bi, const uint64_t value)
 {
   if (hs_bigint_init(bi, 2)) return 1;
   bi->data[0] = (uint32_t)(value & (uint64_t)UINT32_MAX);
-  bi->data[1] = (uint32_t)(value >> UINT32_MAX);
+  bi->data[1] = (uint32_t)(value >> 32);
+  bi->size = bi->data[1] ? 2 : 1;
   return 0;
 }
 
 int
 hs_bigint_from_i64(hs_bigint *bi, const int64_t value)
 {
-  if (hs_bigint_from_u64(bi, (value & (uint64_t)INT64_MAX) )) return 1;
+  uint64_t magnitude = value < 0 ? 0u - (uint64_t)value : (uint64_t)value;
+  if (hs_bigint_from_u64(bi, magnitude)) return 1;
   bi->negative = value < 0; 
   return 0;
 }
 
+int
+hs_bigint_to_i64(const hs_bigint *bi, int64_t *value)
+{
+  uint64_t magnitude = bi->data[0];
+  if (bi->size > 2) return 1;
+  if (bi->size == 2) magnitude |= (uint64_t)bi->data[1] << 32;
+  /* The negative side has one more number than the positive one */
+  if (magnitude > (uint64_t)INT64_MAX + bi->negative) return 1;
+  *value = bi->negative ? (int64_t)(0u - magnitude) : (int64_t)magnitude;
+  return 0;
+}
+
 void
 hs_bigint_end(hs_bigint *bi)
 {
@@ -569,7 +592,7 @@ hs_bigint_mod(const hs_bigint *a, const hs_bigint *b, hs_bigint *dst)
 int
 hs_bigint_neg(const hs_bigint *src, hs_bigint *dst)
 {
-  if (hs_bigint_copy(a, dst)) return 1;
+  if (hs_bigint_copy(src, dst)) return 1;
   if (hs_bigint_self_neg(dst)) {
     hs_bigint_end(dst);
     return 1;
@@ -580,7 +603,7 @@ hs_bigint_neg(const hs_bigint *src, hs_bigint *dst)
 int
 hs_bigint_cpl(const hs_bigint *src, hs_bigint *dst)
 {
-  if (hs_bigint_copy(a, dst)) return 1;
+  if (hs_bigint_copy(src, dst)) return 1;
   if (hs_bigint_self_cpl(dst)) {
     hs_bigint_end(dst);
     return 1;
@@ -591,7 +614,7 @@ hs_bigint_cpl(const hs_bigint *src, hs_bigint *dst)
 int
 hs_bigint_abs(const hs_bigint *src, hs_bigint *dst)
 {
-  if (hs_bigint_copy(a, dst)) return 1;
+  if (hs_bigint_copy(src, dst)) return 1;
   if (hs_bigint_self_abs(dst)) {
     hs_bigint_end(dst);
     return 1;
@@ -602,7 +625,11 @@ hs_bigint_abs(const hs_bigint *src, hs_bigint *dst)
 int
 hs_bigint_inc(hs_bigint *bi)
 {
-  if ( bi->negative && !is_zero(bi) ) return dec_bits(bi);
+  if ( bi->negative && !is_zero(bi) ) {
+    dec_bits(bi);
+    bi->negative = !is_zero(bi);
+    return 0;
+  }
   bi->negative = 0;
   return inc_bits(bi);
 }
@@ -610,20 +637,40 @@ hs_bigint_inc(hs_bigint *bi)
 int
 hs_bigint_dec(hs_bigint *bi)
 {
-  size_t i = 0;
-  if ( bi->negative && !is_zero(bi) ) return inc_bits(bi);
-  bi->negative = 1;
+  if ( bi->negative || is_zero(bi) ) {
+    bi->negative = 1;
+    return inc_bits(bi);
+  }
   return dec_bits(bi);
 }
 
+/**
+ * @brief subtracts the bits of a from the bits of b, storing them in a.
+ *
+ * Used when b is bigger than a, so the bits can't be subtracted in place.
+ * The sign of a is flipped, as the result goes to the other side of zero.
+ *
+ * @param a The left operand, smaller than b
+ * @param b The right operand
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+sub_bits_inverted(hs_bigint *a, const hs_bigint *b)
+{
+  hs_bigint tmp;
+  if (hs_bigint_copy(b, &tmp)) return 1;
+  sub_bits(&tmp, a);
+  tmp.negative = !a->negative;
+  hs_bigint_end(a);
+  *a = tmp;
+  return 0;
+}
+
 int
 hs_bigint_self_add(hs_bigint *a, const hs_bigint *b)
 {
   if (a->negative == b->negative) return add_bits(a, b);
-  if  (need_sub_inversion(a, b)) {
-    a->negative = !a->negative;
-    return sub_bits(b, a);
-  }
+  if (need_sub_inversion(a, b)) return sub_bits_inverted(a, b);
   return sub_bits(a, b);
 }
 
@@ -631,73 +678,58 @@ int
 hs_bigint_self_sub(hs_bigint *a, const hs_bigint *b)
 {
   if (a->negative != b->negative) return add_bits(a, b);
-  if  (need_sub_inversion(a, b)) {
-    a->negative = !a->negative;
-    return sub_bits(b, a);
-  }
+  if (need_sub_inversion(a, b)) return sub_bits_inverted(a, b);
   return sub_bits(a, b);  
 }
 
 /**
- * I don't really know how to do a faster multiplication algorithm, so I take
- * the approach of how the multiplication is defined, by adding "a" a number of 
- * "b" times. 
- * Also, the rule of symbols ( symbol(a) ^ symbol(b) )is applied apart for the 
+ * Multiplies the way it is done by hand, one word of b at a time, adding
+ * the partial products in a new number.
+ * The rule of symbols ( symbol(a) ^ symbol(b) ) is applied apart for the 
  * rest of algorithm.
  */
 int
 hs_bigint_self_mul(hs_bigint *a, const hs_bigint *b)
 {
-  hs_bigint count, accum, abs_b;
+  hs_bigint accum;
+  uint64_t  tmp, carry;
   int negative = a->negative ^ b->negative;
-  if (is_zero(a)) return 0;
-  if (is_zero(b)) { a->size = 1; a->data[0] = 0; a->negative = negative; return 0; }
-  if (hs_bigint_from_u32(&count, 0)) return 1;
-  if (hs_bigint_from_u32(&accum, 0)) { hs_bigint_end(&count); return 1; }
-  if ( hs_bigint_copy(b, &abs_b) ) {
-    hs_bigint_end(&count);
-    hs_bigint_end(&accum);
-    return 1;
-  };
-  abs_b->negative = 0;
-  while (!hs_bigint_equals(&count, abs_b))
-  {
-    if (add_bits(&accum, a)) {  
-      hs_bigint_end(&count); 
-      hs_bigint_end(&accum);
-      hs_bigint_end(&abs_b); 
-      return 1;
-    };
-    if (hs_bigint_inc(&count)) {
-      hs_bigint_end(&count);
-      hs_bigint_end(&accum);
-      hs_bigint_end(&abs_b); 
-      return 1;
+  if (is_zero(a) || is_zero(b)) { 
+    a->size = 1; 
+    a->data[0] = 0; 
+    a->negative = 0; 
+    return 0; 
+  }
+  if (hs_bigint_init(&accum, a->size + b->size)) return 1;
+  memset(accum.data, 0, accum.capa * sizeof(*(accum.data)));
+  for (size_t j = 0; j < b->size; ++j) {
+    carry = 0;
+    for (size_t i = 0; i < a->size; ++i) {
+      tmp = (uint64_t)a->data[i] * (uint64_t)b->data[j] + 
+            (uint64_t)accum.data[i + j] + carry;
+      accum.data[i + j] = (uint32_t)( tmp & (uint64_t)UINT32_MAX );
+      carry = tmp >> 32;
     }
+    accum.data[a->size + j] = (uint32_t)carry;
   }
-  hs_bigint_end(&count);
-  hs_bigint_end(&a);
-  hs_bigint_end(&abs_b); 
-  a->data = accum->data;
-  a->size = accum->size;
-  a->negative = negative;
+  accum.size = a->size + b->size;
+  while (accum.size > 1 && accum.data[accum.size - 1] == 0) {
+    --(accum.size);
+  }
+  accum.negative = negative;
+  hs_bigint_end(a);
+  *a = accum;
   return 0;
 }
 
-
-
-
- 
 int
 hs_bigint_self_div(hs_bigint *a, const hs_bigint *b)
 {
   hs_bigint accum, rem;
-  if (divrem(a, b, &accum, &rem) return 1;
+  if (divrem(a, b, &accum, &rem)) return 1;
   hs_bigint_end(a);
   hs_bigint_end(&rem);
-  a->size = accum->size;
-  a->data = accum->data;
-  a->negative = acumm->negative;
+  *a = accum;
   return 0;
 }
 
@@ -705,122 +737,170 @@ hs_bigint_self_div(hs_bigint *a, const hs_bigint *b)
  * Shifting left is multiplying by 2 n times,
  * so X << Y is the same as doing X * (2 ^ Y) in this library, the sign is 
  * always preserved to ensure this.
+ * Whole words are moved first, then the bits left inside a word, from the
+ * top word down so nothing is overwritten before it is read.
  */
 int
 hs_bigint_self_shl(hs_bigint *a, const hs_bigint *b)
 {
-  int carry, t;
-  if (b->negative || is_zero(b)) return 1;
-  hs_bigint bi;
-  if ( hs_bigint_from_u32(&bi, 0) ) return 1;
-  while ( !hs_bigint_equals(&bi, b) )
-  {
-    carry = 0;
-    for (size_t i = 0; i < a->size; ++i) {
-      t = a->data[i] & 0x80000000;
-      a->data[i] = a->data[i] << 1;
-      if (carry)
-        a->data[i] |= 1;
-      carry = t;
-    }
-    if ( (a->data[a->size - 1] == 0) && a->size > 1) --(a->size);
-    if ( hs_bigint_inc(&bi) ) {
-      hs_bigint_end(&bi);
-      return 1;
-    }
+  size_t   count, words;
+  unsigned bits;
+  uint32_t high, low;
+  if (shift_count(b, &count)) return 1;
+  if (is_zero(a)) return 0;
+  words = count / 32;
+  bits  = (unsigned)( count % 32 );
+  /* One more word for the bits shifted out of the top one */
+  if (check_size(a, words + 1)) return 1;
+  for (size_t i = a->size + 1; i > 0; --i) {
+    high = i - 1 < a->size ? a->data[i - 1] : 0;
+    low  = i > 1 ? a->data[i - 2] : 0;
+    a->data[i - 1 + words] = bits ? (high << bits) | ( low >> (32 - bits) )
+                                  : high;
   }
-  hs_bigint_end(&bi);
+  memset(a->data, 0, words * sizeof(*(a->data)));
+  a->size += words + 1;
+  trim_size(a);
   return 0;  
 }
 
 int
 hs_bigint_self_shr(hs_bigint *a, const hs_bigint *b)
 {
-  if (shift_right(a, b)) return 1;
-  /* In signed (logical) right shift, the sign is preserved */
+  size_t count;
+  if (shift_count(b, &count)) return 1;
+  /* Like on two's complement numbers, negative numbers round down */
+  if (shift_right(a, count) && a->negative) return inc_bits(a);
+  a->negative = a->negative && !is_zero(a);
   return 0;
 }
 
 int
 hs_bigint_self_ushr(hs_bigint *a, const hs_bigint *b)
 {
-  if (shift_right(a, b)) return 1;
+  size_t count;
+  if (shift_count(b, &count)) return 1;
+  shift_right(a, count);
   /* In unsigned (arithmetic) right shift, the sign disappears */
   a->negative = 0;  
   return 0;
 }
 
-int
-hs_bigint_self_and(hs_bigint *a, const hs_bigint *b)
+/**
+ * @brief finds the lowest word of a number that is not zero
+ *
+ * @param bi A number
+ * @return The index of the word, zero if the number is zero
+ */
+static size_t
+lowest_word(const hs_bigint *bi)
+{
+  size_t i = 0;
+  while (i + 1 < bi->size && bi->data[i] == 0) {
+    ++i;
+  }
+  return i;
+}
+
+/**
+ * @brief gets a word of the two's complement of a number
+ *
+ * The two's complement of a negative number is ~magnitude + 1, where the
+ * carry of the + 1 stops at the lowest word that is not zero, so that word
+ * is negated, the ones below stay zero and the ones above are complemented.
+ * Past the top, the words repeat the sign.
+ *
+ * @param bi A number
+ * @param low The lowest word of bi that is not zero
+ * @param i The index of the word
+ * @return The word
+ */
+static uint32_t
+complement_word(const hs_bigint *bi, size_t low, size_t i)
 {
-  size_t size = a->size < b->size ? a->size : b->size;
-  a->size = size;
+  if (!bi->negative || is_zero(bi)) return i < bi->size ? bi->data[i] : 0;
+  if (i >= bi->size) return UINT32_MAX;
+  if (i < low) return 0;
+  return i == low ? 0u - bi->data[i] : ~bi->data[i];
+}
+
+enum bitwise_op { BITWISE_AND, BITWISE_OR, BITWISE_XOR };
+
+/**
+ * @brief does a bitwise operation on the two's complement of two numbers
+ *
+ * The result has one word more than the longest operand, for its sign, and
+ * is turned back into a magnitude the same way when it is negative.
+ *
+ * @param a The left operand, where the result is stored
+ * @param b The right operand
+ * @param op The operation
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+bitwise(hs_bigint *a, const hs_bigint *b, enum bitwise_op op)
+{
+  hs_bigint r;
+  uint32_t  x, y;
+  size_t    size = ( a->size > b->size ? a->size : b->size ) + 1;
+  size_t    low_a = lowest_word(a), low_b = lowest_word(b), low;
+  if (hs_bigint_init(&r, size)) return 1;
   for (size_t i = 0; i < size; ++i) {
-    a->data[i] = a->data[i] & b->data[i];
+    x = complement_word(a, low_a, i);
+    y = complement_word(b, low_b, i);
+    r.data[i] = op == BITWISE_AND ? x & y : op == BITWISE_OR ? x | y : x ^ y;
   }
-  a->size = size;
+  r.size = size;
+  if (r.data[size - 1] >> 31) {
+    low = lowest_word(&r);
+    for (size_t i = low; i < size; ++i) {
+      r.data[i] = i == low ? 0u - r.data[i] : ~r.data[i];
+    }
+    r.negative = 1;
+  }
+  trim_size(&r);
+  hs_bigint_end(a);
+  *a = r;
   return 0;
 }
 
+int
+hs_bigint_self_and(hs_bigint *a, const hs_bigint *b)
+{
+  return bitwise(a, b, BITWISE_AND);
+}
+
 int
 hs_bigint_self_rem(hs_bigint *a, const hs_bigint *b)
 {
   hs_bigint accum, rem;
-  if (divrem(a, b, &accum, &rem) return 1;
+  if (divrem(a, b, &accum, &rem)) return 1;
   hs_bigint_end(a);
   hs_bigint_end(&accum);
-  a->size = rem->size;
-  a->data = rem->data;
-  a->negative = rem->negative;
+  *a = rem;
   return 0;
 }
 
 int
 hs_bigint_self_mod(hs_bigint *a, const hs_bigint *b)
 {
-  /* TODO: implement (a % b + b) % b  */
-  if ( hs_bigint_self_rem(a, b) ) return 1;
-  if ( hs_bigint_self_add(a, b) ) return 1;
+  /* (a % b + b) % b, the remainder only moves when its sign is not b's */
   if ( hs_bigint_self_rem(a, b) ) return 1;
+  if ( !is_zero(a) && a->negative != b->negative )
+    return hs_bigint_self_add(a, b);
   return 0;
 }
 
 int
 hs_bigint_self_or(hs_bigint *a, const hs_bigint *b)
 {
-  size_t size = a->size < b->size ? a->size : b->size;
-  if (a->size < b->size) {
-    if (check_size(a, b->size - a->size) {
-      return 1;
-    }
-  }
-  for (size_t i = 0; i < size; ++i) {
-    a->data[i] = a->data[i] | b->data[i];
-  }
-  for (size_t j = a->size; j < b->size; ++j) {
-    a->data[j] = b->data[j];
-  }  
-  a->size = b->size;
-  return 0;
+  return bitwise(a, b, BITWISE_OR);
 }
 
 int
 hs_bigint_self_xor(hs_bigint *a, const hs_bigint *b)
 {
-  size_t size = a->size < b->size ? a->size : b->size;
-  if (a->size < b->size) {
-    if (check_size(a, b->size - a->size) {
-      return 1;
-    }
-  }
-  for (size_t i = 0; i < size; ++i) {
-    a->data[i] = a->data[i] ^ b->data[i];
-  }
-  for (size_t j = a->size; j < b->size; ++j) {
-    a->data[j] = b->data[j];
-  }  
-  a->size = b->size;
-  return 0;
+  return bitwise(a, b, BITWISE_XOR);
 }
 
 int
@@ -840,17 +920,9 @@ hs_bigint_self_abs(hs_bigint *bi)
 int
 hs_bigint_self_cpl(hs_bigint *bi)
 {
-  size_t i;
-  for (size_t i = 0; i < bi->size; ++i) {
-    bi->data[i] = ~bi->data[i];
-  }
-  if (inc_bits(bi)) return 1;
-  if (bi->data[bi->size - 1] == 1) {
-    --(bi->size);
-    bi->data[bi->size] = 0;
-    bi->negative = !bi->negative;
-  }
-  return 0;
+  /* On two's complement numbers ~bi is -bi - 1 */
+  bi->negative = !bi->negative;
+  return hs_bigint_dec(bi);
 }
 
 int
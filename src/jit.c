@@ -0,0 +1,998 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* A copy-and-patch compiler for x86-64.
+ *
+ * Each instruction is made of stencils, machine code with holes for its
+ * registers, immediates and jump targets. Compiling a function copies the
+ * stencils of every instruction one after the other, and patches the holes.
+ * There is no dispatch left: each instruction falls into the next one, and
+ * jumps go straight to the code of their target.
+ *
+ * The code only covers the instructions of numeric kernels. A function
+ * with anything else is left to the interpreter. A check that fails, like a
+ * type guard or an integer overflow, leaves the code and resumes the
+ * interpreter on the same instruction, which raises the error or promotes
+ * the result to a BIGINT as usual.
+ *
+ * The compiled code is called as an hs_jit_entry, with the registers on rdi,
+ * the result on rsi, the instruction index on rdx and the safepoint flag on
+ * rcx. It never calls anything, so it needs no frame of its own.
+ *
+ * A hot loop of a running function is compiled on its own, for the types
+ * its registers hold when the loop gets hot (see hs_function_osr()). The
+ * types are followed through the loop, so checks they prove are dropped,
+ * and registers whose tag is already right only get their value written.
+ * Guards on the way in send the interpreter back when a type differs.
+ */
+/* MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The stencils know the offsets of the tag and value of a 16 byte object */
+#if defined(__x86_64__) && defined(__linux__) && !defined(HS_NAN_BOXING)
+#include <sys/mman.h>
+#define HS_JIT_X86_64 1
+#endif
+
+#include <hs/vm.h>
+
+#ifdef HS_JIT_X86_64
+
+/* What is patched on a hole, all of them are 4 bytes unless noted */
+enum hole_kind
+{
+  HOLE_NONE = 0,
+  HOLE_A,          /* the offset of the value of register a */
+  HOLE_A_TAG,      /* the offset of the tag of register a */
+  HOLE_B,
+  HOLE_B_TAG,
+  HOLE_C,
+  HOLE_C_TAG,
+  HOLE_RESULT,     /* the offset of the value of the result */
+  HOLE_RESULT_TAG, /* the offset of the tag of the result */
+  HOLE_IMM,        /* the immediate of the instruction */
+  HOLE_INDEX,      /* the index of the instruction */
+  HOLE_TARGET,     /* relative address of the code of the jump target */
+  HOLE_SKIP,       /* relative address of the instruction after the next */
+  HOLE_EXIT,       /* relative address of the exit resuming this instruction */
+  HOLE_POLL,       /* relative address of the exit polling at the target */
+  HOLE_TABLE,      /* relative address of the entry table */
+  HOLE_DEOPT,      /* relative address of the exit of the entry guards */
+  HOLE_JCC,        /* 1 byte, a near jump on the condition */
+  HOLE_JNCC_SHORT  /* 1 byte, a short jump on the opposite condition */
+};
+
+#define HS_JIT_MAX_HOLES 5
+
+/**
+ * @brief A piece of machine code, with the holes to patch on each copy.
+ */
+typedef struct stencil
+{
+  const uint8_t *code;
+  uint8_t        size;
+  struct
+  {
+    uint8_t at;
+    uint8_t kind;
+  } holes[HS_JIT_MAX_HOLES];
+} stencil;
+
+#define STENCIL(name, ...)                                                     \
+  static const stencil name = { name##_code, sizeof name##_code,              \
+                                { __VA_ARGS__ } }
+
+/* The most stencils an instruction is made of */
+#define HS_JIT_MAX_STENCILS 6
+
+#define H 0, 0, 0, 0
+#define TAG(t) (t), 0, 0, 0
+
+/* mov eax, [rdx]; lea r8, [table]; movsxd rax, [r8 + rax * 4];
+ * add rax, r8; jmp rax */
+static const uint8_t prologue_code[] = {
+  0x8B, 0x02, 0x4C, 0x8D, 0x05, H, 0x49, 0x63, 0x04, 0x80, 0x4C, 0x01, 0xC0,
+  0xFF, 0xE0
+};
+STENCIL(prologue, { 5, HOLE_TABLE });
+
+/* mov dword [rdx], index; mov eax, status; ret */
+static const uint8_t resume_code[] = {
+  0xC7, 0x02, H, 0xB8, TAG(HS_JIT_RESUME), 0xC3
+};
+STENCIL(resume, { 2, HOLE_INDEX });
+static const uint8_t poll_code[] = {
+  0xC7, 0x02, H, 0xB8, TAG(HS_JIT_SAFEPOINT), 0xC3
+};
+STENCIL(poll, { 2, HOLE_INDEX });
+static const uint8_t deopt_code[] = {
+  0xC7, 0x02, H, 0xB8, TAG(HS_JIT_DEOPT), 0xC3
+};
+STENCIL(deopt, { 2, HOLE_INDEX });
+
+/* Type guards: cmp dword [a.tag], type; jne exit */
+static const uint8_t guard_a_int_code[] = {
+  0x81, 0xBF, H, TAG(HS_OBJECT_FIXINT), 0x0F, 0x85, H
+};
+STENCIL(guard_a_int, { 2, HOLE_A_TAG }, { 12, HOLE_EXIT });
+static const uint8_t guard_b_int_code[] = {
+  0x81, 0xBF, H, TAG(HS_OBJECT_FIXINT), 0x0F, 0x85, H
+};
+STENCIL(guard_b_int, { 2, HOLE_B_TAG }, { 12, HOLE_EXIT });
+static const uint8_t guard_c_int_code[] = {
+  0x81, 0xBF, H, TAG(HS_OBJECT_FIXINT), 0x0F, 0x85, H
+};
+STENCIL(guard_c_int, { 2, HOLE_C_TAG }, { 12, HOLE_EXIT });
+static const uint8_t guard_b_float_code[] = {
+  0x81, 0xBF, H, TAG(HS_OBJECT_FLOAT), 0x0F, 0x85, H
+};
+STENCIL(guard_b_float, { 2, HOLE_B_TAG }, { 12, HOLE_EXIT });
+static const uint8_t guard_c_float_code[] = {
+  0x81, 0xBF, H, TAG(HS_OBJECT_FLOAT), 0x0F, 0x85, H
+};
+STENCIL(guard_c_float, { 2, HOLE_C_TAG }, { 12, HOLE_EXIT });
+/* mov eax, [a.tag]; cmp eax, int; je ok; cmp eax, bool; jne exit; ok: */
+static const uint8_t guard_a_integral_code[] = {
+  0x8B, 0x87, H, 0x83, 0xF8, HS_OBJECT_FIXINT, 0x74, 0x09,
+  0x83, 0xF8, HS_OBJECT_BOOLEAN, 0x0F, 0x85, H
+};
+STENCIL(guard_a_integral, { 2, HOLE_A_TAG }, { 16, HOLE_EXIT });
+/* The guards on the way into a loop, the type is the immediate */
+static const uint8_t guard_entry_code[] = {
+  0x81, 0xBF, H, H, 0x0F, 0x85, H
+};
+STENCIL(guard_entry, { 2, HOLE_A_TAG }, { 6, HOLE_IMM }, { 12, HOLE_DEOPT });
+
+/* Loads: mov dword [a], value; mov dword [a.tag], type */
+static const uint8_t load_null_code[] = {
+  0xC7, 0x87, H, TAG(HS_OBJECT_NULL)
+};
+STENCIL(load_null, { 2, HOLE_A_TAG });
+static const uint8_t load_false_code[] = {
+  0xC7, 0x87, H, 0, 0, 0, 0, 0xC7, 0x87, H, TAG(HS_OBJECT_BOOLEAN)
+};
+STENCIL(load_false, { 2, HOLE_A }, { 12, HOLE_A_TAG });
+static const uint8_t load_true_code[] = {
+  0xC7, 0x87, H, 1, 0, 0, 0, 0xC7, 0x87, H, TAG(HS_OBJECT_BOOLEAN)
+};
+STENCIL(load_true, { 2, HOLE_A }, { 12, HOLE_A_TAG });
+static const uint8_t load_int_code[] = {
+  0xC7, 0x87, H, H, 0xC7, 0x87, H, TAG(HS_OBJECT_FIXINT)
+};
+STENCIL(load_int, { 2, HOLE_A }, { 6, HOLE_IMM }, { 12, HOLE_A_TAG });
+static const uint8_t load_int_raw_code[] = { 0xC7, 0x87, H, H };
+STENCIL(load_int_raw, { 2, HOLE_A }, { 6, HOLE_IMM });
+
+/* mov rax, [b]; mov [a], rax; mov eax, [b.tag]; mov [a.tag], eax */
+static const uint8_t move_code[] = {
+  0x48, 0x8B, 0x87, H, 0x48, 0x89, 0x87, H, 0x8B, 0x87, H, 0x89, 0x87, H
+};
+STENCIL(move, { 3, HOLE_B }, { 10, HOLE_A }, { 16, HOLE_B_TAG },
+        { 22, HOLE_A_TAG });
+static const uint8_t move_raw_code[] = {
+  0x48, 0x8B, 0x87, H, 0x48, 0x89, 0x87, H
+};
+STENCIL(move_raw, { 3, HOLE_B }, { 10, HOLE_A });
+
+/* Integers: eax <- b, eax <- eax op c, a <- eax */
+static const uint8_t load_b_code[] = { 0x8B, 0x87, H };
+STENCIL(load_b, { 2, HOLE_B });
+static const uint8_t load_a_code[] = { 0x8B, 0x87, H };
+STENCIL(load_a, { 2, HOLE_A });
+static const uint8_t add_c_code[] = { 0x03, 0x87, H };
+STENCIL(add_c, { 2, HOLE_C });
+static const uint8_t sub_c_code[] = { 0x2B, 0x87, H };
+STENCIL(sub_c, { 2, HOLE_C });
+static const uint8_t mul_c_code[] = { 0x0F, 0xAF, 0x87, H };
+STENCIL(mul_c, { 3, HOLE_C });
+static const uint8_t and_c_code[] = { 0x23, 0x87, H };
+STENCIL(and_c, { 2, HOLE_C });
+static const uint8_t or_c_code[] = { 0x0B, 0x87, H };
+STENCIL(or_c, { 2, HOLE_C });
+static const uint8_t xor_c_code[] = { 0x33, 0x87, H };
+STENCIL(xor_c, { 2, HOLE_C });
+/* add eax, 1 and sub eax, 1 */
+static const uint8_t inc_eax_code[] = { 0x83, 0xC0, 0x01 };
+STENCIL(inc_eax, { 0, HOLE_NONE });
+static const uint8_t dec_eax_code[] = { 0x83, 0xE8, 0x01 };
+STENCIL(dec_eax, { 0, HOLE_NONE });
+/* jo exit, before a result that left hs_int is stored */
+static const uint8_t jo_exit_code[] = { 0x0F, 0x80, H };
+STENCIL(jo_exit, { 2, HOLE_EXIT });
+static const uint8_t store_a_code[] = {
+  0x89, 0x87, H, 0xC7, 0x87, H, TAG(HS_OBJECT_FIXINT)
+};
+STENCIL(store_a, { 2, HOLE_A }, { 8, HOLE_A_TAG });
+static const uint8_t store_a_raw_code[] = { 0x89, 0x87, H };
+STENCIL(store_a_raw, { 2, HOLE_A });
+
+/* r8d <- -1, 0 or 1 comparing eax with a register:
+ * cmp eax, [r]; setg r8b; setl r9b; movzx r8d, r8b; movzx r9d, r9b;
+ * sub r8d, r9d */
+#define CMP_SET_CODE(hole)                                                     \
+  0x3B, 0x87, hole, 0x41, 0x0F, 0x9F, 0xC0, 0x41, 0x0F, 0x9C, 0xC1,            \
+  0x45, 0x0F, 0xB6, 0xC0, 0x45, 0x0F, 0xB6, 0xC9, 0x45, 0x29, 0xC8
+static const uint8_t cmp_b_code[] = { CMP_SET_CODE(H) };
+STENCIL(cmp_b, { 2, HOLE_B });
+static const uint8_t cmp_c_code[] = { CMP_SET_CODE(H) };
+STENCIL(cmp_c, { 2, HOLE_C });
+/* mov [r], r8d; mov dword [r.tag], int */
+static const uint8_t store_r8_a_code[] = {
+  0x44, 0x89, 0x87, H, 0xC7, 0x87, H, TAG(HS_OBJECT_FIXINT)
+};
+STENCIL(store_r8_a, { 3, HOLE_A }, { 9, HOLE_A_TAG });
+static const uint8_t store_r8_c_code[] = {
+  0x44, 0x89, 0x87, H, 0xC7, 0x87, H, TAG(HS_OBJECT_FIXINT)
+};
+STENCIL(store_r8_c, { 3, HOLE_C }, { 9, HOLE_C_TAG });
+static const uint8_t store_r8_a_raw_code[] = { 0x44, 0x89, 0x87, H };
+STENCIL(store_r8_a_raw, { 3, HOLE_A });
+static const uint8_t store_r8_c_raw_code[] = { 0x44, 0x89, 0x87, H };
+STENCIL(store_r8_c_raw, { 3, HOLE_C });
+
+/* Floats: xmm0 <- b, xmm0 <- xmm0 op c, a <- xmm0, cvtsi2ss converts */
+static const uint8_t fload_b_code[] = { 0xF3, 0x0F, 0x10, 0x87, H };
+STENCIL(fload_b, { 4, HOLE_B });
+static const uint8_t fadd_c_code[] = { 0xF3, 0x0F, 0x58, 0x87, H };
+STENCIL(fadd_c, { 4, HOLE_C });
+static const uint8_t fsub_c_code[] = { 0xF3, 0x0F, 0x5C, 0x87, H };
+STENCIL(fsub_c, { 4, HOLE_C });
+static const uint8_t fmul_c_code[] = { 0xF3, 0x0F, 0x59, 0x87, H };
+STENCIL(fmul_c, { 4, HOLE_C });
+static const uint8_t fdiv_c_code[] = { 0xF3, 0x0F, 0x5E, 0x87, H };
+STENCIL(fdiv_c, { 4, HOLE_C });
+static const uint8_t int2float_b_code[] = { 0xF3, 0x0F, 0x2A, 0x87, H };
+STENCIL(int2float_b, { 4, HOLE_B });
+static const uint8_t fstore_a_code[] = {
+  0xF3, 0x0F, 0x11, 0x87, H, 0xC7, 0x87, H, TAG(HS_OBJECT_FLOAT)
+};
+STENCIL(fstore_a, { 4, HOLE_A }, { 10, HOLE_A_TAG });
+static const uint8_t fstore_a_raw_code[] = { 0xF3, 0x0F, 0x11, 0x87, H };
+STENCIL(fstore_a_raw, { 4, HOLE_A });
+
+/* Branches, the condition comes from the opcode */
+static const uint8_t test_a_code[] = { 0x83, 0xBF, H, 0x00 };
+STENCIL(test_a, { 2, HOLE_A });
+static const uint8_t test_r8_code[] = { 0x45, 0x85, 0xC0 };
+STENCIL(test_r8, { 0, HOLE_NONE });
+static const uint8_t jcc_code[] = { 0x0F, 0x80, H };
+STENCIL(jcc, { 1, HOLE_JCC }, { 2, HOLE_TARGET });
+static const uint8_t jmp_code[] = { 0xE9, H };
+STENCIL(jmp, { 1, HOLE_TARGET });
+static const uint8_t jmp_skip_code[] = { 0xE9, H };
+STENCIL(jmp_skip, { 1, HOLE_SKIP });
+static const uint8_t jmp_exit_code[] = { 0xE9, H };
+STENCIL(jmp_exit, { 1, HOLE_EXIT });
+/* Backward jumps poll the safepoint flag first:
+ * cmp dword [rcx], 0; jne poll; jmp target */
+static const uint8_t poll_jmp_code[] = {
+  0x83, 0x39, 0x00, 0x0F, 0x85, H, 0xE9, H
+};
+STENCIL(poll_jmp, { 5, HOLE_POLL }, { 10, HOLE_TARGET });
+static const uint8_t poll_jcc_code[] = {
+  0x70, 0x0E, 0x83, 0x39, 0x00, 0x0F, 0x85, H, 0xE9, H
+};
+STENCIL(poll_jcc, { 0, HOLE_JNCC_SHORT }, { 7, HOLE_POLL },
+        { 12, HOLE_TARGET });
+
+/* Returns: copy a to the result; mov dword [rdx], index; xor eax, eax; ret */
+static const uint8_t ret_a_code[] = {
+  0x48, 0x8B, 0x87, H, 0x48, 0x89, 0x86, H, 0x8B, 0x87, H, 0x89, 0x86, H,
+  0xC7, 0x02, H, 0x31, 0xC0, 0xC3
+};
+STENCIL(ret_a, { 3, HOLE_A }, { 10, HOLE_RESULT }, { 16, HOLE_A_TAG },
+        { 22, HOLE_RESULT_TAG }, { 28, HOLE_INDEX });
+static const uint8_t ret_null_code[] = {
+  0xC7, 0x86, H, TAG(HS_OBJECT_NULL), 0xC7, 0x02, H, 0x31, 0xC0, 0xC3
+};
+STENCIL(ret_null, { 2, HOLE_RESULT_TAG }, { 12, HOLE_INDEX });
+
+#undef H
+#undef TAG
+
+/* The condition codes of eq, ne, lt, le, gt and ge */
+static const uint8_t conditions[] = { 0x4, 0x5, 0xC, 0xE, 0xF, 0xD };
+
+/* The type of a register nothing is known about */
+#define HS_JIT_ANY 255
+
+/* Checks a type known before the instruction, never known without types */
+#define KNOWN(r, type) ( types && types[r] == (type) )
+
+/**
+ * @brief Picks the stencils of an instruction.
+ *
+ * @param ins The instruction.
+ * @param at Its index.
+ * @param types The type of each register before the instruction, or NULL
+ *        when nothing is known. Guards they prove are left out.
+ * @param out Where the stencils go, at least HS_JIT_MAX_STENCILS.
+ * @param cond Where the condition code of a branch goes.
+ * @return The number of stencils, -1 if the instruction is not supported.
+ */
+static int
+select_stencils(const hs_instruction *ins, size_t at, const uint8_t *types,
+                const stencil **out, uint8_t *cond)
+{
+  int n = 0;
+  int backward = (size_t)ins->imm <= at;
+  switch (ins->opcode)
+  {
+    case HS_OP_NOP:
+    case HS_OP_BREAKPOINT:
+    case HS_OP_EXTRA_ARG:
+      return 0;
+    case HS_OP_LOAD_NULL:  out[n++] = &load_null;  return n;
+    case HS_OP_LOAD_FALSE: out[n++] = &load_false; return n;
+    case HS_OP_LOAD_TRUE:  out[n++] = &load_true;  return n;
+    case HS_OP_LOAD_INT_CONST:
+    case HS_OP_LOAD_INT_WIDE:
+      out[n++] = KNOWN(ins->a, HS_OBJECT_FIXINT) ? &load_int_raw : &load_int;
+      return n;
+    case HS_OP_MOVE:
+      out[n++] = types && types[ins->b] != HS_JIT_ANY &&
+                 types[ins->a] == types[ins->b] ? &move_raw : &move;
+      return n;
+
+    case HS_OP_INT_ADD: case HS_OP_INT_SUB: case HS_OP_INT_MUL:
+    case HS_OP_INT_AND: case HS_OP_INT_OR:  case HS_OP_INT_XOR:
+    case HS_OP_INT_CMP:
+      if (!KNOWN(ins->b, HS_OBJECT_FIXINT)) out[n++] = &guard_b_int;
+      if (!KNOWN(ins->c, HS_OBJECT_FIXINT)) out[n++] = &guard_c_int;
+      /* fall through */
+    case HS_OP_INT_ADD_UNCHECKED: case HS_OP_INT_SUB_UNCHECKED:
+    case HS_OP_INT_MUL_UNCHECKED: case HS_OP_INT_AND_UNCHECKED:
+    case HS_OP_INT_OR_UNCHECKED:  case HS_OP_INT_XOR_UNCHECKED:
+    case HS_OP_INT_CMP_UNCHECKED:
+      out[n++] = &load_b;
+      switch (ins->opcode)
+      {
+        case HS_OP_INT_ADD: case HS_OP_INT_ADD_UNCHECKED:
+          out[n++] = &add_c;
+          out[n++] = &jo_exit;
+          break;
+        case HS_OP_INT_SUB: case HS_OP_INT_SUB_UNCHECKED:
+          out[n++] = &sub_c;
+          out[n++] = &jo_exit;
+          break;
+        case HS_OP_INT_MUL: case HS_OP_INT_MUL_UNCHECKED:
+          out[n++] = &mul_c;
+          out[n++] = &jo_exit;
+          break;
+        case HS_OP_INT_AND: case HS_OP_INT_AND_UNCHECKED:
+          out[n++] = &and_c; break;
+        case HS_OP_INT_OR: case HS_OP_INT_OR_UNCHECKED:
+          out[n++] = &or_c; break;
+        case HS_OP_INT_XOR: case HS_OP_INT_XOR_UNCHECKED:
+          out[n++] = &xor_c; break;
+        default:
+          out[n++] = &cmp_c;
+          out[n++] = KNOWN(ins->a, HS_OBJECT_FIXINT) ? &store_r8_a_raw :
+                                                        &store_r8_a;
+          return n;
+      }
+      out[n++] = KNOWN(ins->a, HS_OBJECT_FIXINT) ? &store_a_raw : &store_a;
+      return n;
+
+    case HS_OP_INT_INC:
+    case HS_OP_INT_DEC:
+      if (!KNOWN(ins->a, HS_OBJECT_FIXINT)) out[n++] = &guard_a_int;
+      /* fall through */
+    case HS_OP_INT_INC_UNCHECKED:
+    case HS_OP_INT_DEC_UNCHECKED:
+      out[n++] = &load_a;
+      out[n++] = ins->opcode == HS_OP_INT_INC ||
+                 ins->opcode == HS_OP_INT_INC_UNCHECKED ? &inc_eax : &dec_eax;
+      out[n++] = &jo_exit;
+      out[n++] = &store_a_raw;
+      return n;
+
+    case HS_OP_FLOAT_ADD: case HS_OP_FLOAT_SUB:
+    case HS_OP_FLOAT_MUL: case HS_OP_FLOAT_DIV:
+      if (!KNOWN(ins->b, HS_OBJECT_FLOAT)) out[n++] = &guard_b_float;
+      if (!KNOWN(ins->c, HS_OBJECT_FLOAT)) out[n++] = &guard_c_float;
+      /* fall through */
+    case HS_OP_FLOAT_ADD_UNCHECKED: case HS_OP_FLOAT_SUB_UNCHECKED:
+    case HS_OP_FLOAT_MUL_UNCHECKED: case HS_OP_FLOAT_DIV_UNCHECKED:
+      out[n++] = &fload_b;
+      switch (ins->opcode)
+      {
+        case HS_OP_FLOAT_ADD: case HS_OP_FLOAT_ADD_UNCHECKED:
+          out[n++] = &fadd_c; break;
+        case HS_OP_FLOAT_SUB: case HS_OP_FLOAT_SUB_UNCHECKED:
+          out[n++] = &fsub_c; break;
+        case HS_OP_FLOAT_MUL: case HS_OP_FLOAT_MUL_UNCHECKED:
+          out[n++] = &fmul_c; break;
+        default:
+          out[n++] = &fdiv_c; break;
+      }
+      out[n++] = KNOWN(ins->a, HS_OBJECT_FLOAT) ? &fstore_a_raw : &fstore_a;
+      return n;
+
+    case HS_OP_INT2FLOAT:
+      if (!KNOWN(ins->b, HS_OBJECT_FIXINT)) out[n++] = &guard_b_int;
+      out[n++] = &int2float_b;
+      out[n++] = KNOWN(ins->a, HS_OBJECT_FLOAT) ? &fstore_a_raw : &fstore_a;
+      return n;
+
+    case HS_OP_JUMP:
+      out[n++] = backward ? &poll_jmp : &jmp;
+      return n;
+
+    case HS_OP_JUMP_EQ_ZERO: case HS_OP_JUMP_NE_ZERO:
+    case HS_OP_JUMP_LT_ZERO: case HS_OP_JUMP_LE_ZERO:
+    case HS_OP_JUMP_GT_ZERO: case HS_OP_JUMP_GE_ZERO:
+      *cond = conditions[ins->opcode - HS_OP_JUMP_EQ_ZERO];
+      if (!KNOWN(ins->a, HS_OBJECT_FIXINT) &&
+          !KNOWN(ins->a, HS_OBJECT_BOOLEAN))
+        out[n++] = &guard_a_integral;
+      out[n++] = &test_a;
+      out[n++] = backward ? &poll_jcc : &jcc;
+      return n;
+    case HS_OP_JUMP_EQ_ZERO_UNCHECKED: case HS_OP_JUMP_NE_ZERO_UNCHECKED:
+    case HS_OP_JUMP_LT_ZERO_UNCHECKED: case HS_OP_JUMP_LE_ZERO_UNCHECKED:
+    case HS_OP_JUMP_GT_ZERO_UNCHECKED: case HS_OP_JUMP_GE_ZERO_UNCHECKED:
+      *cond = conditions[ins->opcode - HS_OP_JUMP_EQ_ZERO_UNCHECKED];
+      out[n++] = &test_a;
+      out[n++] = backward ? &poll_jcc : &jcc;
+      return n;
+
+    /* c <- a <=> b, jump on c op 0, or go on after the fused jump */
+    case HS_OP_INT_JUMP_EQ: case HS_OP_INT_JUMP_NE:
+    case HS_OP_INT_JUMP_LT: case HS_OP_INT_JUMP_LE:
+    case HS_OP_INT_JUMP_GT: case HS_OP_INT_JUMP_GE:
+      *cond = conditions[ins->opcode - HS_OP_INT_JUMP_EQ];
+      if (!KNOWN(ins->a, HS_OBJECT_FIXINT)) out[n++] = &guard_a_int;
+      if (!KNOWN(ins->b, HS_OBJECT_FIXINT)) out[n++] = &guard_b_int;
+      goto int_jump;
+    case HS_OP_INT_JUMP_EQ_UNCHECKED: case HS_OP_INT_JUMP_NE_UNCHECKED:
+    case HS_OP_INT_JUMP_LT_UNCHECKED: case HS_OP_INT_JUMP_LE_UNCHECKED:
+    case HS_OP_INT_JUMP_GT_UNCHECKED: case HS_OP_INT_JUMP_GE_UNCHECKED:
+      *cond = conditions[ins->opcode - HS_OP_INT_JUMP_EQ_UNCHECKED];
+    int_jump:
+      out[n++] = &load_a;
+      out[n++] = &cmp_b;
+      out[n++] = KNOWN(ins->c, HS_OBJECT_FIXINT) ? &store_r8_c_raw :
+                                                    &store_r8_c;
+      out[n++] = &test_r8;
+      out[n++] = backward ? &poll_jcc : &jcc;
+      out[n++] = &jmp_skip;
+      return n;
+
+    case HS_OP_RETURN:
+      out[n++] = &ret_a;
+      return n;
+    case HS_OP_RETURN_NULL:
+    case HS_OP_END_BYTECODE:
+      out[n++] = &ret_null;
+      return n;
+
+    default:
+      return -1;
+  }
+}
+
+/**
+ * @brief Finds what an instruction leaves known on the registers, and where
+ *        it goes next.
+ *
+ * Only the instructions with stencils are followed, checked forms leave
+ * their operands known since they exit on anything else.
+ *
+ * @param ins The instruction.
+ * @param at Its index.
+ * @param types The types before it, changed into the types after it.
+ * @param next Where the next instructions go, at most two.
+ * @return The number of next instructions, -1 if the instruction can't be
+ *         compiled.
+ */
+static int
+flow_step(const hs_instruction *ins, size_t at, uint8_t *types, size_t *next)
+{
+  next[0] = at + 1;
+  switch (ins->opcode)
+  {
+    case HS_OP_NOP:
+    case HS_OP_BREAKPOINT:
+    case HS_OP_EXTRA_ARG:
+      return 1;
+    case HS_OP_LOAD_NULL:
+      types[ins->a] = HS_OBJECT_NULL;
+      return 1;
+    case HS_OP_LOAD_FALSE:
+    case HS_OP_LOAD_TRUE:
+      types[ins->a] = HS_OBJECT_BOOLEAN;
+      return 1;
+    case HS_OP_LOAD_INT_CONST:
+    case HS_OP_LOAD_INT_WIDE:
+    case HS_OP_INT_INC: case HS_OP_INT_INC_UNCHECKED:
+    case HS_OP_INT_DEC: case HS_OP_INT_DEC_UNCHECKED:
+      types[ins->a] = HS_OBJECT_FIXINT;
+      return 1;
+    case HS_OP_MOVE:
+      types[ins->a] = types[ins->b];
+      return 1;
+    case HS_OP_INT_ADD: case HS_OP_INT_SUB: case HS_OP_INT_MUL:
+    case HS_OP_INT_AND: case HS_OP_INT_OR:  case HS_OP_INT_XOR:
+    case HS_OP_INT_CMP:
+    case HS_OP_INT_ADD_UNCHECKED: case HS_OP_INT_SUB_UNCHECKED:
+    case HS_OP_INT_MUL_UNCHECKED: case HS_OP_INT_AND_UNCHECKED:
+    case HS_OP_INT_OR_UNCHECKED:  case HS_OP_INT_XOR_UNCHECKED:
+    case HS_OP_INT_CMP_UNCHECKED:
+      types[ins->b] = HS_OBJECT_FIXINT;
+      types[ins->c] = HS_OBJECT_FIXINT;
+      types[ins->a] = HS_OBJECT_FIXINT;
+      return 1;
+    case HS_OP_FLOAT_ADD: case HS_OP_FLOAT_SUB:
+    case HS_OP_FLOAT_MUL: case HS_OP_FLOAT_DIV:
+    case HS_OP_FLOAT_ADD_UNCHECKED: case HS_OP_FLOAT_SUB_UNCHECKED:
+    case HS_OP_FLOAT_MUL_UNCHECKED: case HS_OP_FLOAT_DIV_UNCHECKED:
+      types[ins->b] = HS_OBJECT_FLOAT;
+      types[ins->c] = HS_OBJECT_FLOAT;
+      types[ins->a] = HS_OBJECT_FLOAT;
+      return 1;
+    case HS_OP_INT2FLOAT:
+      types[ins->b] = HS_OBJECT_FIXINT;
+      types[ins->a] = HS_OBJECT_FLOAT;
+      return 1;
+    case HS_OP_JUMP:
+      next[0] = (size_t)ins->imm;
+      return 1;
+    case HS_OP_JUMP_EQ_ZERO: case HS_OP_JUMP_NE_ZERO:
+    case HS_OP_JUMP_LT_ZERO: case HS_OP_JUMP_LE_ZERO:
+    case HS_OP_JUMP_GT_ZERO: case HS_OP_JUMP_GE_ZERO:
+    case HS_OP_JUMP_EQ_ZERO_UNCHECKED: case HS_OP_JUMP_NE_ZERO_UNCHECKED:
+    case HS_OP_JUMP_LT_ZERO_UNCHECKED: case HS_OP_JUMP_LE_ZERO_UNCHECKED:
+    case HS_OP_JUMP_GT_ZERO_UNCHECKED: case HS_OP_JUMP_GE_ZERO_UNCHECKED:
+      next[1] = (size_t)ins->imm;
+      return 2;
+    case HS_OP_INT_JUMP_EQ: case HS_OP_INT_JUMP_NE:
+    case HS_OP_INT_JUMP_LT: case HS_OP_INT_JUMP_LE:
+    case HS_OP_INT_JUMP_GT: case HS_OP_INT_JUMP_GE:
+    case HS_OP_INT_JUMP_EQ_UNCHECKED: case HS_OP_INT_JUMP_NE_UNCHECKED:
+    case HS_OP_INT_JUMP_LT_UNCHECKED: case HS_OP_INT_JUMP_LE_UNCHECKED:
+    case HS_OP_INT_JUMP_GT_UNCHECKED: case HS_OP_INT_JUMP_GE_UNCHECKED:
+      types[ins->a] = HS_OBJECT_FIXINT;
+      types[ins->b] = HS_OBJECT_FIXINT;
+      types[ins->c] = HS_OBJECT_FIXINT;
+      next[0] = at + 2;
+      next[1] = (size_t)ins->imm;
+      return 2;
+    case HS_OP_RETURN:
+    case HS_OP_RETURN_NULL:
+    case HS_OP_END_BYTECODE:
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/**
+ * @brief What is known before each instruction of a loop compiled on-stack.
+ */
+typedef struct flow
+{
+  uint8_t *types;   /* window types for each instruction */
+  uint8_t *reached; /* one of flow_reach for each instruction */
+  size_t   window;
+} flow;
+
+/* How the loop reaches an instruction */
+enum flow_reach
+{
+  FLOW_NEVER = 0,
+  FLOW_RUN,        /* the code runs it */
+  FLOW_EXIT        /* it has no stencils, the code leaves there */
+};
+
+/**
+ * @brief Follows the code from a loop header, starting with the types the
+ *        registers hold now.
+ *
+ * The paths stop on the instructions without stencils, which give the
+ * call back to the interpreter. That is fine after the loop, but not inside
+ * it: between the header and the last jump back to it.
+ *
+ * @return zero on success, a non zero value if the loop runs something
+ *         without stencils, or there is no memory.
+ */
+static int
+flow_follow(const hs_function *fn, size_t header, const hs_object *regs,
+            flow *f)
+{
+  uint8_t  *types;
+  uint8_t  *queued;
+  uint32_t *work;
+  size_t    count = 0;
+  size_t    end   = header;
+  int       failed = 0;
+  f->window  = fn->registers;
+  f->types   = malloc(fn->size * f->window + 1);
+  f->reached = calloc(fn->size, 1);
+  types      = malloc(f->window + 1);
+  queued     = calloc(fn->size, 1);
+  work       = malloc(fn->size * sizeof(uint32_t));
+  if (!f->types || !f->reached || !types || !queued || !work)
+  {
+    free(types);
+    free(queued);
+    free(work);
+    return 1;
+  }
+  /* Only the types the stencils use are worth a guard */
+  for (size_t r = 0; r < f->window; ++r)
+  {
+    hs_object_type tag = HS_TAG(regs[r]);
+    f->types[header * f->window + r] =
+      tag == HS_OBJECT_FIXINT || tag == HS_OBJECT_FLOAT ||
+      tag == HS_OBJECT_BOOLEAN ? (uint8_t)tag : HS_JIT_ANY;
+  }
+  f->reached[header] = FLOW_RUN;
+  queued[header]     = 1;
+  work[count++]      = (uint32_t)header;
+  while (count && !failed)
+  {
+    size_t at = work[--count];
+    size_t next[2];
+    int    nexts;
+    queued[at] = 0;
+    memcpy(types, f->types + at * f->window, f->window);
+    nexts = flow_step(fn->instructions + at, at, types, next);
+    if (nexts < 0)
+    {
+      f->reached[at] = FLOW_EXIT;
+      continue;
+    }
+    for (int n = 0; n < nexts && !failed; ++n)
+    {
+      uint8_t *into = f->types + next[n] * f->window;
+      int      changed = 0;
+      if (next[n] >= fn->size)
+      {
+        failed = 1;
+        break;
+      }
+      if (next[n] == header && at > end) end = at;
+      if (!f->reached[next[n]])
+      {
+        memcpy(into, types, f->window);
+        f->reached[next[n]] = FLOW_RUN;
+        changed = 1;
+      }
+      for (size_t r = 0; r < f->window; ++r)
+      {
+        if (into[r] != types[r] && into[r] != HS_JIT_ANY)
+        {
+          into[r] = HS_JIT_ANY;
+          changed = 1;
+        }
+      }
+      if (changed && !queued[next[n]])
+      {
+        queued[next[n]] = 1;
+        work[count++]   = (uint32_t)next[n];
+      }
+    }
+  }
+  for (size_t i = header; i <= end && !failed; ++i)
+  {
+    if (f->reached[i] == FLOW_EXIT) failed = 1;
+  }
+  free(types);
+  free(queued);
+  free(work);
+  return failed;
+}
+
+/**
+ * @brief Where everything is placed inside the code of a function.
+ */
+typedef struct layout
+{
+  uint8_t  *memory;
+  size_t   *code;     /* the offset of each instruction */
+  size_t    resumes;  /* the offset of the resume exits */
+  size_t    polls;    /* the offset of the safepoint exits */
+  size_t    guards;   /* the offset of the entry guards of a loop */
+  size_t    deopt;    /* the offset of the exit of the entry guards */
+  size_t    table;    /* the offset of the entry table */
+  size_t    size;
+} layout;
+
+#define HS_JIT_EXIT_SIZE sizeof resume_code
+
+/**
+ * @brief Copies a stencil, then patches its holes.
+ */
+static size_t
+patch(const layout *l, size_t pos, const stencil *s, const hs_instruction *ins,
+      size_t index, uint8_t cond)
+{
+  uint8_t *dst = l->memory + pos;
+  memcpy(dst, s->code, s->size);
+  for (size_t h = 0; h < HS_JIT_MAX_HOLES && s->holes[h].kind; ++h)
+  {
+    uint8_t *hole = dst + s->holes[h].at;
+    int64_t  value = 0;
+    size_t   to   = 0;
+    int      rel  = 0;
+    switch (s->holes[h].kind)
+    {
+      case HOLE_A:
+        value = ins->a * sizeof(hs_object) + offsetof(hs_object, value);
+        break;
+      case HOLE_A_TAG:
+        value = ins->a * sizeof(hs_object) + offsetof(hs_object, tag);
+        break;
+      case HOLE_B:
+        value = ins->b * sizeof(hs_object) + offsetof(hs_object, value);
+        break;
+      case HOLE_B_TAG:
+        value = ins->b * sizeof(hs_object) + offsetof(hs_object, tag);
+        break;
+      case HOLE_C:
+        value = ins->c * sizeof(hs_object) + offsetof(hs_object, value);
+        break;
+      case HOLE_C_TAG:
+        value = ins->c * sizeof(hs_object) + offsetof(hs_object, tag);
+        break;
+      case HOLE_RESULT:     value = offsetof(hs_object, value); break;
+      case HOLE_RESULT_TAG: value = offsetof(hs_object, tag);   break;
+      case HOLE_IMM:        value = ins->imm;                   break;
+      case HOLE_INDEX:      value = (int64_t)index;             break;
+      case HOLE_TARGET: to = l->code[ins->imm];                  rel = 1; break;
+      case HOLE_SKIP:   to = l->code[index + 2];                 rel = 1; break;
+      case HOLE_EXIT:   to = l->resumes + index * HS_JIT_EXIT_SIZE;
+                        rel = 1; break;
+      case HOLE_POLL:   to = l->polls + ins->imm * HS_JIT_EXIT_SIZE;
+                        rel = 1; break;
+      case HOLE_TABLE:  to = l->table;                           rel = 1; break;
+      case HOLE_DEOPT:  to = l->deopt;                           rel = 1; break;
+      case HOLE_JCC:
+        *hole = (uint8_t)( 0x80 | cond );
+        continue;
+      case HOLE_JNCC_SHORT:
+        *hole = (uint8_t)( 0x70 | ( cond ^ 1 ) );
+        continue;
+      default:
+        continue;
+    }
+    /* Relative addresses count from the end of the hole */
+    if (rel) value = (int64_t)to - (int64_t)( pos + s->holes[h].at + 4 );
+    {
+      uint32_t word = (uint32_t)(int32_t)value;
+      hole[0] = (uint8_t)word;
+      hole[1] = (uint8_t)( word >> 8 );
+      hole[2] = (uint8_t)( word >> 16 );
+      hole[3] = (uint8_t)( word >> 24 );
+    }
+  }
+  return pos + s->size;
+}
+
+/**
+ * @brief Compiles the code of a function.
+ *
+ * @param fn The function.
+ * @param f What is known of a loop compiled on-stack, NULL to compile the
+ *        whole function. Instructions the loop can't reach get no code,
+ *        and the ones without stencils only leave, entering on them
+ *        resumes the interpreter.
+ * @param header The instruction where the loop is entered.
+ * @param code Where the address of the code goes.
+ * @param size Where the size of the code goes.
+ * @return zero on success, a non zero value if an instruction has no
+ *         stencils, or there is no memory.
+ */
+static int
+compile(const hs_function *fn, const flow *f, size_t header, void **code,
+        size_t *size)
+{
+  const stencil *pieces[HS_JIT_MAX_STENCILS];
+  layout         l;
+  size_t         pos;
+  size_t         guards = 0;
+  uint8_t        cond = 0;
+  void          *memory;
+  l.code = malloc(( fn->size + 1 ) * sizeof(size_t));
+  if (!l.code) return 1;
+  pos = prologue.size;
+  if (f)
+  {
+    /* Each known type of the header is checked on the way in */
+    for (size_t r = 0; r < f->window; ++r)
+    {
+      if (f->types[header * f->window + r] != HS_JIT_ANY) ++guards;
+    }
+    l.guards = pos;
+    pos += guards * guard_entry.size + jmp.size;
+  }
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    const uint8_t *types = f ? f->types + i * f->window : NULL;
+    int            n = 0;
+    l.code[i] = pos;
+    if (f && f->reached[i] == FLOW_EXIT) pos += jmp_exit.size;
+    if (f && f->reached[i] != FLOW_RUN) continue;
+    n = select_stencils(fn->instructions + i, i, types, pieces, &cond);
+    if (n < 0)
+    {
+      free(l.code);
+      return 1;
+    }
+    for (int p = 0; p < n; ++p)
+    {
+      pos += pieces[p]->size;
+    }
+  }
+  /* A fused jump skips its last instruction, END_BYTECODE is never fused */
+  l.code[fn->size] = pos;
+  l.resumes = pos;
+  l.polls   = l.resumes + fn->size * HS_JIT_EXIT_SIZE;
+  l.deopt   = l.polls + fn->size * HS_JIT_EXIT_SIZE;
+  l.table   = l.deopt + HS_JIT_EXIT_SIZE;
+  l.size    = l.table + fn->size * sizeof(int32_t);
+  memory = mmap(NULL, l.size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+  {
+    free(l.code);
+    return 1;
+  }
+  l.memory = memory;
+  pos = patch(&l, 0, &prologue, NULL, 0, 0);
+  if (f)
+  {
+    hs_instruction check;
+    memset(&check, 0, sizeof check);
+    for (size_t r = 0; r < f->window; ++r)
+    {
+      uint8_t type = f->types[header * f->window + r];
+      if (type == HS_JIT_ANY) continue;
+      check.a   = (uint8_t)r;
+      check.imm = type;
+      pos = patch(&l, pos, &guard_entry, &check, header, 0);
+    }
+    check.imm = (int32_t)header;
+    pos = patch(&l, pos, &jmp, &check, header, 0);
+  }
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    const uint8_t *types = f ? f->types + i * f->window : NULL;
+    int            n;
+    if (f && f->reached[i] == FLOW_EXIT)
+      pos = patch(&l, pos, &jmp_exit, fn->instructions + i, i, 0);
+    if (f && f->reached[i] != FLOW_RUN) continue;
+    n = select_stencils(fn->instructions + i, i, types, pieces, &cond);
+    for (int p = 0; p < n; ++p)
+    {
+      pos = patch(&l, pos, pieces[p], fn->instructions + i, i, cond);
+    }
+  }
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    patch(&l, l.resumes + i * HS_JIT_EXIT_SIZE, &resume, NULL, i, 0);
+    patch(&l, l.polls + i * HS_JIT_EXIT_SIZE, &poll, NULL, i, 0);
+  }
+  patch(&l, l.deopt, &deopt, NULL, header, 0);
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    size_t  to = l.code[i];
+    int32_t entry;
+    if (f && i == header)
+      to = l.guards;
+    else if (f && f->reached[i] != FLOW_RUN)
+      to = l.resumes + i * HS_JIT_EXIT_SIZE;
+    entry = (int32_t)( (int64_t)to - (int64_t)l.table );
+    memcpy(l.memory + l.table + i * sizeof(int32_t), &entry, sizeof entry);
+  }
+  free(l.code);
+  /* Never writable and executable at once */
+  if (mprotect(memory, l.size, PROT_READ | PROT_EXEC))
+  {
+    munmap(memory, l.size);
+    return 1;
+  }
+  *code = memory;
+  *size = l.size;
+  return 0;
+}
+
+int
+hs_function_jit(hs_function *fn)
+{
+  void *code;
+  /* The stencils read tags as 32 bit words */
+  if (sizeof(((hs_object *)0)->tag) != 4) return 1;
+  if (fn->jit_entry) return 0;
+  if (compile(fn, NULL, 0, &code, &fn->jit_size)) return 1;
+  fn->jit_code = code;
+  memcpy(&fn->jit_entry, &code, sizeof code);
+  return 0;
+}
+
+int
+hs_function_osr(hs_function *fn, uint32_t header, const hs_object *regs)
+{
+  flow  f;
+  void *code;
+  int   failed;
+  if (sizeof(((hs_object *)0)->tag) != 4 || header >= fn->size) return 1;
+  hs_function_osr_end(fn);
+  failed = flow_follow(fn, header, regs, &f) ||
+           compile(fn, &f, header, &code, &fn->osr_size);
+  free(f.types);
+  free(f.reached);
+  if (failed) return 1;
+  fn->osr_code = code;
+  fn->osr_at   = header;
+  memcpy(&fn->osr_entry, &code, sizeof code);
+  return 0;
+}
+
+void
+hs_function_osr_end(hs_function *fn)
+{
+  if (fn->osr_code) munmap(fn->osr_code, fn->osr_size);
+  fn->osr_code  = NULL;
+  fn->osr_size  = 0;
+  fn->osr_entry = NULL;
+}
+
+void
+hs_function_jit_end(hs_function *fn)
+{
+  if (fn->jit_code) munmap(fn->jit_code, fn->jit_size);
+  fn->jit_code  = NULL;
+  fn->jit_size  = 0;
+  fn->jit_entry = NULL;
+  hs_function_osr_end(fn);
+}
+
+#else
+
+int
+hs_function_jit(hs_function *fn)
+{
+  (void)fn;
+  return 1;
+}
+
+int
+hs_function_osr(hs_function *fn, uint32_t header, const hs_object *regs)
+{
+  (void)fn;
+  (void)header;
+  (void)regs;
+  return 1;
+}
+
+void
+hs_function_osr_end(hs_function *fn)
+{
+  fn->osr_code  = NULL;
+  fn->osr_size  = 0;
+  fn->osr_entry = NULL;
+}
+
+void
+hs_function_jit_end(hs_function *fn)
+{
+  fn->jit_code  = NULL;
+  fn->jit_size  = 0;
+  fn->jit_entry = NULL;
+  hs_function_osr_end(fn);
+}
+
+#endif
@@ -0,0 +1,738 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <hs/object.h>
+
+#define HS_INSTANCE_INIT_CAPA 4
+#define HS_ELEMENTS_INIT_CAPA 4
+
+hs_shape *
+hs_shape_new(void)
+{
+  hs_shape *shape = malloc(sizeof *shape);
+  if (!shape) return NULL;
+  shape->parent      = NULL;
+  HS_SET_NULL(shape->key);
+  shape->size        = 0;
+  shape->children    = NULL;
+  shape->child_count = 0;
+  shape->child_capa  = 0;
+  return shape;
+}
+
+void
+hs_shape_free(hs_shape *shape)
+{
+  for (size_t i = 0; i < shape->child_count; ++i)
+  {
+    hs_shape_free(shape->children[i]);
+  }
+  free(shape->children);
+  free(shape);
+}
+
+int
+hs_key_equals(hs_object a, hs_object b)
+{
+  if (HS_TAG(a) != HS_TAG(b)) return 0;
+  switch (HS_TAG(a))
+  {
+    case HS_OBJECT_NULL:
+      return 1;
+    case HS_OBJECT_BOOLEAN:
+    case HS_OBJECT_FIXINT:
+      return HS_AS_INT(a) == HS_AS_INT(b);
+    case HS_OBJECT_FLOAT:
+      return HS_AS_FLOAT(a) == HS_AS_FLOAT(b);
+    case HS_OBJECT_BIGINT:
+      return hs_bigint_equals(&HS_AS_BOX(a)->value.as_bigint,
+                              &HS_AS_BOX(b)->value.as_bigint);
+    case HS_OBJECT_NATIVE_FUNCTION:
+      return HS_AS_NATIVE_FN(a) == HS_AS_NATIVE_FN(b);
+    case HS_OBJECT_CODE_FUNCTION:
+      return HS_AS_CLOSURE(a) == HS_AS_CLOSURE(b);
+    case HS_OBJECT_INSTANCE:
+      return HS_AS_INSTANCE(a) == HS_AS_INSTANCE(b);
+    case HS_OBJECT_STRING:
+      /* Interned, so equal texts always share the box */
+      return HS_AS_BOX(a) == HS_AS_BOX(b);
+    default:
+      return HS_AS_BOX(a) == HS_AS_BOX(b);
+  }
+}
+
+size_t
+hs_key_hash(hs_object key)
+{
+  size_t hash;
+  switch (HS_TAG(key))
+  {
+    case HS_OBJECT_NULL:
+      hash = 0;
+      break;
+    case HS_OBJECT_BOOLEAN:
+    case HS_OBJECT_FIXINT:
+      hash = (size_t)(uint32_t)HS_AS_INT(key);
+      break;
+    case HS_OBJECT_FLOAT:
+    {
+      hs_float value = HS_AS_FLOAT(key);
+      uint32_t bits  = 0;
+      /* 0.0 and -0.0 are equal, so they must hash the same */
+      if (value != 0) memcpy(&bits, &value, sizeof bits);
+      hash = (size_t)bits;
+      break;
+    }
+    case HS_OBJECT_BIGINT:
+    {
+      const hs_bigint *bi = &HS_AS_BOX(key)->value.as_bigint;
+      hash = (size_t)bi->negative;
+      for (size_t i = 0; i < bi->size; ++i)
+      {
+        hash = hash * 31 + bi->data[i];
+      }
+      break;
+    }
+    case HS_OBJECT_NATIVE_FUNCTION:
+      hash = (size_t)HS_AS_NATIVE_FN(key);
+      break;
+    case HS_OBJECT_CODE_FUNCTION:
+      hash = (size_t)HS_AS_CLOSURE(key);
+      break;
+    case HS_OBJECT_INSTANCE:
+      hash = (size_t)HS_AS_INSTANCE(key);
+      break;
+    default:
+      hash = (size_t)HS_AS_BOX(key);
+      break;
+  }
+  return hash * 31 + (size_t)HS_TAG(key);
+}
+
+int
+hs_shape_find(const hs_shape *shape, hs_object key, size_t *slot)
+{
+  /* The newest properties are found first, walking to the root */
+  for (; shape->parent; shape = shape->parent)
+  {
+    if (hs_key_equals(shape->key, key))
+    {
+      *slot = shape->size - 1;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+hs_shape *
+hs_shape_add(hs_shape *shape, hs_object key)
+{
+  hs_shape *child;
+  for (size_t i = 0; i < shape->child_count; ++i)
+  {
+    if (hs_key_equals(shape->children[i]->key, key))
+      return shape->children[i];
+  }
+  if (shape->child_count == shape->child_capa)
+  {
+    size_t     capa = shape->child_capa ? shape->child_capa * 2 : 2;
+    hs_shape **children = realloc(shape->children, capa * sizeof *children);
+    if (!children) return NULL;
+    shape->children   = children;
+    shape->child_capa = capa;
+  }
+  child = hs_shape_new();
+  if (!child) return NULL;
+  child->parent = shape;
+  child->key    = key;
+  child->size   = shape->size + 1;
+  shape->children[shape->child_count++] = child;
+  return child;
+}
+
+hs_instance *
+hs_instance_new(hs_shape *root)
+{
+  hs_instance *obj = malloc(sizeof *obj);
+  if (!obj) return NULL;
+  obj->shape = root;
+  obj->slots = NULL;
+  obj->capa  = 0;
+  obj->proto = NULL;
+  return obj;
+}
+
+hs_instance *
+hs_instance_extend(hs_shape *root, hs_instance *proto)
+{
+  hs_instance *obj = hs_instance_new(root);
+  if (obj) obj->proto = proto;
+  return obj;
+}
+
+hs_instance *
+hs_instance_clone(const hs_instance *proto)
+{
+  hs_instance *obj = hs_instance_new(proto->shape);
+  size_t       size = proto->shape->size;
+  if (!obj) return NULL;
+  obj->proto = proto->proto;
+  if (size == 0) return obj;
+  obj->slots = malloc(size * sizeof(hs_object));
+  if (!obj->slots)
+  {
+    free(obj);
+    return NULL;
+  }
+  memcpy(obj->slots, proto->slots, size * sizeof(hs_object));
+  obj->capa = size;
+  return obj;
+}
+
+void
+hs_instance_free(hs_instance *obj)
+{
+  free(obj->slots);
+  free(obj);
+}
+
+int
+hs_instance_get(const hs_instance *obj, hs_object key, hs_object *dst)
+{
+  size_t slot;
+  for (; obj; obj = obj->proto)
+  {
+    if (!hs_shape_find(obj->shape, key, &slot))
+    {
+      *dst = obj->slots[slot];
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+hs_instance_set(hs_instance *obj, hs_object key, hs_object value)
+{
+  size_t    slot;
+  hs_shape *shape;
+  if (!hs_shape_find(obj->shape, key, &slot))
+  {
+    obj->slots[slot] = value;
+    return 0;
+  }
+  shape = hs_shape_add(obj->shape, key);
+  if (!shape) return 1;
+  if (shape->size > obj->capa)
+  {
+    size_t     capa  = obj->capa ? obj->capa * 2 : HS_INSTANCE_INIT_CAPA;
+    hs_object *slots = realloc(obj->slots, capa * sizeof(hs_object));
+    if (!slots) return 1;
+    obj->slots = slots;
+    obj->capa  = capa;
+  }
+  obj->slots[shape->size - 1] = value;
+  obj->shape = shape;
+  return 0;
+}
+
+void
+hs_object_area_init(hs_object_area *area)
+{
+  area->boxes = NULL;
+  area->size  = 0;
+}
+
+hs_box *
+hs_object_area_box(hs_object_area *area, hs_object_type type)
+{
+  hs_box *box = calloc(1, sizeof *box);
+  if (!box) return NULL;
+  box->area     = area;
+  box->type     = type;
+  box->links[0] = area->boxes;
+  area->boxes   = box;
+  ++area->size;
+  return box;
+}
+
+void
+hs_object_area_end(hs_object_area *area)
+{
+  hs_box *box, *next;
+  for (box = area->boxes; box; box = next)
+  {
+    next = box->links[0];
+    switch (box->type)
+    {
+      case HS_OBJECT_BIGINT: hs_bigint_end(&box->value.as_bigint); break;
+      case HS_OBJECT_ARRAY:  hs_elements_end(&box->value.as_array); break;
+      default:               break;
+    }
+    free(box);
+  }
+  hs_object_area_init(area);
+}
+
+/**
+ * @brief gets an integer as an int64, if it fits.
+ */
+static int
+integer_to_i64(hs_object obj, int64_t *value)
+{
+  if (HS_TAG(obj) == HS_OBJECT_BIGINT)
+    return hs_bigint_to_i64(&HS_AS_BOX(obj)->value.as_bigint, value);
+  *value = HS_AS_INT(obj);
+  return 0;
+}
+
+/**
+ * @brief gets an integer as a new hs_bigint.
+ */
+static int
+integer_to_bigint(hs_object obj, hs_bigint *bi)
+{
+  if (HS_TAG(obj) == HS_OBJECT_BIGINT)
+    return hs_bigint_copy(&HS_AS_BOX(obj)->value.as_bigint, bi);
+  return hs_bigint_from_i64(bi, HS_AS_INT(obj));
+}
+
+/**
+ * @brief gets the low 32 bits of an integer, in two's complement.
+ */
+static uint32_t
+integer_low_bits(hs_object obj)
+{
+  const hs_bigint *bi;
+  if (HS_TAG(obj) != HS_OBJECT_BIGINT) return (uint32_t)HS_AS_INT(obj);
+  bi = &HS_AS_BOX(obj)->value.as_bigint;
+  return bi->negative ? 0u - bi->data[0] : bi->data[0];
+}
+
+/**
+ * @brief stores an hs_bigint, boxed only if it does not fit in an hs_int.
+ *
+ * The box takes the bigint, which is released when it is not needed.
+ */
+static int
+integer_from_bigint(hs_object_area *area, hs_object *dst, hs_bigint *bi)
+{
+  int64_t value;
+  hs_box *box;
+  if (!hs_bigint_to_i64(bi, &value) &&
+      value >= INT32_MIN && value <= INT32_MAX)
+  {
+    hs_bigint_end(bi);
+    HS_SET_INT(*dst, (hs_int)value);
+    return 0;
+  }
+  box = hs_object_area_box(area, HS_OBJECT_BIGINT);
+  if (!box)
+  {
+    hs_bigint_end(bi);
+    return 1;
+  }
+  box->value.as_bigint = *bi;
+  HS_SET_BOX(*dst, HS_OBJECT_BIGINT, box);
+  return 0;
+}
+
+/**
+ * @brief raises a bigint to a power, by squaring.
+ *
+ * Negative exponents only give a non zero result for 1 and -1, and those
+ * are the only bases, with 0, that can take an exponent that is a BIGINT.
+ */
+static int
+bigint_pow(hs_bigint *base, const hs_bigint *exp)
+{
+  hs_bigint result;
+  int64_t   b, e;
+  int       failed = 0;
+  if (exp->negative || hs_bigint_to_i64(exp, &e))
+  {
+    if (hs_bigint_to_i64(base, &b) || b < -1 || b > 1)
+    {
+      if (!exp->negative) return 1;
+      b = 0;
+    }
+    else if (b == -1 && !( exp->data[0] & 1 ))
+      b = 1;
+    hs_bigint_end(base);
+    return hs_bigint_from_i64(base, b);
+  }
+  if (hs_bigint_from_u32(&result, 1)) return 1;
+  while (e)
+  {
+    if (e & 1) failed = hs_bigint_self_mul(&result, base);
+    e >>= 1;
+    if (e && !failed) failed = hs_bigint_self_mul(base, base);
+    if (failed)
+    {
+      hs_bigint_end(&result);
+      return 1;
+    }
+  }
+  hs_bigint_end(base);
+  *base = result;
+  return 0;
+}
+
+int
+hs_integer_from_i64(hs_object_area *area, hs_object *dst, int64_t value)
+{
+  hs_bigint bi;
+  if (value >= INT32_MIN && value <= INT32_MAX)
+  {
+    HS_SET_INT(*dst, (hs_int)value);
+    return 0;
+  }
+  if (hs_bigint_from_i64(&bi, value)) return 1;
+  return integer_from_bigint(area, dst, &bi);
+}
+
+/**
+ * @brief runs an operation on two FIXINTs, where the result is an int64.
+ *
+ * @return 0 on success, 1 on failure, 2 when it needs an hs_bigint.
+ */
+static int
+integer_compute_fixint(hs_object_area *area, hs_object *dst, int64_t i,
+                       int64_t j, hs_integer_op op)
+{
+  int64_t r;
+  switch (op)
+  {
+    case HS_INTEGER_ADD: r = i + j; break;
+    case HS_INTEGER_SUB: r = i - j; break;
+    case HS_INTEGER_MUL: r = i * j; break;
+    case HS_INTEGER_DIV:
+      if (j == 0) return 1;
+      r = i / j;
+      break;
+    case HS_INTEGER_MOD:
+    case HS_INTEGER_REM:
+      if (j == 0) return 1;
+      r = i % j;
+      if (op == HS_INTEGER_MOD && r != 0 && ( r < 0 ) != ( j < 0 )) r += j;
+      break;
+    case HS_INTEGER_SHL:
+      if (j < 0) return 1;
+      /* Shifting less than 32 bits never leaves an int64 */
+      if (j >= 32) return 2;
+      r = i * ( (int64_t)1 << j );
+      break;
+    case HS_INTEGER_SHR:
+      if (j < 0) return 1;
+      /* Shifting 63 bits or more only leaves the sign */
+      if (j > 62) j = 62;
+      r = i >= 0 ? i >> j : -1 - ( ( -1 - i ) >> j );
+      break;
+    case HS_INTEGER_AND: r = i & j; break;
+    case HS_INTEGER_OR:  r = i | j; break;
+    case HS_INTEGER_XOR: r = i ^ j; break;
+    case HS_INTEGER_CMP: r = i < j ? -1 : i > j; break;
+    default: return 2;
+  }
+  return hs_integer_from_i64(area, dst, r);
+}
+
+int
+hs_integer_compute(hs_object_area *area, hs_object *dst, hs_object a,
+                   hs_object b, hs_integer_op op)
+{
+  hs_bigint x, y;
+  int64_t   i, j;
+  int       failed;
+  if (op == HS_INTEGER_LSR)
+  {
+    if (integer_to_i64(b, &j))
+      j = HS_AS_BOX(b)->value.as_bigint.negative ? -1 : INT64_MAX;
+    if (j < 0) return 1;
+    HS_SET_INT(*dst, j >= 32 ? 0 : (hs_int)( integer_low_bits(a) >> j ));
+    return 0;
+  }
+  if (HS_TAG(a) == HS_OBJECT_FIXINT && HS_TAG(b) == HS_OBJECT_FIXINT)
+  {
+    /* Nothing but a power or a long shift on two hs_int leaves an int64 */
+    failed = integer_compute_fixint(area, dst, HS_AS_INT(a), HS_AS_INT(b), op);
+    if (failed != 2) return failed;
+  }
+  else if (op == HS_INTEGER_CMP && !integer_to_i64(a, &i) &&
+           !integer_to_i64(b, &j))
+  {
+    HS_SET_INT(*dst, i < j ? -1 : i > j);
+    return 0;
+  }
+  if (integer_to_bigint(a, &x)) return 1;
+  if (integer_to_bigint(b, &y))
+  {
+    hs_bigint_end(&x);
+    return 1;
+  }
+  switch (op)
+  {
+    case HS_INTEGER_ADD: failed = hs_bigint_self_add(&x, &y); break;
+    case HS_INTEGER_SUB: failed = hs_bigint_self_sub(&x, &y); break;
+    case HS_INTEGER_MUL: failed = hs_bigint_self_mul(&x, &y); break;
+    case HS_INTEGER_DIV: failed = hs_bigint_self_div(&x, &y); break;
+    case HS_INTEGER_MOD: failed = hs_bigint_self_mod(&x, &y); break;
+    case HS_INTEGER_REM: failed = hs_bigint_self_rem(&x, &y); break;
+    case HS_INTEGER_POW: failed = bigint_pow(&x, &y);         break;
+    case HS_INTEGER_SHL: failed = hs_bigint_self_shl(&x, &y); break;
+    case HS_INTEGER_SHR: failed = hs_bigint_self_shr(&x, &y); break;
+    case HS_INTEGER_AND: failed = hs_bigint_self_and(&x, &y); break;
+    case HS_INTEGER_OR:  failed = hs_bigint_self_or(&x, &y);  break;
+    case HS_INTEGER_XOR: failed = hs_bigint_self_xor(&x, &y); break;
+    default:
+      HS_SET_INT(*dst, hs_bigint_compare(&x, &y));
+      hs_bigint_end(&x);
+      hs_bigint_end(&y);
+      return 0;
+  }
+  hs_bigint_end(&y);
+  if (failed)
+  {
+    hs_bigint_end(&x);
+    return 1;
+  }
+  return integer_from_bigint(area, dst, &x);
+}
+
+int
+hs_integer_sign(hs_object a)
+{
+  const hs_bigint *bi;
+  if (HS_TAG(a) != HS_OBJECT_BIGINT)
+    return HS_AS_INT(a) < 0 ? -1 : HS_AS_INT(a) > 0;
+  bi = &HS_AS_BOX(a)->value.as_bigint;
+  for (size_t i = 0; i < bi->size; ++i)
+  {
+    if (bi->data[i]) return bi->negative ? -1 : 1;
+  }
+  return 0;
+}
+
+hs_float
+hs_integer_to_float(hs_object a)
+{
+  const hs_bigint *bi;
+  double           value = 0;
+  if (HS_TAG(a) != HS_OBJECT_BIGINT) return (hs_float)HS_AS_INT(a);
+  bi = &HS_AS_BOX(a)->value.as_bigint;
+  /* From the top word down, past 53 bits the lower words only round */
+  for (size_t i = bi->size; i > 0; --i)
+  {
+    value = value * 4294967296.0 + bi->data[i - 1];
+  }
+  return (hs_float)( bi->negative ? -value : value );
+}
+
+/**
+ * @brief gets the size of an element of a kind.
+ */
+static size_t
+elements_width(hs_elements_kind kind)
+{
+  switch (kind)
+  {
+    case HS_ELEMENTS_INT:   return sizeof(hs_int);
+    case HS_ELEMENTS_FLOAT: return sizeof(hs_float);
+    default:                return sizeof(hs_object);
+  }
+}
+
+/**
+ * @brief gets the most packed kind that can hold a value.
+ */
+static hs_elements_kind
+elements_kind_of(hs_object value)
+{
+  switch (HS_TAG(value))
+  {
+    case HS_OBJECT_FIXINT: return HS_ELEMENTS_INT;
+    case HS_OBJECT_FLOAT:  return HS_ELEMENTS_FLOAT;
+    default:               return HS_ELEMENTS_GENERIC;
+  }
+}
+
+/**
+ * @brief moves the elements to another kind, with room for capa of them.
+ *
+ * Only an empty array moves to a packed kind, so the values are either
+ * kept as they are or tagged as hs_objects.
+ */
+static int
+elements_convert(hs_elements *el, hs_elements_kind kind, size_t capa)
+{
+  hs_object *objects;
+  if (kind == el->kind || el->size == 0)
+  {
+    void *data = realloc(el->data.as_object, capa * elements_width(kind));
+    if (!data) return 1;
+    el->data.as_object = data;
+    el->kind = kind;
+    el->capa = capa;
+    return 0;
+  }
+  objects = malloc(capa * sizeof(hs_object));
+  if (!objects) return 1;
+  for (size_t i = 0; i < el->size; ++i)
+  {
+    if (el->kind == HS_ELEMENTS_INT)
+      HS_SET_INT(objects[i], el->data.as_int[i]);
+    else
+      HS_SET_FLOAT(objects[i], el->data.as_float[i]);
+  }
+  free(el->data.as_object);
+  el->data.as_object = objects;
+  el->kind = HS_ELEMENTS_GENERIC;
+  el->capa = capa;
+  return 0;
+}
+
+int
+hs_elements_new(hs_object_area *area, hs_object *dst, size_t capa)
+{
+  struct hs_box *box = hs_object_area_box(area, HS_OBJECT_ARRAY);
+  if (!box) return 1;
+  box->value.as_array.kind = HS_ELEMENTS_INT;
+  /* A failed box stays on the area, empty, and is released with it */
+  if (capa && elements_convert(&box->value.as_array, HS_ELEMENTS_INT, capa))
+    return 1;
+  HS_SET_BOX(*dst, HS_OBJECT_ARRAY, box);
+  return 0;
+}
+
+void
+hs_elements_end(hs_elements *el)
+{
+  free(el->data.as_object);
+  el->data.as_object = NULL;
+  el->size = 0;
+  el->capa = 0;
+}
+
+int
+hs_elements_get(const hs_elements *el, size_t at, hs_object *dst)
+{
+  if (at >= el->size) return 1;
+  switch (el->kind)
+  {
+    case HS_ELEMENTS_INT:   HS_SET_INT(*dst, el->data.as_int[at]);     break;
+    case HS_ELEMENTS_FLOAT: HS_SET_FLOAT(*dst, el->data.as_float[at]); break;
+    default:                *dst = el->data.as_object[at];             break;
+  }
+  return 0;
+}
+
+int
+hs_elements_set(hs_elements *el, size_t at, hs_object value)
+{
+  hs_elements_kind kind = elements_kind_of(value);
+  size_t           capa = el->capa;
+  if (at > el->size) return 1;
+  if (at == el->size && el->size == el->capa)
+    capa = capa ? capa * 2 : HS_ELEMENTS_INIT_CAPA;
+  /* An empty array takes the kind of its first value */
+  if (el->size == 0 && at == 0 && kind != el->kind)
+  {
+    if (elements_convert(el, kind, capa)) return 1;
+  }
+  else if (kind != el->kind && el->kind != HS_ELEMENTS_GENERIC)
+  {
+    if (elements_convert(el, HS_ELEMENTS_GENERIC, capa)) return 1;
+  }
+  else if (capa != el->capa)
+  {
+    if (elements_convert(el, el->kind, capa)) return 1;
+  }
+  switch (el->kind)
+  {
+    case HS_ELEMENTS_INT:   el->data.as_int[at]    = HS_AS_INT(value);   break;
+    case HS_ELEMENTS_FLOAT: el->data.as_float[at]  = HS_AS_FLOAT(value); break;
+    default:                el->data.as_object[at] = value;              break;
+  }
+  if (at == el->size) el->size += 1;
+  return 0;
+}
+
+int
+hs_elements_remove(hs_elements *el, size_t at)
+{
+  size_t width = elements_width(el->kind);
+  char  *data  = (char *)el->data.as_object;
+  if (at >= el->size) return 1;
+  memmove(data + at * width, data + (at + 1) * width,
+          (el->size - at - 1) * width);
+  el->size -= 1;
+  return 0;
+}
+
+int
+hs_range_init(hs_range *r, hs_int first, hs_int bound, int exclusive)
+{
+  int64_t distance = (int64_t)bound - first;
+  int64_t size     = ( distance < 0 ? -distance : distance ) + !exclusive;
+  if (size > INT32_MAX) return 1;
+  r->first = first;
+  r->step  = distance < 0 ? -1 : 1;
+  r->size  = size;
+  return 0;
+}
+
+int
+hs_range_step(hs_range *r, hs_int step)
+{
+  if (step < 1) return 1;
+  r->size = ( r->size + step - 1 ) / step;
+  /* The step never goes past the span of the range, so it fits in 33 bits */
+  if (r->size > 1) r->step *= step;
+  return 0;
+}
+
+int
+hs_range_slice(hs_range *dst, const hs_range *r, const hs_range *indexes)
+{
+  hs_range slice = { r->first, indexes->size, 1 };
+  int64_t  last  = indexes->first + ( indexes->size - 1 ) * indexes->step;
+  if (indexes->size > 0)
+  {
+    if (indexes->first < 0 || indexes->first >= r->size ||
+        last < 0 || last >= r->size)
+      return 1;
+    slice.first = (hs_int)( r->first + indexes->first * r->step );
+    if (indexes->size > 1) slice.step = r->step * indexes->step;
+  }
+  *dst = slice;
+  return 0;
+}
+
+int
+hs_range_includes(const hs_range *r, hs_int value)
+{
+  int64_t distance = (int64_t)value - r->first;
+  if (distance % r->step != 0) return 0;
+  distance /= r->step;
+  return distance >= 0 && distance < r->size;
+}
+
+int
+hs_range_new(hs_object_area *area, hs_object *dst, const hs_range *r)
+{
+  struct hs_box *box = hs_object_area_box(area, HS_OBJECT_RANGE);
+  if (!box) return 1;
+  box->value.as_range = *r;
+  HS_SET_BOX(*dst, HS_OBJECT_RANGE, box);
+  return 0;
+}
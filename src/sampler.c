@@ -0,0 +1,261 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+/* sigaction() and setitimer() */
+#define _XOPEN_SOURCE 600
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#define HS_SAMPLER_POSIX 1
+#endif
+
+#include <hs/vm.h>
+
+#define HS_SAMPLER_INIT_CAPA 64
+
+/* The sampler owning SIGPROF, the signal handler can't be given a pointer */
+static hs_sampler *volatile running;
+
+#ifdef HS_SAMPLER_POSIX
+static struct sigaction previous;
+
+/**
+ * @brief Asks the loop for a sample, it is taken on the next safepoint.
+ */
+static void
+on_sigprof(int signum)
+{
+  hs_sampler *sampler = running;
+  (void)signum;
+  if (sampler)
+  {
+    sampler->state->sample_pending += 1;
+    sampler->state->safepoint       = 1;
+  }
+}
+#endif
+
+int
+hs_sampler_start(hs_sampler *sampler, hs_state *state, unsigned interval)
+{
+#ifdef HS_SAMPLER_POSIX
+  struct sigaction  action;
+  struct itimerval  timer;
+  if (running || interval == 0) return 1;
+  sampler->state       = state;
+  sampler->stacks      = NULL;
+  sampler->stack_count = 0;
+  sampler->stack_capa  = 0;
+  sampler->samples     = 0;
+  sampler->lost        = 0;
+  state->sampler        = sampler;
+  state->sample_pending = 0;
+  memset(&action, 0, sizeof action);
+  action.sa_handler = on_sigprof;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  running = sampler;
+  if (sigaction(SIGPROF, &action, &previous))
+  {
+    running = NULL;
+    state->sampler = NULL;
+    return 1;
+  }
+  timer.it_interval.tv_sec  = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value            = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL))
+  {
+    sigaction(SIGPROF, &previous, NULL);
+    running = NULL;
+    state->sampler = NULL;
+    return 1;
+  }
+  return 0;
+#else
+  (void)sampler;
+  (void)state;
+  (void)interval;
+  return 1;
+#endif
+}
+
+void
+hs_sampler_stop(hs_sampler *sampler)
+{
+#ifdef HS_SAMPLER_POSIX
+  struct itimerval timer;
+  if (running != sampler) return;
+  memset(&timer, 0, sizeof timer);
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &previous, NULL);
+  running = NULL;
+  sampler->state->sampler        = NULL;
+  sampler->state->sample_pending = 0;
+#else
+  (void)sampler;
+#endif
+}
+
+/**
+ * @brief Hashes the frames of a stack.
+ */
+static size_t
+stack_hash(const hs_sample_frame *frames, size_t depth)
+{
+  size_t hash = depth;
+  for (size_t i = 0; i < depth; ++i)
+  {
+    hash = hash * 31 + (size_t)frames[i].function;
+    hash = hash * 31 + frames[i].line;
+  }
+  return hash;
+}
+
+/**
+ * @brief Compares two stacks, field by field since frames have padding.
+ */
+static int
+frames_equal(const hs_sample_frame *a, const hs_sample_frame *b, size_t depth)
+{
+  for (size_t i = 0; i < depth; ++i)
+  {
+    if (a[i].function != b[i].function || a[i].line != b[i].line) return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Finds the entry of a stack, or the free entry where it goes.
+ */
+static hs_sample_stack *
+stack_find(hs_sample_stack *stacks, size_t capa, size_t hash,
+           const hs_sample_frame *frames, size_t depth)
+{
+  for (size_t i = hash & ( capa - 1 ); ; i = ( i + 1 ) & ( capa - 1 ))
+  {
+    hs_sample_stack *entry = stacks + i;
+    if (!entry->frames) return entry;
+    if (entry->hash == hash && entry->depth == depth &&
+        frames_equal(entry->frames, frames, depth))
+      return entry;
+  }
+}
+
+/**
+ * @brief Doubles the stack table, it is kept at most half full.
+ */
+static int
+stacks_grow(hs_sampler *sampler)
+{
+  size_t           capa = sampler->stack_capa ? sampler->stack_capa * 2 :
+                                                HS_SAMPLER_INIT_CAPA;
+  hs_sample_stack *stacks = calloc(capa, sizeof *stacks);
+  if (!stacks) return 1;
+  for (size_t i = 0; i < sampler->stack_capa; ++i)
+  {
+    hs_sample_stack *old = sampler->stacks + i;
+    if (old->frames)
+      *stack_find(stacks, capa, old->hash, old->frames, old->depth) = *old;
+  }
+  free(sampler->stacks);
+  sampler->stacks     = stacks;
+  sampler->stack_capa = capa;
+  return 0;
+}
+
+int
+hs_sampler_add(hs_sampler *sampler, const hs_sample_frame *frames,
+               size_t depth, uint64_t weight)
+{
+  size_t           hash = stack_hash(frames, depth);
+  hs_sample_stack *entry;
+  if ( ( sampler->stack_count + 1 ) * 2 > sampler->stack_capa &&
+       stacks_grow(sampler) )
+  {
+    sampler->lost += weight;
+    return 1;
+  }
+  entry = stack_find(sampler->stacks, sampler->stack_capa, hash, frames,
+                     depth);
+  if (!entry->frames)
+  {
+    /* An empty stack still needs frames, to mark the entry as used */
+    entry->frames = malloc(( depth ? depth : 1 ) * sizeof *frames);
+    if (!entry->frames)
+    {
+      sampler->lost += weight;
+      return 1;
+    }
+    memcpy(entry->frames, frames, depth * sizeof *frames);
+    entry->depth = depth;
+    entry->hash  = hash;
+    entry->count = 0;
+    sampler->stack_count += 1;
+  }
+  entry->count     += weight;
+  sampler->samples += weight;
+  return 0;
+}
+
+/**
+ * @brief Writes the name of a function, anonymous functions are named after
+ *        their index on the module.
+ */
+static void
+write_function(const hs_function *fn, FILE *file)
+{
+  const hs_module *module = fn->module;
+  if (fn->name)
+    fputs(fn->name, file);
+  else if (module && fn >= module->functions &&
+           fn < module->functions + module->function_count)
+    fprintf(file, "def@%u", (unsigned)( fn - module->functions ));
+  else
+    fputs("<anonymous>", file);
+}
+
+int
+hs_sampler_write_folded(const hs_sampler *sampler, FILE *file)
+{
+  for (size_t i = 0; i < sampler->stack_capa; ++i)
+  {
+    const hs_sample_stack *entry = sampler->stacks + i;
+    if (!entry->frames) continue;
+    for (size_t j = entry->depth; j-- > 0; )
+    {
+      write_function(entry->frames[j].function, file);
+      if (entry->frames[j].line)
+        fprintf(file, ":%u", (unsigned)entry->frames[j].line);
+      if (j) fputc(';', file);
+    }
+    fprintf(file, " %llu\n", (unsigned long long)entry->count);
+  }
+  return ferror(file) ? 1 : 0;
+}
+
+void
+hs_sampler_end(hs_sampler *sampler)
+{
+  hs_sampler_stop(sampler);
+  for (size_t i = 0; i < sampler->stack_capa; ++i)
+  {
+    free(sampler->stacks[i].frames);
+  }
+  free(sampler->stacks);
+  sampler->stacks      = NULL;
+  sampler->stack_count = 0;
+  sampler->stack_capa  = 0;
+}
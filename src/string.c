@@ -0,0 +1,187 @@
+/* Humming Script - Collection of libraries to build a scripting language
+ * Written in 2015 by Ramiro Rojo <ramiro.rojo.cretta@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright 
+ * and related and neighboring rights to this software to the public domain 
+ * worldwide. This software is distributed without any warranty.
+ * You should have received a copy of the CC0 Public Domain Dedication along 
+ * with this software. If not, see 
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <hs/object.h>
+#include <hs/string.h>
+#include <hs/thread.h>
+
+#define HS_INTERN_INIT_CAPA 256
+
+/*
+ * An open addressing set of the boxes of every interned string, with a
+ * power of two capacity, kept at most half full.
+ */
+static struct
+{
+  hs_mutex        lock;
+  struct hs_box **boxes;
+  size_t          size;
+  size_t          capa;
+} intern_table;
+
+int
+hs_string_init(hs_string *str, const char *data)
+{
+  return hs_string_init_size(str, data, strlen(data));
+}
+
+int
+hs_string_init_size(hs_string *str, const char *data, size_t size)
+{
+  char *chars = str->data.local;
+  if (size > HS_STRING_INLINE)
+  {
+    chars = malloc(size + 1);
+    if (!chars) return 1;
+    str->data.heap = chars;
+  }
+  memcpy(chars, data, size);
+  chars[size] = '\0';
+  str->size   = size;
+  return 0;
+}
+
+void
+hs_string_end(hs_string *str)
+{
+  if (str->size > HS_STRING_INLINE) free(str->data.heap);
+  str->size = 0;
+  str->data.local[0] = '\0';
+}
+
+/** @brief FNV-1a over the characters of a text */
+static size_t
+intern_hash(const char *data, size_t size)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return (size_t)hash;
+}
+
+/** @brief Finds the bucket of a text: its box, or the empty one to use */
+static struct hs_box **
+intern_find(struct hs_box **boxes, size_t capa, const char *data,
+            size_t size)
+{
+  size_t mask = capa - 1;
+  size_t at   = intern_hash(data, size) & mask;
+  while (boxes[at])
+  {
+    const hs_string *str = &boxes[at]->value.as_string;
+    if (str->size == size && memcmp(HS_STRING_DATA(str), data, size) == 0)
+    {
+      return &boxes[at];
+    }
+    at = (at + 1) & mask;
+  }
+  return &boxes[at];
+}
+
+/** @brief Doubles the capacity of the table */
+static int
+intern_grow(void)
+{
+  size_t          capa  = intern_table.capa * 2;
+  struct hs_box **boxes = calloc(capa, sizeof *boxes);
+  if (!boxes) return 1;
+  for (size_t i = 0; i < intern_table.capa; ++i)
+  {
+    const hs_string *str;
+    if (!intern_table.boxes[i]) continue;
+    str = &intern_table.boxes[i]->value.as_string;
+    *intern_find(boxes, capa, HS_STRING_DATA(str), str->size) =
+      intern_table.boxes[i];
+  }
+  free(intern_table.boxes);
+  intern_table.boxes = boxes;
+  intern_table.capa  = capa;
+  return 0;
+}
+
+int
+hs_intern_init(void)
+{
+  intern_table.boxes = calloc(HS_INTERN_INIT_CAPA, sizeof *intern_table.boxes);
+  if (!intern_table.boxes) return 1;
+  if (hs_mutex_init(&intern_table.lock))
+  {
+    free(intern_table.boxes);
+    intern_table.boxes = NULL;
+    return 1;
+  }
+  intern_table.size = 0;
+  intern_table.capa = HS_INTERN_INIT_CAPA;
+  return 0;
+}
+
+void
+hs_intern_end(void)
+{
+  if (!intern_table.boxes) return;
+  for (size_t i = 0; i < intern_table.capa; ++i)
+  {
+    if (!intern_table.boxes[i]) continue;
+    hs_string_end(&intern_table.boxes[i]->value.as_string);
+    free(intern_table.boxes[i]);
+  }
+  free(intern_table.boxes);
+  hs_mutex_end(&intern_table.lock);
+  intern_table.boxes = NULL;
+  intern_table.size  = 0;
+  intern_table.capa  = 0;
+}
+
+int
+hs_intern(hs_object *dst, const char *data, size_t size)
+{
+  struct hs_box **slot;
+  struct hs_box  *box;
+  /* The lock is only there after hs_intern_init() */
+  if (!intern_table.boxes) return 1;
+  if (hs_mutex_lock(&intern_table.lock)) return 1;
+  slot = intern_find(intern_table.boxes, intern_table.capa, data, size);
+  box  = *slot;
+  if (!box)
+  {
+    if ( (intern_table.size + 1) * 2 > intern_table.capa )
+    {
+      if (intern_grow()) goto fail;
+      slot = intern_find(intern_table.boxes, intern_table.capa, data, size);
+    }
+    box = calloc(1, sizeof *box);
+    if (!box) goto fail;
+    box->type = HS_OBJECT_STRING;
+    if (hs_string_init_size(&box->value.as_string, data, size))
+    {
+      free(box);
+      goto fail;
+    }
+    *slot = box;
+    ++intern_table.size;
+  }
+  hs_mutex_unlock(&intern_table.lock);
+  HS_SET_BOX(*dst, HS_OBJECT_STRING, box);
+  return 0;
+fail:
+  hs_mutex_unlock(&intern_table.lock);
+  return 1;
+}
+
+int
+hs_intern_cstr(hs_object *dst, const char *data)
+{
+  return hs_intern(dst, data, strlen(data));
+}
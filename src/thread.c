@@ -102,8 +102,8 @@ hs_thread_join( hs_thread *th, int *result  )
   };
   return 1;
 #else
-  void *result;
-  int p = pthread_join(th->handle, &result);
+  void *ret;
+  int p = pthread_join(th->handle, &ret);
   if (result) *result = th->r;
   return p;
 #endif  
@@ -140,7 +140,7 @@ hs_mutex_lock( hs_mutex *mx )
 #ifdef _WIN32
   switch (WaitForSingleObject(*mx, INFINITE))
   {
-    WAIT_OBJECT_0:
+    case WAIT_OBJECT_0:
       return 0;
     default:
       break;
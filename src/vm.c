@@ -8,11 +8,23 @@
  * with this software. If not, see 
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hs/object.h>
 #include <hs/opcode.h>
+#include <hs/vm.h>
 
-#define HS_MAX_REGISTERS  8
-#define HS_MAX_ARGS       3
 #define HS_HEAP_INIT_SIZE 4
+/* The number of frames allocated at once on the frame stack */
+#define HS_FRAME_CHUNK    64
+#define HS_MAX_CATCHES    8
+/* A generic opcode stops quickening after its guard failed this many times */
+#define HS_MAX_DEOPTS     4
 
 /*
 int logicalRightShift(int x, int n) {
@@ -32,14 +44,17 @@ int arithmeticRightShift(int x, int n) {
 #define HS_OPCODE_THREE_REG_PARAMS 3
 #define HS_OPCODE_UINT_PARAMS 4
 #define HS_OPCODE_UINT_AND_REG_PARAMS 5
+#define HS_OPCODE_INT24_PARAMS 6
 
 const char HS_OPCODE_PARAM_TYPE[] = {
   
+  HS_OPCODE_NO_PARAMS,           /* 000 - <<undefined>> */
+  
   HS_OPCODE_NO_PARAMS,           /* 001 - HS_OP_NOP */
   HS_OPCODE_NO_PARAMS,           /* 002 - HS_OP_BREAKPOINT */
   HS_OPCODE_NO_PARAMS,           /* 003 - HS_OP_HALT  */
  
-  HS_OPCODE_NO_PARAMS,           /* 004 - <<undefined>> */
+  HS_OPCODE_INT24_PARAMS,        /* 004 - HS_OP_EXTRA_ARG */
   HS_OPCODE_NO_PARAMS,           /* 005 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 006 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 007 - <<undefined>> */
@@ -60,8 +75,8 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   HS_OPCODE_UINT_AND_REG_PARAMS, /* 021 - HS_OP_LOAD_INT_CONST */
   
   
-  HS_OPCODE_NO_PARAMS,           /* 022 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 023 - <<undefined>> */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 022 - HS_OP_LOAD_CONST_WIDE */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 023 - HS_OP_LOAD_INT_WIDE */
   HS_OPCODE_NO_PARAMS,           /* 024 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 025 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 026 - <<undefined>> */
@@ -143,9 +158,9 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   HS_OPCODE_NO_PARAMS,           /* 091 - HS_OP_RETURN_NULL */
   HS_OPCODE_NO_PARAMS,           /* 092 - HS_OP_RETURN_SELF */
   
-  HS_OPCODE_NO_PARAMS,           /* 093 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 094 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 095 - <<undefined>> */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 093 - HS_OP_TAIL_CALL */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 094 - HS_OP_TAIL_LOCAL_CALL */
+  HS_OPCODE_TWO_REG_PARAMS,      /* 095 - HS_OP_TAIL_DYNAMIC_CALL */
   HS_OPCODE_NO_PARAMS,           /* 096 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 097 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 098 - <<undefined>> */
@@ -159,9 +174,9 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   HS_OPCODE_TWO_REG_PARAMS,      /* 105 - HS_OP_LOCAL_CALL */
   HS_OPCODE_THREE_REG_PARAMS,    /* 106 - HS_OP_DYNAMIC_CAL */
   
-  HS_OPCODE_NO_PARAMS,           /* 107 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 108 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 109 - <<undefined>> */    
+  HS_OPCODE_UINT_AND_REG_PARAMS, /* 107 - HS_OP_CALL_SITE */
+  HS_OPCODE_UINT_AND_REG_PARAMS, /* 108 - HS_OP_LOCAL_CALL_SITE */
+  HS_OPCODE_UINT_AND_REG_PARAMS, /* 109 - HS_OP_DYNAMIC_CALL_SITE */
   
   HS_OPCODE_ONE_REG_PARAMS,      /* 110 - HS_OP_SET_THIS */
   HS_OPCODE_ONE_REG_PARAMS,      /* 111 - HS_OP_SET_MODULE */
@@ -193,11 +208,11 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   HS_OPCODE_THREE_REG_PARAMS,    /* 133 - HS_OP_BOOL_CMP */
   HS_OPCODE_TWO_REG_PARAMS,      /* 134 - HS_OP_BOOL_NOT */
   
-  HS_OPCODE_NO_PARAMS,           /* 135 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 136 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 137 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 138 - <<undefined>> */
-  HS_OPCODE_NO_PARAMS,           /* 139 - <<undefined>> */   
+  HS_OPCODE_THREE_REG_PARAMS,    /* 135 - HS_OP_ADD */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 136 - HS_OP_SUB */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 137 - HS_OP_MUL */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 138 - HS_OP_DIV */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 139 - HS_OP_CMP */   
   
   HS_OPCODE_THREE_REG_PARAMS,    /* 140 - HS_OP_INT_ADD */
   HS_OPCODE_THREE_REG_PARAMS,    /* 141 - HS_OP_INT_SUB */
@@ -297,14 +312,21 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   HS_OPCODE_THREE_REG_PARAMS,    /* 223 - HS_OP_ARRAY_SET */
   HS_OPCODE_TWO_REG_PARAMS,      /* 224 - HS_OP_ARRAY_DELETE */  
   
-  HS_OPCODE_UINT_PARAMS,         /* 231 - HS_OP_NEW_TRY_CONTEXT */
-  HS_OPCODE_ONE_REG_PARAMS,      /* 232 - HS_OP_NEW_TRY_CONTEXT_INDIRECT */
-  HS_OPCODE_NO_PARAMS,           /* 233 - HS_OP_NEW_TRY_CONTEXT_NO_FINAL */
-  HS_OPCODE_UINT_AND_REG_PARAMS, /* 234 - HS_OP_ADD_CATCH */
-  HS_OPCODE_TWO_REG_PARAMS,      /* 235 - HS_OP_ADD_CATCH_INDIRECT */
-  HS_OPCODE_ONE_REG_PARAMS,      /* 236 - HS_OP_THROW */
-  HS_OPCODE_NO_PARAMS,           /* 237 - HS_OP_END_TRY_CONTEXT */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 225 - HS_OP_RANGE_NEW */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 226 - HS_OP_RANGE_NEW_EXCLUSIVE */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 227 - HS_OP_RANGE_STEP */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 228 - HS_OP_RANGE_INCLUDES */
+  HS_OPCODE_THREE_REG_PARAMS,    /* 229 - HS_OP_FOR_IN */
   
+  HS_OPCODE_UINT_PARAMS,         /* 230 - HS_OP_NEW_TRY_CONTEXT */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 231 - HS_OP_NEW_TRY_CONTEXT_INDIRECT */
+  HS_OPCODE_NO_PARAMS,           /* 232 - HS_OP_NEW_TRY_CONTEXT_NO_FINAL */
+  HS_OPCODE_UINT_AND_REG_PARAMS, /* 233 - HS_OP_ADD_CATCH */
+  HS_OPCODE_TWO_REG_PARAMS,      /* 234 - HS_OP_ADD_CATCH_INDIRECT */
+  HS_OPCODE_ONE_REG_PARAMS,      /* 235 - HS_OP_THROW */
+  HS_OPCODE_NO_PARAMS,           /* 236 - HS_OP_END_TRY_CONTEXT */
+  
+  HS_OPCODE_NO_PARAMS,           /* 237 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 238 - <<undefined>> */
   HS_OPCODE_NO_PARAMS,           /* 239 - <<undefined>> */
 
@@ -331,3 +353,3788 @@ const char HS_OPCODE_PARAM_TYPE[] = {
   
 };
 
+
+/**
+ * @brief A running call of a function.
+ *
+ * Frames are linked from the callee to the caller, the running frame is
+ * always state->frame.
+ */
+struct hs_frame
+{
+  /** The frame that called this one */
+  hs_frame       *parent;
+  /** The function running on this frame */
+  hs_function    *function;
+  /** Where the frame continues when a call returns */
+  const hs_instruction *pc;
+  /** The local variables of the call. The buffer stays with the frame
+   *  after the call returns, for the next call at the same depth */
+  hs_context     *context;
+  /** The number of slots the context buffer can hold */
+  size_t          context_capa;
+  /** The value of this */
+  hs_object       self;
+  /** The value of module */
+  hs_object       module;
+  /** The index of the first register inside state->registers */
+  size_t          base;
+  /** The number of registers of the window */
+  size_t          size;
+  /** The size of the register stack to restore when the call returns */
+  size_t          bottom;
+  /** The number of arguments passed, they are the first registers */
+  size_t          argc;
+  /** The number of try contexts open when the call started */
+  size_t          tries;
+  /** The size of the value stack when the call started */
+  size_t          stack_base;
+  /** The argument block open when the call started, see hs_state */
+  size_t          args_base;
+  /** The register of the parent receiving the returned value */
+  uint8_t         result;
+  /** Non zero if the frame returns what its running call returns, after a
+   *  tail call that could not reuse the frame */
+  uint8_t         tail;
+};
+
+/**
+ * @brief A block of frames of the frame stack.
+ *
+ * Chunks never move, so frames can point to each other. A chunk emptied by
+ * returns stays linked, and the next deep call reuses it.
+ */
+struct hs_frame_chunk
+{
+  hs_frame_chunk *prev;
+  hs_frame_chunk *next;
+  /** The number of frames in use */
+  size_t          used;
+  hs_frame        frames[HS_FRAME_CHUNK];
+};
+
+/**
+ * @brief A try context, opened by try() and closed with end().
+ */
+struct hs_try
+{
+  /** Where to go if no catch matches, NULL to throw again */
+  const hs_instruction *landing;
+  /** The size of the value stack when the context was opened */
+  size_t          stack_size;
+  /** The state of the register stack when the context was opened */
+  size_t          registers_size;
+  size_t          args_base;
+  /** The types each catch accepts, null accepts everything */
+  hs_object       types[HS_MAX_CATCHES];
+  /** Where each catch continues */
+  const hs_instruction *handlers[HS_MAX_CATCHES];
+  uint8_t         catches;
+};
+
+/**
+ * @brief makes room for more elements on a growing buffer.
+ *
+ * The buffer doubles its capacity, starting from HS_HEAP_INIT_SIZE.
+ *
+ * @param data The pointer to the buffer.
+ * @param capa The capacity of the buffer, in elements.
+ * @param need The number of elements the buffer must hold.
+ * @param elem The size of each element.
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+grow_buffer(void **data, size_t *capa, size_t need, size_t elem)
+{
+  size_t new_capa = *capa ? *capa : HS_HEAP_INIT_SIZE;
+  void  *ptr;
+  if (need <= *capa) return 0;
+  while (new_capa < need)
+  {
+    if (new_capa > SIZE_MAX / 2 / elem) return 1;
+    new_capa *= 2;
+  }
+  ptr = realloc(*data, new_capa * elem);
+  if (!ptr) return 1;
+  *data = ptr;
+  *capa = new_capa;
+  return 0;
+}
+
+/**
+ * @brief gives a frame its context, with all its slots set to null.
+ *
+ * The buffer left by the previous call on the same frame is reused, so
+ * the allocator is only used when a call needs more slots than before.
+ *
+ * @param frame The frame of the call.
+ * @param parent The enclosing context, can be NULL.
+ * @param size The number of slots.
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+context_take(hs_frame *frame, hs_context *parent, size_t size)
+{
+  hs_context *ctx = frame->context;
+  if (!ctx || frame->context_capa < size)
+  {
+    ctx = realloc(ctx, sizeof(hs_context) + size * sizeof(hs_object));
+    if (!ctx) return 1;
+    frame->context      = ctx;
+    frame->context_capa = size;
+  }
+  ctx->parent  = parent;
+  ctx->size    = size;
+  ctx->escaped = 0;
+  for (size_t i = 0; i < size; ++i) HS_SET_NULL(ctx->slots[i]);
+  return 0;
+}
+
+/**
+ * @brief finds the slot of a local variable.
+ *
+ * @param ctx The innermost context.
+ * @param index The index of the slot, counted from the innermost scope.
+ * @return A pointer to the slot, or NULL if the index is out of range.
+ */
+static hs_object *
+context_slot(hs_context *ctx, size_t index)
+{
+  while (ctx)
+  {
+    if (index < ctx->size) return ctx->slots + index;
+    index -= ctx->size;
+    ctx = ctx->parent;
+  }
+  return NULL;
+}
+
+/**
+ * @brief marks a context, and all its parents, as used by a closure.
+ *
+ * Escaped contexts are not reused when their call returns, the state keeps
+ * them instead, and releases them in hs_state_end().
+ *
+ * @param state The state running the call.
+ * @param ctx The context captured.
+ */
+static void
+context_escape(hs_state *state, hs_context *ctx)
+{
+  while (ctx && !ctx->escaped)
+  {
+    ctx->escaped   = 1;
+    ctx->next      = state->escaped;
+    state->escaped = ctx;
+    ctx = ctx->parent;
+  }
+}
+
+/**
+ * @brief pushes the frame for a call on the frame stack.
+ *
+ * @param state The state owning the frame stack.
+ * @param parent The calling frame, can be NULL.
+ * @param fn The function to call.
+ * @param context The context where the function was declared.
+ * @return The new frame, or NULL if there is no memory.
+ */
+static hs_frame *
+frame_push(hs_state *state, hs_frame *parent, hs_function *fn,
+           hs_context *context)
+{
+  hs_frame_chunk *chunk = state->frames;
+  hs_frame       *frame;
+  if (!chunk || chunk->used == HS_FRAME_CHUNK)
+  {
+    hs_frame_chunk *next = chunk ? chunk->next : NULL;
+    if (!next)
+    {
+      next = calloc(1, sizeof(hs_frame_chunk));
+      if (!next) return NULL;
+      next->prev = chunk;
+      if (chunk) chunk->next = next;
+    }
+    chunk = next;
+  }
+  frame = chunk->frames + chunk->used;
+  if (context_take(frame, context, fn->locals)) return NULL;
+  chunk->used  += 1;
+  state->frames = chunk;
+  frame->parent      = parent;
+  frame->function    = fn;
+  frame->pc          = fn->instructions;
+  HS_SET_NULL(frame->self);
+  HS_SET_NULL(frame->module);
+  frame->base        = 0;
+  frame->size        = 0;
+  frame->bottom      = 0;
+  frame->argc        = 0;
+  frame->tries       = 0;
+  frame->stack_base  = state->stack_size;
+  frame->args_base   = state->args_base;
+  frame->result      = 0;
+  frame->tail        = 0;
+  return frame;
+}
+
+/**
+ * @brief gives a frame its register window, on top of the register stack.
+ *
+ * The arguments are already in place, as the first argc registers from base.
+ * The rest of the window starts as null.
+ *
+ * @param state The state owning the register stack.
+ * @param frame The frame of the call.
+ * @param base The index of the first register of the window.
+ * @param argc The number of arguments.
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+window_open(hs_state *state, hs_frame *frame, size_t base, size_t argc)
+{
+  size_t size = frame->function->registers;
+  if (size < argc) size = argc;
+  if (grow_buffer((void **)&state->registers, &state->registers_capa,
+                  base + size, sizeof(hs_object)))
+    return 1;
+  for (size_t i = argc; i < size; ++i)
+  {
+    HS_SET_NULL(state->registers[base + i]);
+  }
+  state->registers_size = base + size;
+  frame->base = base;
+  frame->size = size;
+  frame->argc = argc;
+  return 0;
+}
+
+/**
+ * @brief pops the frame on top of the frame stack, after its call returns.
+ *
+ * @param state The state owning the frame stack.
+ */
+static void
+frame_pop(hs_state *state)
+{
+  hs_frame_chunk *chunk = state->frames;
+  hs_frame       *frame = chunk->frames + --chunk->used;
+  /* A closure owns the context now */
+  if (frame->context && frame->context->escaped)
+  {
+    frame->context      = NULL;
+    frame->context_capa = 0;
+  }
+  if (chunk->used == 0 && chunk->prev) state->frames = chunk->prev;
+}
+
+/**
+ * @brief checks if a catch accepts a thrown value.
+ *
+ * @param type The type given to catch(), null accepts everything.
+ * @param error The thrown value.
+ * @return A non zero value if the catch accepts the value.
+ */
+static int
+catch_matches(const hs_object *type, const hs_object *error)
+{
+  if (HS_TAG(*type) == HS_OBJECT_NULL) return 1;
+  return HS_TAG(*type) == HS_TAG(*error);
+}
+
+/**
+ * @brief finds the handler of a function catching a thrown value.
+ *
+ * @param fn The function where the value was thrown.
+ * @param at The index of the instruction that threw.
+ * @param error The thrown value, NULL to accept any handler.
+ * @return The handler, or NULL if none covers the instruction.
+ */
+static const hs_handler *
+handler_find(const hs_function *fn, size_t at, const hs_object *error)
+{
+  for (size_t i = 0; i < fn->handler_count; ++i)
+  {
+    const hs_handler *h = fn->handlers + i;
+    if (at >= h->start && at < h->end &&
+        (!error || catch_matches(&h->type, error)))
+      return h;
+  }
+  return NULL;
+}
+
+/**
+ * @brief computes an integer power, by squaring.
+ *
+ * Negative exponents only give a non zero result for 1 and -1.
+ *
+ * @param base The base.
+ * @param exp The exponent.
+ * @param r A place to store base ** exp.
+ * @return A non zero value if the result does not fit in an hs_int.
+ */
+static int
+int_pow(hs_int base, hs_int exp, hs_int *r)
+{
+  int64_t result = 1;
+  int64_t b = base;
+  if (exp < 0)
+  {
+    if (base == 1) *r = 1;
+    else if (base == -1) *r = (exp & 1) ? -1 : 1;
+    else *r = 0;
+    return 0;
+  }
+  while (exp)
+  {
+    if (exp & 1) result *= b;
+    if (result < INT32_MIN || result > INT32_MAX) return 1;
+    exp >>= 1;
+    /* Once the square leaves hs_int, any bit left makes the result leave */
+    if (exp) b *= b;
+    if (b < INT32_MIN || b > INT32_MAX) return 1;
+  }
+  *r = (hs_int)result;
+  return 0;
+}
+
+#if !defined(__GNUC__)
+/**
+ * @brief narrows the result of an operation on two hs_int.
+ *
+ * @param wide The result.
+ * @param r A place to store it as an hs_int.
+ * @return A non zero value if it does not fit in an hs_int.
+ */
+static int
+int_narrow(int64_t wide, hs_int *r)
+{
+  *r = (hs_int)(uint32_t)wide;
+  return wide < INT32_MIN || wide > INT32_MAX;
+}
+#endif
+
+static int
+run_loop(hs_state *state, hs_function *fn, hs_object *result,
+         const void *const **handlers);
+
+/**
+ * @brief gets the address of the handler of each opcode.
+ *
+ * With HS_VM_DISPATCH_SWITCH there are no addresses, and the loop switches
+ * on the opcode instead.
+ *
+ * @return A table indexed by opcode, or NULL.
+ */
+static const void *const *
+dispatch_handlers(void)
+{
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+  static const void *const *handlers = NULL;
+  if (!handlers) run_loop(NULL, NULL, NULL, &handlers);
+  return handlers;
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * @brief replaces common opcode sequences with superinstructions.
+ *
+ * Only the first instruction of a sequence is rewritten, the superinstruction
+ * skips the rest when it runs. The others stay in place, so a jump into the
+ * middle of a sequence still runs the original opcodes.
+ *
+ * @param fn The function, already decoded.
+ * @param fusions A mask of hs_vm_fusion values.
+ * @param handlers The handler table, or NULL.
+ */
+static void
+fuse_function(hs_function *fn, unsigned fusions, const void *const *handlers)
+{
+  hs_instruction *ins = fn->instructions;
+  for (size_t i = 0; i + 1 < fn->size; ++i)
+  {
+    hs_instruction *next = ins + i + 1;
+    uint16_t        opcode = 0;
+    uint8_t         dst;
+    switch (ins[i].opcode)
+    {
+      case HS_OP_LOAD_LOCAL:
+        if ( (fusions & HS_VM_FUSE_LOCAL_INC) && i + 2 < fn->size &&
+             (next->opcode == HS_OP_INT_INC || next->opcode == HS_OP_INT_DEC) &&
+             next->a == ins[i].a &&
+             next[1].opcode == HS_OP_STORE_LOCAL && next[1].a == ins[i].a &&
+             next[1].imm == ins[i].imm )
+        {
+          opcode = next->opcode == HS_OP_INT_INC ? HS_OP_LOCAL_INT_INC :
+                                                   HS_OP_LOCAL_INT_DEC;
+        }
+        else if ( (fusions & HS_VM_FUSE_LOCAL_CALL) &&
+                  next->opcode == HS_OP_LOCAL_CALL && next->b == ins[i].a )
+        {
+          /* a receives the result, b keeps the loaded function */
+          opcode      = HS_OP_LOCAL_LOAD_CALL;
+          ins[i].b    = ins[i].a;
+          ins[i].a    = next->a;
+        }
+        break;
+      case HS_OP_LOAD_FIELD:
+        if ( (fusions & HS_VM_FUSE_FIELD_CALL) &&
+             next->opcode == HS_OP_CALL && next->b == ins[i].a )
+        {
+          opcode      = HS_OP_FIELD_CALL;
+          ins[i].b    = ins[i].a;
+          ins[i].a    = next->a;
+        }
+        break;
+      case HS_OP_INT_CMP:
+        if ( !(fusions & HS_VM_FUSE_CMP_JUMP) ||
+             next->opcode < HS_OP_JUMP_EQ_ZERO ||
+             next->opcode > HS_OP_JUMP_GE_ZERO || next->a != ins[i].a )
+          break;
+        /* a and b are compared, c keeps the result of the comparison */
+        opcode     = HS_OP_INT_JUMP_EQ + (next->opcode - HS_OP_JUMP_EQ_ZERO);
+        dst        = ins[i].a;
+        ins[i].a   = ins[i].b;
+        ins[i].b   = ins[i].c;
+        ins[i].c   = dst;
+        ins[i].imm = next->imm;
+        break;
+      default:
+        break;
+    }
+    if (!opcode) continue;
+    ins[i].opcode  = opcode;
+    ins[i].handler = handlers ? handlers[opcode] : NULL;
+  }
+}
+
+/**
+ * @brief checks if an opcode looks up a property, and needs an inline cache.
+ */
+static int
+is_field_opcode(uint8_t opcode)
+{
+  return opcode == HS_OP_LOAD_FIELD || opcode == HS_OP_LOAD_FIELD_INDIRECT ||
+         opcode == HS_OP_STORE_FIELD || opcode == HS_OP_STORE_FIELD_INDIRECT;
+}
+
+/**
+ * @brief finds the slot of a property, going through the inline cache.
+ *
+ * @param state The running state, with the megamorphic table.
+ * @param cache The cache of the running instruction.
+ * @param shape The shape of the object.
+ * @param key The name of the property.
+ * @param slot A place to store the slot.
+ * @return zero if the property was found, a non zero value otherwise.
+ */
+static int
+cached_slot(hs_state *state, hs_inline_cache *cache, const hs_shape *shape,
+            hs_object key, size_t *slot)
+{
+  hs_cache_entry *entry;
+  for (size_t i = 0; i < cache->count; ++i)
+  {
+    entry = cache->entries + i;
+    if (entry->shape == shape && hs_key_equals(entry->key, key))
+    {
+      state->cache_stats.hits += 1;
+      *slot = entry->slot;
+      return *slot == HS_VM_CACHE_ABSENT;
+    }
+  }
+  if (cache->count < HS_VM_CACHE_WAYS)
+  {
+    state->cache_stats.misses += 1;
+    entry = cache->entries + cache->count++;
+  }
+  else
+  {
+    /* Too many shapes for the instruction, use the table of the state */
+    size_t hash = ( (size_t)shape >> 4 ) ^ hs_key_hash(key);
+    entry = state->megamorphic + ( hash & (HS_VM_MEGAMORPHIC_SIZE - 1) );
+    if (entry->shape == shape && hs_key_equals(entry->key, key))
+    {
+      state->cache_stats.megamorphic_hits += 1;
+      *slot = entry->slot;
+      return *slot == HS_VM_CACHE_ABSENT;
+    }
+    state->cache_stats.megamorphic_misses += 1;
+  }
+  if (hs_shape_find(shape, key, slot)) *slot = HS_VM_CACHE_ABSENT;
+  entry->shape = shape;
+  entry->key   = key;
+  entry->slot  = *slot;
+  return *slot == HS_VM_CACHE_ABSENT;
+}
+
+/**
+ * @brief reads a property of an object, or of the first prototype with it.
+ *
+ * @param state The running state, with the megamorphic table.
+ * @param cache The cache of the running instruction.
+ * @param obj The object.
+ * @param key The name of the property.
+ * @param dst A place to store the value, null if nothing has the property.
+ */
+static void
+cached_get(hs_state *state, hs_inline_cache *cache, const hs_instance *obj,
+           hs_object key, hs_object *dst)
+{
+  size_t slot;
+  for (; obj; obj = obj->proto)
+  {
+    if (!cached_slot(state, cache, obj->shape, key, &slot))
+    {
+      *dst = obj->slots[slot];
+      return;
+    }
+  }
+  HS_SET_NULL(*dst);
+}
+
+/**
+ * @brief checks if an opcode calls through a call site.
+ */
+static int
+is_site_opcode(uint8_t opcode)
+{
+  return opcode == HS_OP_CALL_SITE || opcode == HS_OP_LOCAL_CALL_SITE ||
+         opcode == HS_OP_DYNAMIC_CALL_SITE;
+}
+
+/**
+ * @brief widens a register window to hold the registers of a call site.
+ *
+ * @param module The module of the call site, can be NULL.
+ * @param index The index of the call site.
+ * @param window The size of the window so far.
+ * @return The size of the window.
+ */
+static uint16_t
+site_window(const hs_module *module, size_t index, uint16_t window)
+{
+  const hs_call_site *site;
+  if (!module || index >= module->call_site_count) return window;
+  site = module->call_sites + index;
+  if (site->callee >= window) window = site->callee + 1;
+  if (site->self >= window) window = site->self + 1;
+  if (site->args + site->argc > window) window = site->args + site->argc;
+  return window;
+}
+
+/**
+ * @brief finds the parameter receiving each argument of a call site.
+ *
+ * @param site The call site, with the names of its arguments.
+ * @param fn The function called.
+ * @return zero on success, a non zero value if a name is not a parameter.
+ */
+static int
+site_resolve(hs_call_site *site, const hs_function *fn)
+{
+  uint16_t width    = site->argc;
+  uint8_t  in_place = 1;
+  for (size_t i = 0; i < site->argc; ++i)
+  {
+    size_t slot = i;
+    if (HS_TAG(site->names[i]) != HS_OBJECT_NULL)
+    {
+      for (slot = 0; slot < fn->param_count; ++slot)
+      {
+        if (hs_key_equals(fn->params[slot], site->names[i])) break;
+      }
+      if (slot == fn->param_count) return 1;
+    }
+    site->slots[i] = (uint8_t)slot;
+    if (slot != i) in_place = 0;
+    if (slot >= width) width = (uint16_t)( slot + 1 );
+  }
+  site->resolved = fn;
+  site->width    = width;
+  site->in_place = in_place;
+  return 0;
+}
+
+/* The type of a register the verifier knows nothing about */
+#define HS_VERIFY_ANY 255
+
+/* What the verifier must prove before an opcode can drop its checks */
+enum verify_need
+{
+  NEED_BC_INT,      /* b and c hold integers */
+  NEED_BC_FLOAT,    /* b and c hold floats */
+  NEED_A_INT,       /* a holds an integer */
+  NEED_A_INTEGRAL,  /* a holds an integer or a boolean */
+  NEED_AB_INT,      /* a and b hold integers */
+  NEED_STACK        /* the stack holds a value */
+};
+
+/* The opcodes with a form without checks */
+static const struct
+{
+  uint16_t checked, unchecked;
+  uint8_t  need;
+} unchecked_forms[] = {
+  { HS_OP_INT_ADD,      HS_OP_INT_ADD_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_SUB,      HS_OP_INT_SUB_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_MUL,      HS_OP_INT_MUL_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_AND,      HS_OP_INT_AND_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_OR,       HS_OP_INT_OR_UNCHECKED,       NEED_BC_INT },
+  { HS_OP_INT_XOR,      HS_OP_INT_XOR_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_CMP,      HS_OP_INT_CMP_UNCHECKED,      NEED_BC_INT },
+  { HS_OP_INT_INC,      HS_OP_INT_INC_UNCHECKED,      NEED_A_INT },
+  { HS_OP_INT_DEC,      HS_OP_INT_DEC_UNCHECKED,      NEED_A_INT },
+  { HS_OP_FLOAT_ADD,    HS_OP_FLOAT_ADD_UNCHECKED,    NEED_BC_FLOAT },
+  { HS_OP_FLOAT_SUB,    HS_OP_FLOAT_SUB_UNCHECKED,    NEED_BC_FLOAT },
+  { HS_OP_FLOAT_MUL,    HS_OP_FLOAT_MUL_UNCHECKED,    NEED_BC_FLOAT },
+  { HS_OP_FLOAT_DIV,    HS_OP_FLOAT_DIV_UNCHECKED,    NEED_BC_FLOAT },
+  { HS_OP_JUMP_EQ_ZERO, HS_OP_JUMP_EQ_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_JUMP_NE_ZERO, HS_OP_JUMP_NE_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_JUMP_LT_ZERO, HS_OP_JUMP_LT_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_JUMP_LE_ZERO, HS_OP_JUMP_LE_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_JUMP_GT_ZERO, HS_OP_JUMP_GT_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_JUMP_GE_ZERO, HS_OP_JUMP_GE_ZERO_UNCHECKED, NEED_A_INTEGRAL },
+  { HS_OP_INT_JUMP_EQ,  HS_OP_INT_JUMP_EQ_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_INT_JUMP_NE,  HS_OP_INT_JUMP_NE_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_INT_JUMP_LT,  HS_OP_INT_JUMP_LT_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_INT_JUMP_LE,  HS_OP_INT_JUMP_LE_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_INT_JUMP_GT,  HS_OP_INT_JUMP_GT_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_INT_JUMP_GE,  HS_OP_INT_JUMP_GE_UNCHECKED,  NEED_AB_INT },
+  { HS_OP_STACK_POP,    HS_OP_STACK_POP_UNCHECKED,    NEED_STACK },
+  { HS_OP_STACK_PEEK,   HS_OP_STACK_PEEK_UNCHECKED,   NEED_STACK },
+};
+
+#define HS_UNCHECKED_FORMS ( sizeof unchecked_forms / sizeof *unchecked_forms )
+
+/**
+ * @brief gets the opcode an unchecked form was made from, any other opcode
+ *        is given back as it is.
+ */
+static uint16_t
+checked_form(uint16_t opcode)
+{
+  if (opcode < HS_OP_INT_ADD_UNCHECKED) return opcode;
+  for (size_t i = 0; i < HS_UNCHECKED_FORMS; ++i)
+  {
+    if (unchecked_forms[i].unchecked == opcode)
+      return unchecked_forms[i].checked;
+  }
+  return opcode;
+}
+
+/**
+ * @brief gets the unchecked form of an opcode, or the opcode itself.
+ */
+static uint16_t
+unchecked_form(uint16_t opcode)
+{
+  for (size_t i = 0; i < HS_UNCHECKED_FORMS; ++i)
+  {
+    if (unchecked_forms[i].checked == opcode)
+      return unchecked_forms[i].unchecked;
+  }
+  return opcode;
+}
+
+/**
+ * @brief What the verifier knows when an instruction starts: the type of
+ *        each register, and how many values the stack holds at least.
+ */
+typedef struct verify_state
+{
+  uint8_t *types;
+  uint8_t *depth;
+  uint8_t *seen;
+  size_t   window;
+} verify_state;
+
+/**
+ * @brief merges what is known on one path into an instruction.
+ *
+ * @return Non zero if the instruction learned something new, and must be
+ *         visited again.
+ */
+static int
+verify_merge(verify_state *vs, size_t at, const uint8_t *types, unsigned depth)
+{
+  uint8_t *into    = vs->types + at * vs->window;
+  int      changed = 0;
+  if (depth > 255) depth = 255;
+  if (!vs->seen[at])
+  {
+    memcpy(into, types, vs->window);
+    vs->depth[at] = (uint8_t)depth;
+    vs->seen[at]  = 1;
+    return 1;
+  }
+  for (size_t r = 0; r < vs->window; ++r)
+  {
+    if (into[r] != types[r] && into[r] != HS_VERIFY_ANY)
+    {
+      into[r] = HS_VERIFY_ANY;
+      changed = 1;
+    }
+  }
+  if (depth < vs->depth[at])
+  {
+    vs->depth[at] = (uint8_t)depth;
+    changed = 1;
+  }
+  return changed;
+}
+
+/**
+ * @brief checks that an immediate jump target starts an instruction.
+ */
+static int
+verify_target(const hs_function *fn, size_t target)
+{
+  uint8_t before;
+  if (target >= fn->size) return 1;
+  if (target == 0) return 0;
+  /* The word after a wide load is its operand */
+  before = (uint8_t)( fn->code[target - 1] >> 24 );
+  return before == HS_OP_LOAD_CONST_WIDE || before == HS_OP_LOAD_INT_WIDE;
+}
+
+/**
+ * @brief queues an instruction to visit, once until it is visited.
+ */
+static void
+verify_push(uint32_t *work, size_t *count, uint8_t *queued, size_t at)
+{
+  if (queued[at]) return;
+  queued[at]       = 1;
+  work[(*count)++] = (uint32_t)at;
+}
+
+/**
+ * @brief follows every path of a function, finding the types of the
+ *        registers before each instruction.
+ *
+ * The code is read from fn->code, so superinstructions and unchecked forms
+ * don't matter. A function with jumps to computed targets can't be
+ * followed, and gets no proofs.
+ *
+ * @param fn The function to verify.
+ * @param vs Where the types are stored, with window set.
+ * @return zero when every path was followed, a non zero value otherwise.
+ */
+static int
+verify_flow(const hs_function *fn, verify_state *vs)
+{
+  uint8_t  *types = malloc(vs->window);
+  uint8_t  *any   = malloc(vs->window);
+  uint8_t  *queued = calloc(fn->size, 1);
+  uint32_t *work  = malloc(fn->size * sizeof(uint32_t));
+  size_t    count = 0;
+  int       failed = 0;
+  if (!types || !any || !queued || !work)
+  {
+    free(types);
+    free(any);
+    free(queued);
+    free(work);
+    return 1;
+  }
+  memset(any, HS_VERIFY_ANY, vs->window);
+  /* Handlers start with nothing known, a throw may come with less stack */
+  for (size_t h = 0; h < fn->handler_count; ++h)
+  {
+    if (verify_merge(vs, fn->handlers[h].target, any, 0))
+      verify_push(work, &count, queued, fn->handlers[h].target);
+  }
+  /* The arguments have any type */
+  if (verify_merge(vs, 0, any, 0)) verify_push(work, &count, queued, 0);
+  while (count && !failed)
+  {
+    size_t   at = work[--count];
+    size_t   next[2];
+    size_t   nexts = 1;
+    unsigned depth = vs->depth[at];
+    union hs_opcode_params params = { { 0, 0, 0 } };
+    uint8_t  op, a, b, c;
+    queued[at] = 0;
+    memcpy(types, vs->types + at * vs->window, vs->window);
+    HS_OP_DECODE(fn->code[at], op, params);
+    a = params.u8[0];
+    b = params.u8[1];
+    c = params.u8[2];
+    if (HS_OPCODE_PARAM_TYPE[op] == HS_OPCODE_UINT_AND_REG_PARAMS)
+      a = params.set.u8;
+    next[0] = at + 1;
+    switch (op)
+    {
+      case HS_OP_LOAD_NULL:
+        types[a] = HS_OBJECT_NULL;
+        break;
+      case HS_OP_LOAD_FALSE:
+      case HS_OP_LOAD_TRUE:
+      case HS_OP_INT2BOOL:
+      case HS_OP_BOOL_AND:
+      case HS_OP_BOOL_OR:
+      case HS_OP_BOOL_XOR:
+      case HS_OP_BOOL_NOT:
+        types[a] = HS_OBJECT_BOOLEAN;
+        break;
+      case HS_OP_LOAD_INT_CONST:
+        types[a] = HS_OBJECT_FIXINT;
+        break;
+      case HS_OP_LOAD_INT_WIDE:
+        types[a] = HS_OBJECT_FIXINT;
+        next[0] = at + 2;
+        break;
+      case HS_OP_LOAD_CONST_WIDE:
+        types[a] = HS_VERIFY_ANY;
+        next[0] = at + 2;
+        break;
+      case HS_OP_MOVE:
+        types[a] = types[b];
+        break;
+      /* These throw on anything but integers, so after them b and c are.
+       * BIGINTs pass too, but the first one drops the proofs (see
+       * integer_op()), so they are taken as FIXINTs */
+      case HS_OP_INT_ADD: case HS_OP_INT_SUB: case HS_OP_INT_MUL:
+      case HS_OP_INT_DIV: case HS_OP_INT_MOD: case HS_OP_INT_REM:
+      case HS_OP_INT_SHL: case HS_OP_INT_SHR: case HS_OP_INT_LSL:
+      case HS_OP_INT_LSR: case HS_OP_INT_AND: case HS_OP_INT_OR:
+      case HS_OP_INT_XOR: case HS_OP_INT_CMP: case HS_OP_INT_POW:
+        types[c] = HS_OBJECT_FIXINT;
+        /* fall through */
+      case HS_OP_INT_NEG: case HS_OP_INT_CPL:
+        types[b] = HS_OBJECT_FIXINT;
+        types[a] = HS_OBJECT_FIXINT;
+        break;
+      /* This reads BIGINTs without dropping the proofs, so b may still
+       * hold one after it */
+      case HS_OP_INT2FLOAT:
+        types[a] = HS_OBJECT_FLOAT;
+        break;
+      case HS_OP_INT_INC:
+      case HS_OP_INT_DEC:
+      case HS_OP_FLOAT2INT:
+      case HS_OP_BOOL2INT:
+      case HS_OP_BOOL_CMP:
+        types[a] = HS_OBJECT_FIXINT;
+        break;
+      case HS_OP_FLOAT_ADD: case HS_OP_FLOAT_SUB: case HS_OP_FLOAT_MUL:
+      case HS_OP_FLOAT_DIV: case HS_OP_FLOAT_POW: case HS_OP_FLOAT_ATAN2:
+      case HS_OP_FLOAT_CMP:
+        types[c] = HS_OBJECT_FLOAT;
+        types[b] = HS_OBJECT_FLOAT;
+        types[a] = op == HS_OP_FLOAT_CMP ? HS_OBJECT_FIXINT : HS_OBJECT_FLOAT;
+        break;
+      case HS_OP_FLOAT_SQRT: case HS_OP_FLOAT_EXP: case HS_OP_FLOAT_LOG2:
+      case HS_OP_FLOAT_LOG: case HS_OP_FLOAT_LN: case HS_OP_FLOAT_SIN:
+      case HS_OP_FLOAT_COS: case HS_OP_FLOAT_TAN: case HS_OP_FLOAT_ASIN:
+      case HS_OP_FLOAT_ACOS: case HS_OP_FLOAT_ATAN: case HS_OP_FLOAT_NEG:
+        types[b] = HS_OBJECT_FLOAT;
+        types[a] = HS_OBJECT_FLOAT;
+        break;
+      case HS_OP_FLOAT_INC:
+      case HS_OP_FLOAT_DEC:
+        types[a] = HS_OBJECT_FLOAT;
+        break;
+      case HS_OP_STACK_POP:
+        types[a] = HS_VERIFY_ANY;
+        if (depth) --depth;
+        break;
+      case HS_OP_STACK_PEEK:
+        types[a] = HS_VERIFY_ANY;
+        break;
+      case HS_OP_STACK_PUSH:
+      case HS_OP_STACK_DUP:
+        ++depth;
+        break;
+      case HS_OP_ARRAY_NEW:
+      case HS_OP_ARRAY_NEW_INDIRECT:
+        types[a] = HS_OBJECT_ARRAY;
+        break;
+      case HS_OP_ARRAY_GET:
+        types[a] = HS_VERIFY_ANY;
+        break;
+      case HS_OP_RANGE_NEW:
+      case HS_OP_RANGE_NEW_EXCLUSIVE:
+        types[b] = HS_OBJECT_FIXINT;
+        types[c] = HS_OBJECT_FIXINT;
+        types[a] = HS_OBJECT_RANGE;
+        break;
+      case HS_OP_RANGE_STEP:
+        types[c] = HS_OBJECT_FIXINT;
+        types[a] = HS_OBJECT_RANGE;
+        break;
+      case HS_OP_RANGE_INCLUDES:
+        types[a] = HS_OBJECT_BOOLEAN;
+        break;
+      case HS_OP_FOR_IN:
+        /* Goes on to the jump out, or past it */
+        types[c] = HS_OBJECT_FIXINT;
+        types[a] = HS_VERIFY_ANY;
+        next[nexts++] = at + 2;
+        break;
+      case HS_OP_ARRAY_SET:
+      case HS_OP_ARRAY_DELETE:
+        /* The array changes, the registers don't */
+        break;
+      case HS_OP_JUMP:
+        if (verify_target(fn, params.set.u16)) failed = 1;
+        next[0] = params.set.u16;
+        break;
+      case HS_OP_JUMP_EQ_ZERO: case HS_OP_JUMP_NE_ZERO:
+      case HS_OP_JUMP_LT_ZERO: case HS_OP_JUMP_LE_ZERO:
+      case HS_OP_JUMP_GT_ZERO: case HS_OP_JUMP_GE_ZERO:
+        if (verify_target(fn, params.set.u16)) failed = 1;
+        next[nexts++] = params.set.u16;
+        break;
+      case HS_OP_NEW_TRY_CONTEXT:
+      case HS_OP_ADD_CATCH:
+        /* The landing starts like a handler, on the stack it was thrown */
+        if (verify_target(fn, params.set.u16)) failed = 1;
+        else if (verify_merge(vs, params.set.u16, any, 0))
+          verify_push(work, &count, queued, params.set.u16);
+        if (op == HS_OP_ADD_CATCH) types[a] = HS_VERIFY_ANY;
+        break;
+      case HS_OP_CALL:
+      case HS_OP_LOCAL_CALL:
+      case HS_OP_DYNAMIC_CALL:
+      case HS_OP_CALL_SITE:
+      case HS_OP_LOCAL_CALL_SITE:
+      case HS_OP_DYNAMIC_CALL_SITE:
+      {
+        /* The callee may pop what this function pushed, and a call site
+         * gives its registers from args upwards to the callee */
+        size_t from = vs->window;
+        if (is_site_opcode(op))
+        {
+          from = 0;
+          if (fn->module && params.set.u16 < fn->module->call_site_count)
+            from = fn->module->call_sites[params.set.u16].args;
+        }
+        for (size_t r = from; r < vs->window; ++r)
+        {
+          types[r] = HS_VERIFY_ANY;
+        }
+        types[a] = HS_VERIFY_ANY;
+        depth    = 0;
+        break;
+      }
+      case HS_OP_RETURN:
+      case HS_OP_RETURN_NULL:
+      case HS_OP_RETURN_SELF:
+      case HS_OP_TAIL_CALL:
+      case HS_OP_TAIL_LOCAL_CALL:
+      case HS_OP_TAIL_DYNAMIC_CALL:
+      case HS_OP_THROW:
+      case HS_OP_HALT:
+      case HS_OP_END_BYTECODE:
+        nexts = 0;
+        break;
+      case HS_OP_JUMP_INDIRECT:
+      case HS_OP_JUMP_EQ_REG: case HS_OP_JUMP_NE_REG:
+      case HS_OP_JUMP_LT_REG: case HS_OP_JUMP_LE_REG:
+      case HS_OP_JUMP_GT_REG: case HS_OP_JUMP_GE_REG:
+      case HS_OP_JUMP_EQ_ZERO_INDIRECT: case HS_OP_JUMP_NE_ZERO_INDIRECT:
+      case HS_OP_JUMP_LT_ZERO_INDIRECT: case HS_OP_JUMP_LE_ZERO_INDIRECT:
+      case HS_OP_JUMP_GT_ZERO_INDIRECT: case HS_OP_JUMP_GE_ZERO_INDIRECT:
+      case HS_OP_NEW_TRY_CONTEXT_INDIRECT:
+      case HS_OP_ADD_CATCH_INDIRECT:
+        /* The targets are computed, the paths can't be followed */
+        failed = 2;
+        break;
+      default:
+        /* Anything else may write any register it names */
+        switch (HS_OPCODE_PARAM_TYPE[op])
+        {
+          case HS_OPCODE_THREE_REG_PARAMS:
+            types[c] = HS_VERIFY_ANY;
+            /* fall through */
+          case HS_OPCODE_TWO_REG_PARAMS:
+            types[b] = HS_VERIFY_ANY;
+            /* fall through */
+          case HS_OPCODE_ONE_REG_PARAMS:
+          case HS_OPCODE_UINT_AND_REG_PARAMS:
+            types[a] = HS_VERIFY_ANY;
+            break;
+          default:
+            break;
+        }
+        break;
+    }
+    for (size_t n = 0; n < nexts && !failed; ++n)
+    {
+      if (next[n] < fn->size && verify_merge(vs, next[n], types, depth))
+        verify_push(work, &count, queued, next[n]);
+    }
+  }
+  /* A bad target is found even after a computed jump stops the flow */
+  for (size_t i = 0; failed == 2 && i < fn->size; ++i)
+  {
+    uint8_t op = (uint8_t)( fn->code[i] >> 24 );
+    if ( ( op == HS_OP_JUMP || op == HS_OP_NEW_TRY_CONTEXT ||
+           op == HS_OP_ADD_CATCH ||
+           ( op >= HS_OP_JUMP_EQ_ZERO && op <= HS_OP_JUMP_GE_ZERO ) ) &&
+         verify_target(fn, fn->code[i] & 0xFFFF) )
+      failed = 1;
+  }
+  free(types);
+  free(any);
+  free(queued);
+  free(work);
+  return failed;
+}
+
+/**
+ * @brief checks if the verifier proved what an unchecked form needs.
+ */
+static int
+verify_proves(const verify_state *vs, size_t at, const hs_instruction *ins,
+              uint8_t need)
+{
+  const uint8_t *types = vs->types + at * vs->window;
+  if (!vs->seen[at]) return 0;
+  switch (need)
+  {
+    case NEED_BC_INT:
+      return types[ins->b] == HS_OBJECT_FIXINT &&
+             types[ins->c] == HS_OBJECT_FIXINT;
+    case NEED_BC_FLOAT:
+      return types[ins->b] == HS_OBJECT_FLOAT &&
+             types[ins->c] == HS_OBJECT_FLOAT;
+    case NEED_A_INT:
+      return types[ins->a] == HS_OBJECT_FIXINT;
+    case NEED_A_INTEGRAL:
+      return types[ins->a] == HS_OBJECT_FIXINT ||
+             types[ins->a] == HS_OBJECT_BOOLEAN;
+    case NEED_AB_INT:
+      return types[ins->a] == HS_OBJECT_FIXINT &&
+             types[ins->b] == HS_OBJECT_FIXINT;
+    case NEED_STACK:
+      return vs->depth[at] > 0;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @brief drops what the verifier proved, moving every instruction back to
+ *        its checked form.
+ */
+static void
+unverify_function(hs_function *fn, const void *const *handlers)
+{
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    uint16_t op = checked_form(fn->instructions[i].opcode);
+    fn->instructions[i].opcode  = op;
+    fn->instructions[i].handler = handlers ? handlers[op] : NULL;
+  }
+  fn->verified = 0;
+}
+
+/**
+ * @brief verifies a function, and moves the instructions it proved safe to
+ *        their unchecked forms.
+ *
+ * Also runs again when the function gets an exception table, since the
+ * handlers are new ways into the code.
+ *
+ * @param fn The function, already decoded.
+ * @param handlers The addresses of the handlers, NULL on the switch loop.
+ * @return A non zero value if a jump target is not an instruction, or
+ *         there is no memory.
+ */
+static int
+verify_function(hs_function *fn, const void *const *handlers)
+{
+  verify_state vs;
+  int          failed;
+  /* Start over from the checked forms */
+  unverify_function(fn, handlers);
+  vs.window = fn->registers;
+  vs.types  = malloc(fn->size * vs.window);
+  vs.depth  = malloc(fn->size);
+  vs.seen   = calloc(fn->size, 1);
+  failed    = !vs.types || !vs.depth || !vs.seen ? 1 :
+              verify_flow(fn, &vs);
+  if (!failed)
+  {
+    for (size_t i = 0; i < fn->size; ++i)
+    {
+      hs_instruction *ins = fn->instructions + i;
+      for (size_t f = 0; f < HS_UNCHECKED_FORMS; ++f)
+      {
+        if (unchecked_forms[f].checked != ins->opcode) continue;
+        if (verify_proves(&vs, i, ins, unchecked_forms[f].need))
+        {
+          ins->opcode  = unchecked_forms[f].unchecked;
+          ins->handler = handlers ? handlers[ins->opcode] : NULL;
+        }
+        break;
+      }
+    }
+    fn->verified = 1;
+  }
+  free(vs.types);
+  free(vs.depth);
+  free(vs.seen);
+  /* Computed jumps only cost the proofs */
+  return failed == 2 ? 0 : failed;
+}
+
+/**
+ * @brief runs an integer operation the loop can't do on hs_int, because
+ *        the result leaves it or an operand is a BIGINT.
+ *
+ * The verifier proved the types of the function as if integers were always
+ * FIXINTs, and the machine code was compiled from those proofs, so the
+ * first BIGINT sends the function back to its checked forms.
+ *
+ * @param state The state owning the box of a BIGINT result.
+ * @param fn The running function.
+ * @param dst A place to store the result.
+ * @param a The left operand.
+ * @param b The right operand.
+ * @param op The operation.
+ * @return 0 on success, the error to raise on failure.
+ */
+static int
+integer_op(hs_state *state, hs_function *fn, hs_object *dst, hs_object a,
+           hs_object b, hs_integer_op op)
+{
+  if ( ( HS_TAG(a) != HS_OBJECT_FIXINT && HS_TAG(a) != HS_OBJECT_BIGINT ) ||
+       ( HS_TAG(b) != HS_OBJECT_FIXINT && HS_TAG(b) != HS_OBJECT_BIGINT ) )
+    return HS_VM_ERROR_TYPE;
+  if (fn->verified)
+  {
+    hs_function_jit_end(fn);
+    unverify_function(fn, dispatch_handlers());
+  }
+  if (hs_integer_compute(&state->area, dst, a, b, op))
+    return HS_VM_ERROR_MEMORY;
+  return 0;
+}
+
+/**
+ * @brief compares two integers or booleans of any size, storing -1, 0 or 1.
+ *
+ * Nothing is proved about the operands of the jumps that call this, so the
+ * proofs of the function stay.
+ */
+static int
+integral_compare(hs_state *state, hs_object a, hs_object b, hs_object *dst)
+{
+  if (HS_TAG(a) == HS_OBJECT_BOOLEAN) HS_SET_INT(a, HS_AS_INT(a));
+  if (HS_TAG(b) == HS_OBJECT_BOOLEAN) HS_SET_INT(b, HS_AS_INT(b));
+  if (hs_integer_compute(&state->area, dst, a, b, HS_INTEGER_CMP))
+    return HS_VM_ERROR_MEMORY;
+  return 0;
+}
+
+/**
+ * @brief decodes every opcode of a function into its instruction stream.
+ *
+ * This is done once when the function is loaded, so the loop never looks
+ * at HS_OPCODE_PARAM_TYPE, nor shifts and masks operands out of an opcode.
+ *
+ * @param fn The function to decode, with its code already set.
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+decode_function(hs_function *fn)
+{
+  const void *const *handlers = dispatch_handlers();
+  hs_instruction    *ins = malloc(fn->size * sizeof(hs_instruction));
+  size_t             caches = 0;
+  /* A catch stores the error on register 0, so there is always one */
+  uint16_t           window = 1;
+  if (!ins) return 1;
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    caches += is_field_opcode((uint8_t)( fn->code[i] >> 24 ));
+  }
+  fn->caches = caches ? calloc(caches, sizeof(hs_inline_cache)) : NULL;
+  if (caches && !fn->caches)
+  {
+    free(ins);
+    return 1;
+  }
+  caches = 0;
+  for (size_t i = 0; i < fn->size; ++i)
+  {
+    union hs_opcode_params params = { { 0, 0, 0 } };
+    uint8_t instruction;
+    HS_OP_DECODE(fn->code[i], instruction, params);
+    ins[i].handler = handlers ? handlers[instruction] : NULL;
+    ins[i].opcode  = instruction;
+    ins[i].cache   = is_field_opcode(instruction) ? fn->caches + caches++ :
+                                                    NULL;
+    ins[i].a       = 0;
+    ins[i].b       = 0;
+    ins[i].c       = 0;
+    ins[i].deopts  = 0;
+    ins[i].hits    = 0;
+    ins[i].imm     = 0;
+    switch (HS_OPCODE_PARAM_TYPE[instruction])
+    {
+      case HS_OPCODE_THREE_REG_PARAMS:
+        if (params.u8[2] >= window) window = params.u8[2] + 1;
+        /* fall through */
+      case HS_OPCODE_TWO_REG_PARAMS:
+        if (params.u8[1] >= window) window = params.u8[1] + 1;
+        /* fall through */
+      case HS_OPCODE_ONE_REG_PARAMS:
+        if (params.u8[0] >= window) window = params.u8[0] + 1;
+        ins[i].a = params.u8[0];
+        ins[i].b = params.u8[1];
+        ins[i].c = params.u8[2];
+        break;
+      case HS_OPCODE_UINT_AND_REG_PARAMS:
+        if (params.set.u8 >= window) window = params.set.u8 + 1;
+        ins[i].a   = params.set.u8;
+        ins[i].imm = params.set.u16;
+        if (is_site_opcode(instruction))
+          window = site_window(fn->module, params.set.u16, window);
+        break;
+      case HS_OPCODE_UINT_PARAMS:
+        ins[i].imm = params.set.u16;
+        break;
+      default:
+        break;
+    }
+    if (instruction == HS_OP_LOAD_CONST_WIDE ||
+        instruction == HS_OP_LOAD_INT_WIDE)
+    {
+      /* END_BYTECODE is last, so there is always a next word */
+      uint32_t extra = fn->code[i + 1];
+      if ( ( ( extra >> 24 ) & 255 ) != HS_OP_EXTRA_ARG )
+      {
+        free(fn->caches);
+        fn->caches = NULL;
+        free(ins);
+        return 1;
+      }
+      extra &= 0xFFFFFF;
+      /* Integers are signed, constant indexes are not */
+      if (instruction == HS_OP_LOAD_INT_WIDE && (extra & 0x800000))
+        ins[i].imm = (int32_t)extra - 0x1000000;
+      else
+        ins[i].imm = (int32_t)extra;
+    }
+  }
+  fn->instructions = ins;
+  fn->registers    = window;
+  if (fn->module) fuse_function(fn, fn->module->fusions, handlers);
+  if (verify_function(fn, handlers))
+  {
+    free(fn->caches);
+    fn->caches       = NULL;
+    fn->instructions = NULL;
+    free(ins);
+    return 1;
+  }
+  return 0;
+}
+
+int
+hs_function_init(hs_function *fn, hs_module *module, const uint32_t *code,
+                 size_t size, uint16_t locals)
+{
+  /* The loop never checks the end of the code, it trusts this marker */
+  if (size == 0 || size > UINT16_MAX + 1) return 1;
+  if ( ( ( code[size - 1] >> 24 ) & 255 ) != HS_OP_END_BYTECODE ) return 1;
+  fn->module = module;
+  fn->code   = code;
+  fn->size   = size;
+  fn->locals = locals;
+  fn->params = NULL;
+  fn->param_count = 0;
+  fn->handlers = NULL;
+  fn->handler_count = 0;
+  fn->name       = NULL;
+  fn->lines      = NULL;
+  fn->line_count = 0;
+  fn->jit_entry  = NULL;
+  fn->jit_code   = NULL;
+  fn->jit_size   = 0;
+  fn->jit_calls  = 0;
+  fn->osr_entry  = NULL;
+  fn->osr_code   = NULL;
+  fn->osr_size   = 0;
+  fn->osr_at     = 0;
+  return decode_function(fn);
+}
+
+int
+hs_function_set_handlers(hs_function *fn, const hs_handler *handlers,
+                         size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (handlers[i].start > handlers[i].end || handlers[i].end > fn->size ||
+        verify_target(fn, handlers[i].target))
+      return 1;
+  }
+  fn->handlers      = handlers;
+  fn->handler_count = count;
+  /* The handlers are new ways into the code, what was proved may not hold,
+   * and the machine code was compiled from those proofs */
+  hs_function_jit_end(fn);
+  return verify_function(fn, dispatch_handlers());
+}
+
+int
+hs_function_set_lines(hs_function *fn, const hs_line *lines, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (lines[i].start >= fn->size ||
+        ( i > 0 && lines[i].start <= lines[i - 1].start ))
+      return 1;
+  }
+  fn->lines      = lines;
+  fn->line_count = count;
+  return 0;
+}
+
+uint32_t
+hs_function_line(const hs_function *fn, size_t at)
+{
+  size_t low = 0, high = fn->line_count;
+  /* The last entry starting at or before the instruction */
+  while (low < high)
+  {
+    size_t mid = low + ( high - low ) / 2;
+    if (fn->lines[mid].start <= at) low = mid + 1;
+    else high = mid;
+  }
+  return low ? fn->lines[low - 1].line : 0;
+}
+
+void
+hs_function_end(hs_function *fn)
+{
+  hs_function_jit_end(fn);
+  free(fn->instructions);
+  free(fn->caches);
+  fn->instructions = NULL;
+  fn->caches = NULL;
+  fn->code = NULL;
+  fn->size = 0;
+}
+
+int
+hs_state_init(hs_state *state)
+{
+  memset(state, 0, sizeof *state);
+  HS_SET_NULL(state->error);
+  hs_object_area_init(&state->area);
+  state->shapes      = hs_shape_new();
+  state->megamorphic = calloc(HS_VM_MEGAMORPHIC_SIZE, sizeof(hs_cache_entry));
+  if (state->shapes && state->megamorphic) return 0;
+  hs_state_end(state);
+  return 1;
+}
+
+void
+hs_state_end(hs_state *state)
+{
+  hs_frame_chunk *chunk;
+  while (state->frame)
+  {
+    state->frame = state->frame->parent;
+    frame_pop(state);
+  }
+  chunk = state->frames;
+  while (chunk && chunk->prev) chunk = chunk->prev;
+  while (chunk)
+  {
+    hs_frame_chunk *next = chunk->next;
+    for (size_t i = 0; i < HS_FRAME_CHUNK; ++i)
+    {
+      /* The escaped ones are on their own chain, released below */
+      hs_context *ctx = chunk->frames[i].context;
+      if (ctx && !ctx->escaped) free(ctx);
+    }
+    free(chunk);
+    chunk = next;
+  }
+  while (state->closures)
+  {
+    hs_closure *next = state->closures->next;
+    free(state->closures);
+    state->closures = next;
+  }
+  while (state->escaped)
+  {
+    hs_context *next = state->escaped->next;
+    free(state->escaped);
+    state->escaped = next;
+  }
+  free(state->stack);
+  free(state->registers);
+  free(state->tries);
+  if (state->shapes) hs_shape_free(state->shapes);
+  free(state->megamorphic);
+  hs_object_area_end(&state->area);
+  memset(state, 0, sizeof *state);
+}
+
+void
+hs_vm_get_cache_stats(const hs_state *state, hs_vm_cache_stats *stats)
+{
+  *stats = state->cache_stats;
+}
+
+void
+hs_vm_reset_cache_stats(hs_state *state)
+{
+  memset(&state->cache_stats, 0, sizeof state->cache_stats);
+}
+
+size_t
+hs_vm_argc(hs_state *state)
+{
+  return state->native_argc;
+}
+
+int
+hs_vm_arg(hs_state *state, size_t index, hs_object *dst)
+{
+  if (index >= state->native_argc) return 1;
+  *dst = state->registers[state->native_args + index];
+  return 0;
+}
+
+/**
+ * @brief gets the size of the argument block being filled, 0 if none.
+ *
+ * A block opened by a caller, before calling through a call site, lies
+ * under the window of the running frame, and isn't for its calls.
+ */
+static size_t
+pending_argc(const hs_state *state)
+{
+  if (state->args_base <= state->frame->base) return 0;
+  return state->registers_size - state->args_base;
+}
+
+/**
+ * @brief Records the stack for the samples requested by the sampler.
+ *
+ * @param state The state being sampled.
+ * @param ins The instruction running on the top frame.
+ */
+static void
+sample_take(hs_state *state, const hs_instruction *ins)
+{
+  hs_sample_frame frames[HS_SAMPLE_MAX_DEPTH];
+  const hs_frame *frame  = state->frame;
+  uint64_t        weight = (uint64_t)state->sample_pending;
+  size_t          depth  = 0;
+  size_t          at     = (size_t)( ins - frame->function->instructions );
+  state->sample_pending = 0;
+  if (!state->sampler) return;
+  for (; frame && depth < HS_SAMPLE_MAX_DEPTH; frame = frame->parent)
+  {
+    frames[depth].function = frame->function;
+    frames[depth].line     = hs_function_line(frame->function, at);
+    ++depth;
+    /* A parent is stopped on its call, right before its pc */
+    if (frame->parent)
+      at = (size_t)( frame->parent->pc - frame->parent->function->instructions
+                     - 1 );
+  }
+  hs_sampler_add(state->sampler, frames, depth, weight);
+}
+
+/**
+ * @brief Runs what was requested at a safepoint: the samples of the sampler,
+ *        then the safepoint function of the state.
+ *
+ * @param state The state reaching the safepoint.
+ * @param ins The instruction running on the top frame.
+ * @return A non zero value if the run must stop.
+ */
+static int
+safepoint_reached(hs_state *state, const hs_instruction *ins)
+{
+  /* Cleared first, so a request arriving now is seen on the next poll */
+  state->safepoint = 0;
+  if (state->sample_pending) sample_take(state, ins);
+  if (state->on_safepoint)
+    return state->on_safepoint(state, state->safepoint_data);
+  return 0;
+}
+
+void
+hs_state_request_safepoint(hs_state *state)
+{
+  state->safepoint = 1;
+}
+
+/**
+ * @brief counts a pair of opcodes, together with their unchecked forms.
+ */
+static uint64_t
+pair_count(const hs_vm_profile *profile, uint16_t a, uint16_t b)
+{
+  uint16_t ua = unchecked_form(a), ub = unchecked_form(b);
+  uint64_t count = profile->pairs[a][b];
+  if (ua != a) count += profile->pairs[ua][b];
+  if (ub != b) count += profile->pairs[a][ub];
+  if (ua != a && ub != b) count += profile->pairs[ua][ub];
+  return count;
+}
+
+unsigned
+hs_vm_select_fusions(const hs_vm_profile *profile, double min_share)
+{
+  uint64_t total = 0, cmp_jump = 0, local_inc, local_call, field_call;
+  unsigned fusions = 0;
+  for (size_t a = 0; a < HS_OPCODE_COUNT; ++a)
+  {
+    for (size_t b = 0; b < HS_OPCODE_COUNT; ++b)
+    {
+      total += profile->pairs[a][b];
+    }
+  }
+  if (total == 0) return 0;
+  local_inc  = pair_count(profile, HS_OP_LOAD_LOCAL, HS_OP_INT_INC) +
+               pair_count(profile, HS_OP_LOAD_LOCAL, HS_OP_INT_DEC);
+  local_call = pair_count(profile, HS_OP_LOAD_LOCAL, HS_OP_LOCAL_CALL);
+  field_call = pair_count(profile, HS_OP_LOAD_FIELD, HS_OP_CALL);
+  for (uint16_t b = HS_OP_JUMP_EQ_ZERO; b <= HS_OP_JUMP_GE_ZERO; ++b)
+  {
+    cmp_jump += pair_count(profile, HS_OP_INT_CMP, b);
+  }
+  if (local_inc  && local_inc  >= min_share * total)
+    fusions |= HS_VM_FUSE_LOCAL_INC;
+  if (cmp_jump   && cmp_jump   >= min_share * total)
+    fusions |= HS_VM_FUSE_CMP_JUMP;
+  if (local_call && local_call >= min_share * total)
+    fusions |= HS_VM_FUSE_LOCAL_CALL;
+  if (field_call && field_call >= min_share * total)
+    fusions |= HS_VM_FUSE_FIELD_CALL;
+  return fusions;
+}
+
+/* The opcodes with a handler inside hs_vm_run(), anything else is invalid */
+#define HS_VM_OPCODES(X)                                                       \
+  X(HS_OP_NOP)                       X(HS_OP_BREAKPOINT)                       \
+  X(HS_OP_HALT)                      X(HS_OP_LOAD_NULL)                        \
+  X(HS_OP_LOAD_FALSE)                X(HS_OP_LOAD_TRUE)                        \
+  X(HS_OP_LOAD_ARG_INDIRECT)         X(HS_OP_LOAD_ARG)                         \
+  X(HS_OP_LOAD_LOCAL)                X(HS_OP_LOAD_LOCAL_INDIRECT)              \
+  X(HS_OP_LOAD_LOCAL_CONST)          X(HS_OP_LOAD_LOCAL_CONST_INDIRECT)        \
+  X(HS_OP_LOAD_INT_CONST)            X(HS_OP_STORE_LOCAL)                      \
+  X(HS_OP_EXTRA_ARG)                 X(HS_OP_LOAD_CONST_WIDE)                  \
+  X(HS_OP_LOAD_INT_WIDE)                                                       \
+  X(HS_OP_STORE_LOCAL_INDIRECT)      X(HS_OP_MOVE)                             \
+  X(HS_OP_STACK_POP)                 X(HS_OP_STACK_PUSH)                       \
+  X(HS_OP_STACK_PEEK)                X(HS_OP_STACK_DUP)                        \
+  X(HS_OP_JUMP)                      X(HS_OP_JUMP_EQ_REG)                      \
+  X(HS_OP_JUMP_NE_REG)               X(HS_OP_JUMP_LT_REG)                      \
+  X(HS_OP_JUMP_LE_REG)               X(HS_OP_JUMP_GT_REG)                      \
+  X(HS_OP_JUMP_GE_REG)               X(HS_OP_JUMP_EQ_ZERO)                     \
+  X(HS_OP_JUMP_NE_ZERO)              X(HS_OP_JUMP_LT_ZERO)                     \
+  X(HS_OP_JUMP_LE_ZERO)              X(HS_OP_JUMP_GT_ZERO)                     \
+  X(HS_OP_JUMP_GE_ZERO)              X(HS_OP_JUMP_INDIRECT)                    \
+  X(HS_OP_JUMP_EQ_ZERO_INDIRECT)     X(HS_OP_JUMP_NE_ZERO_INDIRECT)            \
+  X(HS_OP_JUMP_LT_ZERO_INDIRECT)     X(HS_OP_JUMP_LE_ZERO_INDIRECT)            \
+  X(HS_OP_JUMP_GT_ZERO_INDIRECT)     X(HS_OP_JUMP_GE_ZERO_INDIRECT)            \
+  X(HS_OP_RETURN)                    X(HS_OP_RETURN_NULL)                      \
+  X(HS_OP_RETURN_SELF)               X(HS_OP_RESERVE_ARGS)                     \
+  X(HS_OP_TAIL_CALL)                 X(HS_OP_TAIL_LOCAL_CALL)                  \
+  X(HS_OP_TAIL_DYNAMIC_CALL)                                                   \
+  X(HS_OP_RESERVE_ARGS_INDIRECT)     X(HS_OP_SET_ARG)                          \
+  X(HS_OP_SET_ARG_INDIRECT)          X(HS_OP_CALL)                             \
+  X(HS_OP_LOCAL_CALL)                X(HS_OP_DYNAMIC_CALL)                     \
+  X(HS_OP_CALL_SITE)                 X(HS_OP_LOCAL_CALL_SITE)                  \
+  X(HS_OP_DYNAMIC_CALL_SITE)                                                   \
+  X(HS_OP_SET_THIS)                  X(HS_OP_SET_MODULE)                       \
+  X(HS_OP_GET_THIS)                  X(HS_OP_GET_MODULE)                       \
+  X(HS_OP_BOOL_AND)                  X(HS_OP_BOOL_OR)                          \
+  X(HS_OP_BOOL_XOR)                  X(HS_OP_BOOL_CMP)                         \
+  X(HS_OP_BOOL_NOT)                  X(HS_OP_INT_ADD)                          \
+  X(HS_OP_INT_SUB)                   X(HS_OP_INT_MUL)                          \
+  X(HS_OP_INT_DIV)                   X(HS_OP_INT_MOD)                          \
+  X(HS_OP_INT_REM)                   X(HS_OP_INT_SHL)                          \
+  X(HS_OP_INT_SHR)                   X(HS_OP_INT_LSL)                          \
+  X(HS_OP_INT_LSR)                   X(HS_OP_INT_AND)                          \
+  X(HS_OP_INT_OR)                    X(HS_OP_INT_XOR)                          \
+  X(HS_OP_INT_CMP)                   X(HS_OP_INT_NEG)                          \
+  X(HS_OP_INT_CPL)                   X(HS_OP_INT_POW)                          \
+  X(HS_OP_FLOAT_ADD)                 X(HS_OP_FLOAT_SUB)                        \
+  X(HS_OP_FLOAT_MUL)                 X(HS_OP_FLOAT_DIV)                        \
+  X(HS_OP_FLOAT_SQRT)                X(HS_OP_FLOAT_EXP)                        \
+  X(HS_OP_FLOAT_POW)                 X(HS_OP_FLOAT_LOG2)                       \
+  X(HS_OP_FLOAT_LOG)                 X(HS_OP_FLOAT_LN)                         \
+  X(HS_OP_FLOAT_SIN)                 X(HS_OP_FLOAT_COS)                        \
+  X(HS_OP_FLOAT_TAN)                 X(HS_OP_FLOAT_ASIN)                       \
+  X(HS_OP_FLOAT_ACOS)                X(HS_OP_FLOAT_ATAN)                       \
+  X(HS_OP_FLOAT_ATAN2)               X(HS_OP_FLOAT_NEG)                        \
+  X(HS_OP_FLOAT_CMP)                 X(HS_OP_BOOL2INT)                         \
+  X(HS_OP_INT2BOOL)                  X(HS_OP_INT2FLOAT)                        \
+  X(HS_OP_FLOAT2INT)                 X(HS_OP_NEW_TRY_CONTEXT)                  \
+  X(HS_OP_NEW_TRY_CONTEXT_INDIRECT)  X(HS_OP_NEW_TRY_CONTEXT_NO_FINAL)         \
+  X(HS_OP_ADD_CATCH)                 X(HS_OP_ADD_CATCH_INDIRECT)               \
+  X(HS_OP_THROW)                     X(HS_OP_END_TRY_CONTEXT)                  \
+  X(HS_OP_INT_INC)                   X(HS_OP_INT_DEC)                          \
+  X(HS_OP_FLOAT_INC)                 X(HS_OP_FLOAT_DEC)                        \
+  X(HS_OP_DECLARE_FUNCTION)          X(HS_OP_DECLARE_FUNCTION_INDIRECT)        \
+  X(HS_OP_END_BYTECODE)                                                        \
+  X(HS_OP_LOCAL_INT_INC)             X(HS_OP_LOCAL_INT_DEC)                    \
+  X(HS_OP_INT_JUMP_EQ)               X(HS_OP_INT_JUMP_NE)                      \
+  X(HS_OP_INT_JUMP_LT)               X(HS_OP_INT_JUMP_LE)                      \
+  X(HS_OP_INT_JUMP_GT)               X(HS_OP_INT_JUMP_GE)                      \
+  X(HS_OP_LOCAL_LOAD_CALL)                                                     \
+  X(HS_OP_LOAD_FIELD)                X(HS_OP_LOAD_FIELD_INDIRECT)              \
+  X(HS_OP_STORE_FIELD)               X(HS_OP_STORE_FIELD_INDIRECT)             \
+  X(HS_OP_NEW)                       X(HS_OP_EXTEND)                           \
+  X(HS_OP_ARRAY_NEW)                 X(HS_OP_ARRAY_NEW_INDIRECT)               \
+  X(HS_OP_ARRAY_GET)                 X(HS_OP_ARRAY_SET)                        \
+  X(HS_OP_ARRAY_DELETE)              X(HS_OP_RANGE_NEW)                        \
+  X(HS_OP_RANGE_NEW_EXCLUSIVE)       X(HS_OP_RANGE_STEP)                       \
+  X(HS_OP_RANGE_INCLUDES)            X(HS_OP_FOR_IN)                           \
+  X(HS_OP_ADD)                       X(HS_OP_SUB)                              \
+  X(HS_OP_MUL)                       X(HS_OP_DIV)                              \
+  X(HS_OP_CMP)                                                                 \
+  X(HS_OP_ADD_INT)                   X(HS_OP_ADD_FLOAT)                        \
+  X(HS_OP_SUB_INT)                   X(HS_OP_SUB_FLOAT)                        \
+  X(HS_OP_MUL_INT)                   X(HS_OP_MUL_FLOAT)                        \
+  X(HS_OP_DIV_INT)                   X(HS_OP_DIV_FLOAT)                        \
+  X(HS_OP_CMP_INT)                   X(HS_OP_CMP_FLOAT)                        \
+  X(HS_OP_FIELD_CALL)                                                          \
+  X(HS_OP_INT_ADD_UNCHECKED)         X(HS_OP_INT_SUB_UNCHECKED)                \
+  X(HS_OP_INT_MUL_UNCHECKED)         X(HS_OP_INT_AND_UNCHECKED)                \
+  X(HS_OP_INT_OR_UNCHECKED)          X(HS_OP_INT_XOR_UNCHECKED)                \
+  X(HS_OP_INT_CMP_UNCHECKED)         X(HS_OP_INT_INC_UNCHECKED)                \
+  X(HS_OP_INT_DEC_UNCHECKED)         X(HS_OP_FLOAT_ADD_UNCHECKED)              \
+  X(HS_OP_FLOAT_SUB_UNCHECKED)       X(HS_OP_FLOAT_MUL_UNCHECKED)              \
+  X(HS_OP_FLOAT_DIV_UNCHECKED)       X(HS_OP_JUMP_EQ_ZERO_UNCHECKED)           \
+  X(HS_OP_JUMP_NE_ZERO_UNCHECKED)    X(HS_OP_JUMP_LT_ZERO_UNCHECKED)           \
+  X(HS_OP_JUMP_LE_ZERO_UNCHECKED)    X(HS_OP_JUMP_GT_ZERO_UNCHECKED)           \
+  X(HS_OP_JUMP_GE_ZERO_UNCHECKED)    X(HS_OP_INT_JUMP_EQ_UNCHECKED)            \
+  X(HS_OP_INT_JUMP_NE_UNCHECKED)     X(HS_OP_INT_JUMP_LT_UNCHECKED)            \
+  X(HS_OP_INT_JUMP_LE_UNCHECKED)     X(HS_OP_INT_JUMP_GT_UNCHECKED)            \
+  X(HS_OP_INT_JUMP_GE_UNCHECKED)     X(HS_OP_STACK_POP_UNCHECKED)              \
+  X(HS_OP_STACK_PEEK_UNCHECKED)
+
+#define HS_VM_NAME(op) [op] = #op + 6,
+
+static const char *const opcode_names[HS_OPCODE_COUNT] = {
+  HS_VM_OPCODES(HS_VM_NAME)
+};
+
+/* The most frequent pairs and triples written by hs_vm_profile_write_json */
+#define HS_VM_PROFILE_DUMP_TOP 100
+
+/* The unit of the profile ticks, see profile_clock() */
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define HS_VM_PROFILE_UNIT "cycles"
+#elif defined(CLOCK_MONOTONIC)
+#define HS_VM_PROFILE_UNIT "nanoseconds"
+#else
+#define HS_VM_PROFILE_UNIT "clock"
+#endif
+
+const char *
+hs_vm_opcode_name(uint16_t opcode)
+{
+  if (opcode >= HS_OPCODE_COUNT || !opcode_names[opcode]) return "INVALID";
+  return opcode_names[opcode];
+}
+
+#ifdef HS_VM_PROFILE
+/**
+ * @brief Reads the clock used by the profiler.
+ */
+static uint64_t
+profile_clock(void)
+{
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+  return __builtin_ia32_rdtsc();
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#else
+  return (uint64_t)clock();
+#endif
+}
+
+/**
+ * @brief Records the dispatch of next, after ins ran. ins is NULL when the
+ *        run starts.
+ */
+static void
+profile_step(hs_vm_profile *profile, const hs_instruction *ins,
+             const hs_instruction *next)
+{
+  uint64_t now = profile_clock();
+  profile->counts[next->opcode] += 1;
+  if (ins)
+  {
+    profile->ticks[ins->opcode] += now - profile->stamp;
+    profile->pairs[ins->opcode][next->opcode] += 1;
+    if (profile->last)
+    {
+      uint32_t key = ( (uint32_t)profile->last * HS_OPCODE_COUNT +
+                       ins->opcode ) * HS_OPCODE_COUNT + next->opcode;
+      size_t   i, probes;
+      /* Linear probing, a triple not found after a few probes is lost */
+      for (i = key * 2654435761u % HS_VM_PROFILE_TRIPLES, probes = 0;
+           probes < 16; i = ( i + 1 ) % HS_VM_PROFILE_TRIPLES, ++probes)
+      {
+        hs_vm_sequence *entry = profile->triples + i;
+        if (entry->count == 0)
+        {
+          entry->ops[0] = profile->last;
+          entry->ops[1] = ins->opcode;
+          entry->ops[2] = next->opcode;
+        }
+        else if (entry->ops[0] != profile->last ||
+                 entry->ops[1] != ins->opcode || entry->ops[2] != next->opcode)
+          continue;
+        entry->count += 1;
+        break;
+      }
+      if (probes == 16) profile->triples_lost += 1;
+    }
+    profile->last = ins->opcode;
+  }
+  else
+    profile->last = 0;
+  profile->stamp = now;
+}
+#endif
+
+/**
+ * @brief Adds a sequence to the n most frequent ones, kept sorted.
+ */
+static void
+top_insert(hs_vm_sequence *top, size_t *size, size_t n, hs_vm_sequence seq)
+{
+  size_t i = *size;
+  if (seq.count == 0) return;
+  if (i == n)
+  {
+    if (n == 0 || top[n - 1].count >= seq.count) return;
+    --i;
+  }
+  else
+    ++*size;
+  for (; i > 0 && top[i - 1].count < seq.count; --i)
+  {
+    top[i] = top[i - 1];
+  }
+  top[i] = seq;
+}
+
+size_t
+hs_vm_profile_top(const hs_vm_profile *profile, size_t length,
+                  hs_vm_sequence *top, size_t n)
+{
+  hs_vm_sequence seq = { { 0, 0, 0 }, 0 };
+  size_t         size = 0;
+  switch (length)
+  {
+    case 1:
+      for (uint16_t a = 0; a < HS_OPCODE_COUNT; ++a)
+      {
+        seq.ops[0] = a;
+        seq.count  = profile->counts[a];
+        top_insert(top, &size, n, seq);
+      }
+      break;
+    case 2:
+      for (uint16_t a = 0; a < HS_OPCODE_COUNT; ++a)
+      {
+        for (uint16_t b = 0; b < HS_OPCODE_COUNT; ++b)
+        {
+          seq.ops[0] = a;
+          seq.ops[1] = b;
+          seq.count  = profile->pairs[a][b];
+          top_insert(top, &size, n, seq);
+        }
+      }
+      break;
+    case 3:
+      for (size_t i = 0; i < HS_VM_PROFILE_TRIPLES; ++i)
+      {
+        top_insert(top, &size, n, profile->triples[i]);
+      }
+      break;
+    default:
+      break;
+  }
+  return size;
+}
+
+/**
+ * @brief Writes the most frequent sequences of a length as a JSON array.
+ */
+static void
+write_sequences(const hs_vm_profile *profile, size_t length, FILE *file)
+{
+  hs_vm_sequence top[HS_VM_PROFILE_DUMP_TOP];
+  size_t         size = hs_vm_profile_top(profile, length, top,
+                                          HS_VM_PROFILE_DUMP_TOP);
+  fputs("[", file);
+  for (size_t i = 0; i < size; ++i)
+  {
+    fprintf(file, "%s\n    { \"ops\": [", i ? "," : "");
+    for (size_t j = 0; j < length; ++j)
+    {
+      fprintf(file, "%s\"%s\"", j ? ", " : "",
+              hs_vm_opcode_name(top[i].ops[j]));
+    }
+    fprintf(file, "], \"count\": %llu }", (unsigned long long)top[i].count);
+  }
+  fputs(size ? "\n  ]" : "]", file);
+}
+
+int
+hs_vm_profile_write_json(const hs_vm_profile *profile, FILE *file)
+{
+  hs_vm_sequence top[HS_OPCODE_COUNT];
+  size_t         size = hs_vm_profile_top(profile, 1, top, HS_OPCODE_COUNT);
+  fputs("{\n  \"clock\": \"" HS_VM_PROFILE_UNIT "\",\n  \"opcodes\": [", file);
+  for (size_t i = 0; i < size; ++i)
+  {
+    uint16_t op = top[i].ops[0];
+    fprintf(file, "%s\n    { \"name\": \"%s\", \"opcode\": %u, "
+            "\"count\": %llu, \"ticks\": %llu }", i ? "," : "",
+            hs_vm_opcode_name(op), (unsigned)op,
+            (unsigned long long)profile->counts[op],
+            (unsigned long long)profile->ticks[op]);
+  }
+  fputs(size ? "\n  ],\n  \"pairs\": " : "],\n  \"pairs\": ", file);
+  write_sequences(profile, 2, file);
+  fputs(",\n  \"triples\": ", file);
+  write_sequences(profile, 3, file);
+  fprintf(file, ",\n  \"triples_lost\": %llu\n}\n",
+          (unsigned long long)profile->triples_lost);
+  return ferror(file) ? 1 : 0;
+}
+
+static const hs_vm_profile *exit_profile;
+static const char          *exit_path;
+
+/**
+ * @brief Writes the profile given to hs_vm_profile_dump_at_exit().
+ */
+static void
+dump_at_exit(void)
+{
+  FILE *file;
+  if (!exit_profile) return;
+  file = exit_path ? fopen(exit_path, "w") : stderr;
+  if (!file) return;
+  hs_vm_profile_write_json(exit_profile, file);
+  if (file != stderr) fclose(file);
+}
+
+int
+hs_vm_profile_dump_at_exit(const hs_vm_profile *profile, const char *path)
+{
+  static int registered = 0;
+  exit_profile = profile;
+  exit_path    = path;
+  if (!registered && atexit(dump_at_exit)) return 1;
+  registered = 1;
+  return 0;
+}
+
+/* Records the dispatch of the next instruction */
+#ifdef HS_VM_PROFILE
+#define HS_VM_COUNT(next)                                                      \
+  if (state->profile) profile_step(state->profile, ins, next)
+#else
+#define HS_VM_COUNT(next)
+#endif
+
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+
+#define HS_VM_LABEL(op) [op] = &&L_##op,
+#define HS_VM_CASE(op)  L_##op:
+#define HS_VM_DEFAULT   L_INVALID:
+#define HS_VM_NEXT()                                                           \
+  do                                                                           \
+  {                                                                            \
+    HS_VM_COUNT(pc);                                                           \
+    ins = pc++;                                                                \
+    goto *ins->handler;                                                        \
+  } while (0)
+
+#else
+
+#define HS_VM_CASE(op)  case op:
+#define HS_VM_DEFAULT   default:
+#define HS_VM_NEXT()    goto dispatch
+
+#endif
+
+/* Operand shorthands for the running instruction */
+#define REG_A    (regs[ins->a])
+#define REG_B    (regs[ins->b])
+#define REG_C    (regs[ins->c])
+
+/* The register stack can move when it grows, or when the frame changes */
+#define SYNC_REGS() regs = state->registers + frame->base
+#define IMM      (ins->imm)
+
+#define CHECK_REG(r)                                                           \
+  if ((r) >= frame->size) { error_code = HS_VM_ERROR_REGISTER; goto fail; }
+#define CHECK_A  CHECK_REG(ins->a)
+#define CHECK_AB CHECK_A; CHECK_REG(ins->b)
+#define CHECK_ABC CHECK_AB; CHECK_REG(ins->c)
+
+#define EXPECT(obj, t)                                                         \
+  if (HS_TAG(obj) != (t)) { error_code = HS_VM_ERROR_TYPE; goto fail; }
+#define EXPECT_INTEGRAL(obj)                                                   \
+  if (HS_TAG(obj) != HS_OBJECT_FIXINT && HS_TAG(obj) != HS_OBJECT_BOOLEAN &&   \
+      HS_TAG(obj) != HS_OBJECT_BIGINT)                                         \
+  { error_code = HS_VM_ERROR_TYPE; goto fail; }
+
+/* A value with the sign of an integer or boolean, compared against 0 */
+#define INTEGRAL_SIGN(obj)                                                     \
+  ( HS_TAG(obj) == HS_OBJECT_BIGINT ? hs_integer_sign(obj) : HS_AS_INT(obj) )
+
+#define SET_INT(obj, v)   HS_SET_INT(obj, v)
+#define SET_FLOAT(obj, v) HS_SET_FLOAT(obj, v)
+#define SET_BOOL(obj, v)  HS_SET_BOOL(obj, v)
+
+#define IS_INTEGER(obj)                                                        \
+  (HS_TAG(obj) == HS_OBJECT_FIXINT || HS_TAG(obj) == HS_OBJECT_BIGINT)
+#define EXPECT_INTEGER(obj)                                                    \
+  if (!IS_INTEGER(obj)) { error_code = HS_VM_ERROR_TYPE; goto fail; }
+
+/* Stores x op y on r, and gives if it left hs_int. With GCC it is the
+ * operation and a branch on the overflow flag */
+#if defined(__GNUC__)
+#define INT_ADD_OVERFLOWS(x, y, r) __builtin_add_overflow(x, y, r)
+#define INT_SUB_OVERFLOWS(x, y, r) __builtin_sub_overflow(x, y, r)
+#define INT_MUL_OVERFLOWS(x, y, r) __builtin_mul_overflow(x, y, r)
+#else
+#define INT_ADD_OVERFLOWS(x, y, r) int_narrow((int64_t)(x) + (y), r)
+#define INT_SUB_OVERFLOWS(x, y, r) int_narrow((int64_t)(x) - (y), r)
+#define INT_MUL_OVERFLOWS(x, y, r) int_narrow((int64_t)(x) * (y), r)
+#endif
+
+/* dst <- x op y, on integers of any size, by integer_op() */
+#define INTEGER_OP(dst, x, y, op)                                              \
+  do                                                                           \
+  {                                                                            \
+    error_code = integer_op(state, frame->function, &(dst), x, y, op);         \
+    if (error_code) goto fail;                                                 \
+  } while (0)
+
+#define CHECK_TARGET(target)                                                   \
+  if ((size_t)(target) >= frame->function->size)                              \
+  { error_code = HS_VM_ERROR_JUMP; goto fail; }
+
+/* Polls the safepoint flag, only on backward jumps, calls and returns */
+#define SAFEPOINT()                                                            \
+  if (state->safepoint && safepoint_reached(state, ins)) goto interrupt
+
+#define IS_BACKWARD(to)                                                        \
+  ( (size_t)(to) <= (size_t)( ins - frame->function->instructions ) )
+
+/* Taken on backward jumps: polls, then counts towards moving the loop
+ * starting at to into machine code */
+#define BACK_EDGE(to)                                                          \
+  do                                                                           \
+  {                                                                            \
+    hs_instruction *edge_ = (hs_instruction *)ins;                             \
+    SAFEPOINT();                                                               \
+    if (edge_->hits < state->osr_threshold &&                                  \
+        ++edge_->hits == state->osr_threshold)                                 \
+    {                                                                          \
+      at = (to);                                                               \
+      goto do_osr;                                                             \
+    }                                                                          \
+  } while (0)
+
+#define JUMP_TO(target)                                                        \
+  do                                                                           \
+  {                                                                            \
+    size_t to_ = (size_t)(target);                                             \
+    CHECK_TARGET(to_);                                                         \
+    if (IS_BACKWARD(to_)) BACK_EDGE(to_);                                      \
+    pc = frame->function->instructions + to_;                                  \
+  } while (0)
+
+/* <reg> <- int : <reg> op <reg>, as a BIGINT when it leaves hs_int. On two
+ * FIXINTs that fit it is the operation and a branch */
+#define INT_ARITH(name)                                                        \
+  CHECK_ABC;                                                                   \
+  {                                                                            \
+    hs_int r_;                                                                 \
+    if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&                                   \
+        HS_TAG(REG_C) == HS_OBJECT_FIXINT &&                                   \
+        !INT_##name##_OVERFLOWS(HS_AS_INT(REG_B), HS_AS_INT(REG_C), &r_))      \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+      INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_##name);                      \
+  }                                                                            \
+  HS_VM_NEXT()
+
+/* <reg> <- <reg> op 1, as a BIGINT when it leaves hs_int */
+#define INT_STEP(name)                                                         \
+  CHECK_A;                                                                     \
+  {                                                                            \
+    hs_int r_;                                                                 \
+    if (HS_TAG(REG_A) == HS_OBJECT_FIXINT &&                                   \
+        !INT_##name##_OVERFLOWS(HS_AS_INT(REG_A), 1, &r_))                     \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+    {                                                                          \
+      hs_object one_;                                                          \
+      SET_INT(one_, 1);                                                        \
+      INTEGER_OP(REG_A, REG_A, one_, HS_INTEGER_##name);                       \
+    }                                                                          \
+  }                                                                            \
+  HS_VM_NEXT()
+
+/* <reg> <- int : <reg> op <reg>, bitwise on two's complement, so two
+ * FIXINTs never leave hs_int. A BIGINT goes through integer_op() */
+#define INT_BINOP(name, op)                                                    \
+  CHECK_ABC;                                                                   \
+  if (HS_TAG(REG_B) == HS_OBJECT_FIXINT && HS_TAG(REG_C) == HS_OBJECT_FIXINT)  \
+    SET_INT(REG_A, (hs_int)( (uint32_t)HS_AS_INT(REG_B) op                     \
+                             (uint32_t)HS_AS_INT(REG_C) ));                    \
+  else                                                                         \
+    INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_##name);                        \
+  HS_VM_NEXT()
+
+/* Shift counts can be integers of any size, but never negative */
+#define EXPECT_COUNT(obj)                                                      \
+  if (HS_TAG(obj) == HS_OBJECT_FIXINT ? HS_AS_INT(obj) < 0 :                   \
+      HS_TAG(obj) == HS_OBJECT_BIGINT &&                                       \
+      HS_AS_BOX(obj)->value.as_bigint.negative)                                \
+  { error_code = HS_VM_ERROR_RANGE; goto fail; }
+
+#define FLOAT_BINOP(op)                                                        \
+  CHECK_ABC;                                                                   \
+  EXPECT(REG_B, HS_OBJECT_FLOAT);                                              \
+  EXPECT(REG_C, HS_OBJECT_FLOAT);                                              \
+  SET_FLOAT(REG_A, HS_AS_FLOAT(REG_B) op HS_AS_FLOAT(REG_C));                  \
+  HS_VM_NEXT()
+
+#define FLOAT_UNARY(fn)                                                        \
+  CHECK_AB;                                                                    \
+  EXPECT(REG_B, HS_OBJECT_FLOAT);                                              \
+  SET_FLOAT(REG_A, (hs_float)fn(HS_AS_FLOAT(REG_B)));                          \
+  HS_VM_NEXT()
+
+#define BOOL_BINOP(op)                                                         \
+  CHECK_ABC;                                                                   \
+  EXPECT(REG_B, HS_OBJECT_BOOLEAN);                                            \
+  EXPECT(REG_C, HS_OBJECT_BOOLEAN);                                            \
+  SET_BOOL(REG_A, HS_AS_INT(REG_B) op HS_AS_INT(REG_C));                       \
+  HS_VM_NEXT()
+
+/* if <reg> op <reg> then jump( <reg> ) */
+#define JUMP_REG(op)                                                           \
+  CHECK_ABC;                                                                   \
+  EXPECT_INTEGRAL(REG_A);                                                      \
+  EXPECT_INTEGRAL(REG_B);                                                      \
+  EXPECT(REG_C, HS_OBJECT_FIXINT);                                             \
+  if (HS_TAG(REG_A) == HS_OBJECT_BIGINT || HS_TAG(REG_B) == HS_OBJECT_BIGINT)  \
+  {                                                                            \
+    error_code = integral_compare(state, REG_A, REG_B, &value);                \
+    if (error_code) goto fail;                                                 \
+    if (HS_AS_INT(value) op 0) JUMP_TO(HS_AS_INT(REG_C));                      \
+  }                                                                            \
+  else if (HS_AS_INT(REG_A) op HS_AS_INT(REG_B)) JUMP_TO(HS_AS_INT(REG_C));    \
+  HS_VM_NEXT()
+
+/* if <reg> op 0 then jump( <uint16> ) */
+#define JUMP_ZERO(op)                                                          \
+  CHECK_A;                                                                     \
+  EXPECT_INTEGRAL(REG_A);                                                      \
+  if (INTEGRAL_SIGN(REG_A) op 0) JUMP_TO(IMM);                                 \
+  HS_VM_NEXT()
+
+/* if <reg> op 0 then jump( <reg> ) */
+#define JUMP_ZERO_INDIRECT(op)                                                 \
+  CHECK_AB;                                                                    \
+  EXPECT_INTEGRAL(REG_A);                                                      \
+  EXPECT(REG_B, HS_OBJECT_FIXINT);                                             \
+  if (INTEGRAL_SIGN(REG_A) op 0) JUMP_TO(HS_AS_INT(REG_B));                    \
+  HS_VM_NEXT()
+
+#define CMP(a, b) ( (a) < (b) ? -1 : ( (a) > (b) ? 1 : 0 ) )
+
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+#define HANDLER(op) (labels[op])
+#else
+#define HANDLER(op) NULL
+#endif
+
+/* Rewrites the running instruction into a quickened opcode */
+#define QUICKEN(op)                                                            \
+  if (ins->deopts < HS_MAX_DEOPTS)                                             \
+  {                                                                            \
+    ((hs_instruction *)ins)->opcode  = (op);                                   \
+    ((hs_instruction *)ins)->handler = HANDLER(op);                            \
+  }
+
+/* The guard of quickened opcodes, both operands must have the type t */
+#define GUARD(t)                                                               \
+  if (HS_TAG(REG_B) != (t) || HS_TAG(REG_C) != (t)) goto deopt
+
+#define IS_NUMBER(obj)                                                         \
+  (HS_TAG(obj) == HS_OBJECT_FIXINT || HS_TAG(obj) == HS_OBJECT_FLOAT)
+#define AS_FLOAT(obj)                                                          \
+  (HS_TAG(obj) == HS_OBJECT_FLOAT ? HS_AS_FLOAT(obj) :                         \
+                                    (hs_float)HS_AS_INT(obj))
+
+/* <reg> <- int : <reg> / <reg>, on two FIXINTs, the same as HS_OP_INT_DIV */
+#define INT_DIV_TO(dst, x, y)                                                  \
+  if (HS_AS_INT(y) == 0)                                                       \
+  { error_code = HS_VM_ERROR_ZERO_DIVISION; goto fail; }                       \
+  if (HS_AS_INT(y) != -1)                                                      \
+    SET_INT(dst, HS_AS_INT(x) / HS_AS_INT(y));                                 \
+  else if (HS_AS_INT(x) != INT32_MIN)                                          \
+    SET_INT(dst, -HS_AS_INT(x));                                               \
+  else                                                                         \
+    INTEGER_OP(dst, x, y, HS_INTEGER_DIV)
+
+/* <reg> <- <reg> op <reg>, on ints of any size, floats or a mix of ints
+ * and floats (as floats) */
+#define GENERIC_BINOP(name, op)                                                \
+  CHECK_ABC;                                                                   \
+  if (HS_TAG(REG_B) == HS_OBJECT_FIXINT && HS_TAG(REG_C) == HS_OBJECT_FIXINT)  \
+  {                                                                            \
+    hs_int r_;                                                                 \
+    QUICKEN(HS_OP_##name##_INT);                                               \
+    if (!INT_##name##_OVERFLOWS(HS_AS_INT(REG_B), HS_AS_INT(REG_C), &r_))      \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+      INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_##name);                      \
+  }                                                                            \
+  else if (HS_TAG(REG_B) == HS_OBJECT_FLOAT &&                                 \
+           HS_TAG(REG_C) == HS_OBJECT_FLOAT)                                   \
+  {                                                                            \
+    QUICKEN(HS_OP_##name##_FLOAT);                                             \
+    SET_FLOAT(REG_A, HS_AS_FLOAT(REG_B) op HS_AS_FLOAT(REG_C));                \
+  }                                                                            \
+  else if (IS_INTEGER(REG_B) && IS_INTEGER(REG_C))                             \
+    INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_##name);                        \
+  else if (IS_NUMBER(REG_B) && IS_NUMBER(REG_C))                               \
+    SET_FLOAT(REG_A, AS_FLOAT(REG_B) op AS_FLOAT(REG_C));                      \
+  else                                                                         \
+  { error_code = HS_VM_ERROR_TYPE; goto fail; }                                \
+  HS_VM_NEXT()
+
+/* The registers were checked by the generic opcode, only the types change */
+#define QUICK_INT_ARITH(name)                                                  \
+  GUARD(HS_OBJECT_FIXINT);                                                     \
+  INT_ARITH_UNCHECKED(name)
+
+#define QUICK_FLOAT_BINOP(op)                                                  \
+  GUARD(HS_OBJECT_FLOAT);                                                      \
+  SET_FLOAT(REG_A, HS_AS_FLOAT(REG_B) op HS_AS_FLOAT(REG_C));                  \
+  HS_VM_NEXT()
+
+/* <reg> <- context [ <uint16> ] <- <reg> op 1, then skips the fused opcodes */
+#define LOCAL_INT_STEP(name)                                                   \
+  {                                                                            \
+    hs_object *slot;                                                           \
+    hs_int     r_;                                                             \
+    CHECK_A;                                                                   \
+    slot = context_slot(frame->context, IMM);                                  \
+    if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }                  \
+    REG_A = *slot;                                                             \
+    if (HS_TAG(REG_A) == HS_OBJECT_FIXINT &&                                   \
+        !INT_##name##_OVERFLOWS(HS_AS_INT(REG_A), 1, &r_))                     \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+    {                                                                          \
+      hs_object one_;                                                          \
+      SET_INT(one_, 1);                                                        \
+      INTEGER_OP(REG_A, REG_A, one_, HS_INTEGER_##name);                       \
+    }                                                                          \
+    *slot = REG_A;                                                             \
+    pc += 2;                                                                   \
+    HS_VM_NEXT();                                                              \
+  }
+
+/* <reg> <- <reg> <=> <reg>, if it is op 0 then jump( <uint16> ) */
+#define INT_JUMP(op)                                                           \
+  CHECK_ABC;                                                                   \
+  if (HS_TAG(REG_A) == HS_OBJECT_FIXINT && HS_TAG(REG_B) == HS_OBJECT_FIXINT)  \
+    SET_INT(REG_C, CMP(HS_AS_INT(REG_A), HS_AS_INT(REG_B)));                   \
+  else                                                                         \
+    INTEGER_OP(REG_C, REG_A, REG_B, HS_INTEGER_CMP);                           \
+  if (HS_AS_INT(REG_C) op 0) JUMP_TO(IMM);                                     \
+  else pc += 1;                                                                \
+  HS_VM_NEXT()
+
+/* The forms proved safe by verify_function(), the registers are in the
+ * window, the operands have their types and the jump targets exist. A
+ * register proved to be a FIXINT never holds a BIGINT here: the only way
+ * one comes in is integer_op(), which moves the function back to the
+ * checked forms first */
+#define INT_ARITH_UNCHECKED(name)                                              \
+  {                                                                            \
+    hs_int r_;                                                                 \
+    if (!INT_##name##_OVERFLOWS(HS_AS_INT(REG_B), HS_AS_INT(REG_C), &r_))      \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+      INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_##name);                      \
+  }                                                                            \
+  HS_VM_NEXT()
+
+#define INT_STEP_UNCHECKED(name)                                               \
+  {                                                                            \
+    hs_int r_;                                                                 \
+    if (!INT_##name##_OVERFLOWS(HS_AS_INT(REG_A), 1, &r_))                     \
+      SET_INT(REG_A, r_);                                                      \
+    else                                                                       \
+    {                                                                          \
+      hs_object one_;                                                          \
+      SET_INT(one_, 1);                                                        \
+      INTEGER_OP(REG_A, REG_A, one_, HS_INTEGER_##name);                       \
+    }                                                                          \
+  }                                                                            \
+  HS_VM_NEXT()
+
+#define INT_BINOP_UNCHECKED(op)                                                \
+  SET_INT(REG_A, (hs_int)( (uint32_t)HS_AS_INT(REG_B) op                       \
+                           (uint32_t)HS_AS_INT(REG_C) ));                      \
+  HS_VM_NEXT()
+
+#define FLOAT_BINOP_UNCHECKED(op)                                              \
+  SET_FLOAT(REG_A, HS_AS_FLOAT(REG_B) op HS_AS_FLOAT(REG_C));                  \
+  HS_VM_NEXT()
+
+#define JUMP_ZERO_UNCHECKED(op)                                                \
+  if (HS_AS_INT(REG_A) op 0)                                                   \
+  {                                                                            \
+    if (IS_BACKWARD(IMM)) BACK_EDGE(IMM);                                      \
+    pc = frame->function->instructions + IMM;                                  \
+  }                                                                            \
+  HS_VM_NEXT()
+
+#define INT_JUMP_UNCHECKED(op)                                                 \
+  SET_INT(REG_C, CMP(HS_AS_INT(REG_A), HS_AS_INT(REG_B)));                     \
+  if (HS_AS_INT(REG_C) op 0)                                                   \
+  {                                                                            \
+    if (IS_BACKWARD(IMM)) BACK_EDGE(IMM);                                      \
+    pc = frame->function->instructions + IMM;                                  \
+  }                                                                            \
+  else pc += 1;                                                                \
+  HS_VM_NEXT()
+
+int
+hs_vm_run(hs_state *state, hs_function *fn, hs_object *result)
+{
+  return run_loop(state, fn, result, NULL);
+}
+
+/**
+ * @brief the dispatch loop of the virtual machine.
+ *
+ * Labels only exist inside their own function, so the loop is also the one
+ * giving the handler addresses to decode_function().
+ *
+ * @param state The state used to run the code.
+ * @param fn The function to run.
+ * @param result A place to store the returned value. Can be NULL.
+ * @param handlers If not NULL, receives the handler table and nothing runs.
+ * @return A non zero value on error, zero if the function succeeds
+ */
+static int
+run_loop(hs_state *state, hs_function *fn, hs_object *result,
+         const void *const **handlers)
+{
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+  /* Every opcode starts as invalid, then the handled ones override it */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+  static const void *const labels[HS_OPCODE_COUNT] = {
+    [0 ... HS_OPCODE_COUNT - 1] = &&L_INVALID,
+    HS_VM_OPCODES(HS_VM_LABEL)
+  };
+#pragma GCC diagnostic pop
+#endif
+  hs_frame             *base, *frame, *callee_frame;
+  hs_object            *regs;
+  hs_call_site         *site;
+  size_t                tries_base, bottom, arg0, argc, call_bottom, at;
+  const hs_instruction *pc, *ins;
+  hs_instruction       *edge = NULL;
+  hs_jit_entry          entry = NULL;
+  hs_object             value, callee, self, key;
+  int                   error_code;
+  uint8_t               dst;
+  size_t                i;
+
+  if (handlers)
+  {
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+    *handlers = labels;
+#endif
+    return 0;
+  }
+  base       = state->frame;
+  tries_base = state->tries_size;
+  bottom     = state->registers_size;
+  frame = frame_push(state, base, fn, NULL);
+  if (!frame) return 1;
+  if (window_open(state, frame, bottom, 0))
+  {
+    frame_pop(state);
+    return 1;
+  }
+  frame->bottom = bottom;
+  frame->tries  = tries_base;
+  state->frame  = frame;
+  SYNC_REGS();
+  pc  = fn->instructions;
+  ins = NULL;
+  goto do_enter;
+
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+  {
+#else
+dispatch:
+  HS_VM_COUNT(pc);
+  ins = pc++;
+  {
+    switch (ins->opcode)
+    {
+#endif
+
+    HS_VM_CASE(HS_OP_NOP)
+    HS_VM_CASE(HS_OP_BREAKPOINT)
+    /* Only reached by jumping over the instruction that owns it */
+    HS_VM_CASE(HS_OP_EXTRA_ARG)
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_HALT)
+      HS_SET_NULL(value);
+      goto finish;
+
+    HS_VM_CASE(HS_OP_LOAD_NULL)
+      CHECK_A;
+      HS_SET_NULL(REG_A);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_FALSE)
+      CHECK_A;
+      SET_BOOL(REG_A, 0);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_TRUE)
+      CHECK_A;
+      SET_BOOL(REG_A, 1);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_ARG_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      if ((size_t)HS_AS_INT(REG_B) < frame->argc)
+        REG_A = regs[HS_AS_INT(REG_B)];
+      else
+        HS_SET_NULL(REG_A);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_ARG)
+      CHECK_A;
+      if ((size_t)IMM < frame->argc)
+        REG_A = regs[IMM];
+      else
+        HS_SET_NULL(REG_A);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_LOCAL)
+    {
+      hs_object *slot;
+      CHECK_A;
+      slot = context_slot(frame->context, IMM);
+      if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_A = *slot;
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_LOAD_LOCAL_INDIRECT)
+    {
+      hs_object *slot;
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      slot = context_slot(frame->context, (uint32_t)HS_AS_INT(REG_B));
+      if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_A = *slot;
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_LOAD_LOCAL_CONST)
+      CHECK_A;
+      if ((uint32_t)IMM >= frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_A = frame->function->module->constants[IMM];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_LOCAL_CONST_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      if ((uint32_t)HS_AS_INT(REG_B) >=
+          frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_A = frame->function->module->constants[HS_AS_INT(REG_B)];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_INT_CONST)
+      CHECK_A;
+      SET_INT(REG_A, IMM);
+      HS_VM_NEXT();
+
+    /* The wide loads got their operand from the next HS_OP_EXTRA_ARG */
+    HS_VM_CASE(HS_OP_LOAD_CONST_WIDE)
+      CHECK_A;
+      if ((uint32_t)IMM >= frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_A = frame->function->module->constants[IMM];
+      ++pc;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_INT_WIDE)
+      CHECK_A;
+      SET_INT(REG_A, IMM);
+      ++pc;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STORE_LOCAL)
+    {
+      hs_object *slot;
+      CHECK_A;
+      slot = context_slot(frame->context, IMM);
+      if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      *slot = REG_A;
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_STORE_LOCAL_INDIRECT)
+    {
+      hs_object *slot;
+      CHECK_AB;
+      EXPECT(REG_A, HS_OBJECT_FIXINT);
+      slot = context_slot(frame->context, (uint32_t)HS_AS_INT(REG_A));
+      if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      *slot = REG_B;
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_MOVE)
+      CHECK_AB;
+      REG_A = REG_B;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STACK_POP)
+      CHECK_A;
+      if (state->stack_size == 0)
+      { error_code = HS_VM_ERROR_STACK; goto fail; }
+      REG_A = state->stack[--state->stack_size];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STACK_PUSH)
+      CHECK_A;
+      if (grow_buffer((void **)&state->stack, &state->stack_capa,
+                      state->stack_size + 1, sizeof(hs_object)))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      state->stack[state->stack_size++] = REG_A;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STACK_PEEK)
+      CHECK_A;
+      if (state->stack_size == 0)
+      { error_code = HS_VM_ERROR_STACK; goto fail; }
+      REG_A = state->stack[state->stack_size - 1];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STACK_DUP)
+      if (state->stack_size == 0)
+      { error_code = HS_VM_ERROR_STACK; goto fail; }
+      if (grow_buffer((void **)&state->stack, &state->stack_capa,
+                      state->stack_size + 1, sizeof(hs_object)))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      state->stack[state->stack_size] = state->stack[state->stack_size - 1];
+      state->stack_size += 1;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_JUMP)
+      JUMP_TO(IMM);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_JUMP_EQ_REG) JUMP_REG(==);
+    HS_VM_CASE(HS_OP_JUMP_NE_REG) JUMP_REG(!=);
+    HS_VM_CASE(HS_OP_JUMP_LT_REG) JUMP_REG(<);
+    HS_VM_CASE(HS_OP_JUMP_LE_REG) JUMP_REG(<=);
+    HS_VM_CASE(HS_OP_JUMP_GT_REG) JUMP_REG(>);
+    HS_VM_CASE(HS_OP_JUMP_GE_REG) JUMP_REG(>=);
+
+    HS_VM_CASE(HS_OP_JUMP_EQ_ZERO) JUMP_ZERO(==);
+    HS_VM_CASE(HS_OP_JUMP_NE_ZERO) JUMP_ZERO(!=);
+    HS_VM_CASE(HS_OP_JUMP_LT_ZERO) JUMP_ZERO(<);
+    HS_VM_CASE(HS_OP_JUMP_LE_ZERO) JUMP_ZERO(<=);
+    HS_VM_CASE(HS_OP_JUMP_GT_ZERO) JUMP_ZERO(>);
+    HS_VM_CASE(HS_OP_JUMP_GE_ZERO) JUMP_ZERO(>=);
+
+    HS_VM_CASE(HS_OP_JUMP_INDIRECT)
+      CHECK_A;
+      EXPECT(REG_A, HS_OBJECT_FIXINT);
+      JUMP_TO((uint32_t)HS_AS_INT(REG_A));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_JUMP_EQ_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(==);
+    HS_VM_CASE(HS_OP_JUMP_NE_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(!=);
+    HS_VM_CASE(HS_OP_JUMP_LT_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(<);
+    HS_VM_CASE(HS_OP_JUMP_LE_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(<=);
+    HS_VM_CASE(HS_OP_JUMP_GT_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(>);
+    HS_VM_CASE(HS_OP_JUMP_GE_ZERO_INDIRECT) JUMP_ZERO_INDIRECT(>=);
+
+    HS_VM_CASE(HS_OP_RETURN)
+      CHECK_A;
+      value = REG_A;
+      goto do_return;
+
+    HS_VM_CASE(HS_OP_RETURN_NULL)
+    HS_VM_CASE(HS_OP_END_BYTECODE)
+      HS_SET_NULL(value);
+      goto do_return;
+
+    HS_VM_CASE(HS_OP_RETURN_SELF)
+      value = frame->self;
+      goto do_return;
+
+    HS_VM_CASE(HS_OP_TAIL_CALL)
+      CHECK_A;
+      self   = frame->self;
+      callee = REG_A;
+      goto do_tail_call;
+
+    HS_VM_CASE(HS_OP_TAIL_LOCAL_CALL)
+      CHECK_A;
+      self   = frame->module;
+      callee = REG_A;
+      goto do_tail_call;
+
+    HS_VM_CASE(HS_OP_TAIL_DYNAMIC_CALL)
+      CHECK_AB;
+      self   = REG_A;
+      callee = REG_B;
+      goto do_tail_call;
+
+    HS_VM_CASE(HS_OP_RESERVE_ARGS)
+      HS_SET_INT(value, IMM);
+      goto do_reserve;
+
+    HS_VM_CASE(HS_OP_RESERVE_ARGS_INDIRECT)
+      CHECK_A;
+      EXPECT(REG_A, HS_OBJECT_FIXINT);
+      if (HS_AS_INT(REG_A) < 0)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      value = REG_A;
+      goto do_reserve;
+
+    HS_VM_CASE(HS_OP_SET_ARG)
+      CHECK_A;
+      if ((size_t)IMM >= pending_argc(state))
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      state->registers[state->args_base + IMM] = REG_A;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_SET_ARG_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_A, HS_OBJECT_FIXINT);
+      if ((uint32_t)HS_AS_INT(REG_A) >= pending_argc(state))
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      state->registers[state->args_base + HS_AS_INT(REG_A)] = REG_B;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_CALL)
+      CHECK_AB;
+      self   = frame->self;
+      callee = REG_B;
+      dst    = ins->a;
+      goto do_call;
+
+    HS_VM_CASE(HS_OP_LOCAL_CALL)
+      CHECK_AB;
+      self   = frame->module;
+      callee = REG_B;
+      dst    = ins->a;
+      goto do_call;
+
+    HS_VM_CASE(HS_OP_DYNAMIC_CALL)
+      CHECK_ABC;
+      self   = REG_B;
+      callee = REG_C;
+      dst    = ins->a;
+      goto do_call;
+
+    HS_VM_CASE(HS_OP_CALL_SITE)
+    HS_VM_CASE(HS_OP_LOCAL_CALL_SITE)
+    HS_VM_CASE(HS_OP_DYNAMIC_CALL_SITE)
+      CHECK_A;
+      if ((uint32_t)IMM >= frame->function->module->call_site_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      site = frame->function->module->call_sites + IMM;
+      CHECK_REG(site->callee);
+      CHECK_REG(site->self);
+      if ((size_t)site->args + site->argc > frame->size)
+      { error_code = HS_VM_ERROR_REGISTER; goto fail; }
+      if (ins->opcode == HS_OP_CALL_SITE)
+        self = frame->self;
+      else if (ins->opcode == HS_OP_LOCAL_CALL_SITE)
+        self = frame->module;
+      else
+        self = regs[site->self];
+      callee = regs[site->callee];
+      dst    = ins->a;
+      goto do_site_call;
+
+    HS_VM_CASE(HS_OP_SET_THIS)
+      CHECK_A;
+      frame->self = REG_A;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_SET_MODULE)
+      CHECK_A;
+      frame->module = REG_A;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_GET_THIS)
+      CHECK_A;
+      REG_A = frame->self;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_GET_MODULE)
+      CHECK_A;
+      REG_A = frame->module;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOAD_FIELD)
+      CHECK_A;
+      if ((uint32_t)IMM >= frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      self = frame->self;
+      key  = frame->function->module->constants[IMM];
+      dst  = ins->a;
+      goto do_get_field;
+
+    HS_VM_CASE(HS_OP_LOAD_FIELD_INDIRECT)
+      CHECK_ABC;
+      self = REG_B;
+      key  = REG_C;
+      dst  = ins->a;
+      goto do_get_field;
+
+    HS_VM_CASE(HS_OP_STORE_FIELD)
+      CHECK_A;
+      if ((uint32_t)IMM >= frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      self  = frame->self;
+      key   = frame->function->module->constants[IMM];
+      value = REG_A;
+      goto do_set_field;
+
+    HS_VM_CASE(HS_OP_STORE_FIELD_INDIRECT)
+      CHECK_ABC;
+      self  = REG_A;
+      key   = REG_B;
+      value = REG_C;
+      goto do_set_field;
+
+    HS_VM_CASE(HS_OP_NEW)
+    {
+      hs_instance *obj;
+      CHECK_A;
+      obj = hs_instance_new(state->shapes);
+      if (!obj) { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_SET_INSTANCE(REG_A, obj);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_EXTEND)
+    {
+      hs_instance *obj;
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_INSTANCE);
+      obj = hs_instance_extend(state->shapes, HS_AS_INSTANCE(REG_B));
+      if (!obj) { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_SET_INSTANCE(REG_A, obj);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_ARRAY_NEW)
+      CHECK_A;
+      if (hs_elements_new(&state->area, &REG_A, IMM))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_ARRAY_NEW_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      if (HS_AS_INT(REG_B) < 0) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      if (hs_elements_new(&state->area, &REG_A, (size_t)HS_AS_INT(REG_B)))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+
+    /* The packed kinds are read and written in place, tagging and untagging
+     * on the way. Anything else goes through hs_elements_set() */
+
+    HS_VM_CASE(HS_OP_ARRAY_GET)
+    {
+      hs_elements *el;
+      CHECK_ABC;
+      if (HS_TAG(REG_B) == HS_OBJECT_RANGE) goto do_range_get;
+      EXPECT(REG_B, HS_OBJECT_ARRAY);
+      EXPECT(REG_C, HS_OBJECT_FIXINT);
+      el = &HS_AS_BOX(REG_B)->value.as_array;
+      i  = (size_t)(uint32_t)HS_AS_INT(REG_C);
+      if (i >= el->size) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      switch (el->kind)
+      {
+        case HS_ELEMENTS_INT:   SET_INT(REG_A, el->data.as_int[i]);     break;
+        case HS_ELEMENTS_FLOAT: SET_FLOAT(REG_A, el->data.as_float[i]); break;
+        default:                REG_A = el->data.as_object[i];          break;
+      }
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_ARRAY_SET)
+    {
+      hs_elements *el;
+      CHECK_ABC;
+      EXPECT(REG_A, HS_OBJECT_ARRAY);
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      el = &HS_AS_BOX(REG_A)->value.as_array;
+      i  = (size_t)(uint32_t)HS_AS_INT(REG_B);
+      if (i < el->size)
+      {
+        if (el->kind == HS_ELEMENTS_INT && HS_TAG(REG_C) == HS_OBJECT_FIXINT)
+        {
+          el->data.as_int[i] = HS_AS_INT(REG_C);
+          HS_VM_NEXT();
+        }
+        if (el->kind == HS_ELEMENTS_FLOAT && HS_TAG(REG_C) == HS_OBJECT_FLOAT)
+        {
+          el->data.as_float[i] = HS_AS_FLOAT(REG_C);
+          HS_VM_NEXT();
+        }
+        if (el->kind == HS_ELEMENTS_GENERIC)
+        {
+          el->data.as_object[i] = REG_C;
+          HS_VM_NEXT();
+        }
+      }
+      else if (i > el->size) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      if (hs_elements_set(el, i, REG_C))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_ARRAY_DELETE)
+      CHECK_AB;
+      EXPECT(REG_A, HS_OBJECT_ARRAY);
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      if (hs_elements_remove(&HS_AS_BOX(REG_A)->value.as_array,
+                             (size_t)(uint32_t)HS_AS_INT(REG_B)))
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_RANGE_NEW)
+    HS_VM_CASE(HS_OP_RANGE_NEW_EXCLUSIVE)
+    {
+      hs_range r;
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      EXPECT(REG_C, HS_OBJECT_FIXINT);
+      if (hs_range_init(&r, HS_AS_INT(REG_B), HS_AS_INT(REG_C),
+                        ins->opcode == HS_OP_RANGE_NEW_EXCLUSIVE))
+      { error_code = HS_VM_ERROR_RANGE; goto fail; }
+      if (hs_range_new(&state->area, &REG_A, &r))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_RANGE_STEP)
+    {
+      hs_range r;
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_RANGE);
+      EXPECT(REG_C, HS_OBJECT_FIXINT);
+      r = HS_AS_BOX(REG_B)->value.as_range;
+      if (hs_range_step(&r, HS_AS_INT(REG_C)))
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      if (hs_range_new(&state->area, &REG_A, &r))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_RANGE_INCLUDES)
+    {
+      const hs_range *r;
+      int64_t         distance;
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_RANGE);
+      r = &HS_AS_BOX(REG_B)->value.as_range;
+      if (HS_TAG(REG_C) != HS_OBJECT_FIXINT)
+        SET_BOOL(REG_A, 0);
+      else if (r->step == 1)
+      {
+        /* a..b and a...b take two comparisons */
+        distance = (int64_t)HS_AS_INT(REG_C) - r->first;
+        SET_BOOL(REG_A, distance >= 0 && distance < r->size);
+      }
+      else
+        SET_BOOL(REG_A, hs_range_includes(r, HS_AS_INT(REG_C)));
+      HS_VM_NEXT();
+    }
+
+    /* a gets the element of b at c, then c moves to the next one and the
+     * opcode after this one, the jump out of the loop, is skipped. Once
+     * there are no more elements that jump runs */
+    HS_VM_CASE(HS_OP_FOR_IN)
+    {
+      hs_object value;
+      hs_int    at;
+      CHECK_ABC;
+      EXPECT(REG_C, HS_OBJECT_FIXINT);
+      at = HS_AS_INT(REG_C);
+      if (HS_TAG(REG_B) == HS_OBJECT_RANGE)
+      {
+        const hs_range *r = &HS_AS_BOX(REG_B)->value.as_range;
+        if (at < 0 || at >= r->size) HS_VM_NEXT();
+        SET_INT(value, (hs_int)( r->first + at * r->step ));
+      }
+      else
+      {
+        EXPECT(REG_B, HS_OBJECT_ARRAY);
+        if (at < 0 ||
+            hs_elements_get(&HS_AS_BOX(REG_B)->value.as_array, (size_t)at,
+                            &value))
+          HS_VM_NEXT();
+      }
+      /* A range has at most INT32_MAX elements, so at + 1 is still an hs_int
+       * after the last one, and the loop ends instead of wrapping */
+      SET_INT(REG_C, (hs_int)( (uint32_t)at + 1u ));
+      REG_A = value;
+      pc += 1;
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_BOOL_AND) BOOL_BINOP(&);
+    HS_VM_CASE(HS_OP_BOOL_OR)  BOOL_BINOP(|);
+    HS_VM_CASE(HS_OP_BOOL_XOR) BOOL_BINOP(^);
+
+    HS_VM_CASE(HS_OP_BOOL_CMP)
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_BOOLEAN);
+      EXPECT(REG_C, HS_OBJECT_BOOLEAN);
+      SET_INT(REG_A, CMP(HS_AS_INT(REG_B), HS_AS_INT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_BOOL_NOT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_BOOLEAN);
+      SET_BOOL(REG_A, !HS_AS_INT(REG_B));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_ADD) INT_ARITH(ADD);
+    HS_VM_CASE(HS_OP_INT_SUB) INT_ARITH(SUB);
+    HS_VM_CASE(HS_OP_INT_MUL) INT_ARITH(MUL);
+    HS_VM_CASE(HS_OP_INT_AND) INT_BINOP(AND, &);
+    HS_VM_CASE(HS_OP_INT_OR)  INT_BINOP(OR, |);
+    HS_VM_CASE(HS_OP_INT_XOR) INT_BINOP(XOR, ^);
+
+    HS_VM_CASE(HS_OP_INT_DIV)
+    HS_VM_CASE(HS_OP_INT_MOD)
+    HS_VM_CASE(HS_OP_INT_REM)
+    {
+      hs_int x, y, r;
+      CHECK_ABC;
+      if (HS_TAG(REG_C) == HS_OBJECT_FIXINT && HS_AS_INT(REG_C) == 0)
+      { error_code = HS_VM_ERROR_ZERO_DIVISION; goto fail; }
+      /* INT32_MIN / -1 leaves hs_int, so it is not done here either */
+      if (HS_TAG(REG_B) != HS_OBJECT_FIXINT ||
+          HS_TAG(REG_C) != HS_OBJECT_FIXINT ||
+          ( HS_AS_INT(REG_B) == INT32_MIN && HS_AS_INT(REG_C) == -1 ))
+      {
+        INTEGER_OP(REG_A, REG_B, REG_C,
+                   ins->opcode == HS_OP_INT_DIV ? HS_INTEGER_DIV :
+                   ins->opcode == HS_OP_INT_MOD ? HS_INTEGER_MOD :
+                                                  HS_INTEGER_REM);
+        HS_VM_NEXT();
+      }
+      x = HS_AS_INT(REG_B);
+      y = HS_AS_INT(REG_C);
+      r = x % y;
+      if (ins->opcode == HS_OP_INT_DIV)
+        SET_INT(REG_A, x / y);
+      else if (ins->opcode == HS_OP_INT_MOD && r != 0 && ((r < 0) != (y < 0)))
+        SET_INT(REG_A, r + y);
+      else
+        SET_INT(REG_A, r);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_INT_SHL)
+    HS_VM_CASE(HS_OP_INT_LSL)
+    {
+      int64_t wide;
+      CHECK_ABC;
+      EXPECT_COUNT(REG_C);
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT && HS_AS_INT(REG_C) < 32)
+      {
+        /* A shift by less than 32 never leaves an int64 */
+        wide = (int64_t)HS_AS_INT(REG_B) * ( (int64_t)1 << HS_AS_INT(REG_C) );
+        if (wide >= INT32_MIN && wide <= INT32_MAX)
+        {
+          SET_INT(REG_A, (hs_int)wide);
+          HS_VM_NEXT();
+        }
+      }
+      INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_SHL);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_INT_SHR)
+    {
+      hs_int x, n;
+      CHECK_ABC;
+      EXPECT_COUNT(REG_C);
+      if (HS_TAG(REG_B) != HS_OBJECT_FIXINT ||
+          HS_TAG(REG_C) != HS_OBJECT_FIXINT)
+      {
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_SHR);
+        HS_VM_NEXT();
+      }
+      x = HS_AS_INT(REG_B);
+      /* Shifting 31 bits or more only leaves the sign */
+      n = HS_AS_INT(REG_C) < 31 ? HS_AS_INT(REG_C) : 31;
+      /* right shifts of negative numbers are implementation defined, and
+       * ~(~x >> n) rounds down the same way */
+      if (x < 0)
+        SET_INT(REG_A, (hs_int)~( ~(uint32_t)x >> n ));
+      else
+        SET_INT(REG_A, x >> n);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_INT_LSR)
+      CHECK_ABC;
+      EXPECT_COUNT(REG_C);
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT)
+        SET_INT(REG_A, HS_AS_INT(REG_C) > 31 ? 0 :
+                       (hs_int)( (uint32_t)HS_AS_INT(REG_B) >>
+                                 HS_AS_INT(REG_C) ));
+      else
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_LSR);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_CMP)
+      CHECK_ABC;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT)
+        SET_INT(REG_A, CMP(HS_AS_INT(REG_B), HS_AS_INT(REG_C)));
+      else
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_CMP);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_NEG)
+      CHECK_AB;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT && HS_AS_INT(REG_B) != INT32_MIN)
+        SET_INT(REG_A, -HS_AS_INT(REG_B));
+      else
+      {
+        hs_object zero;
+        SET_INT(zero, 0);
+        INTEGER_OP(REG_A, zero, REG_B, HS_INTEGER_SUB);
+      }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_CPL)
+      CHECK_AB;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT)
+        SET_INT(REG_A, ~HS_AS_INT(REG_B));
+      else
+      {
+        /* ~x is -1 - x on two's complement */
+        hs_object minus_one;
+        SET_INT(minus_one, -1);
+        INTEGER_OP(REG_A, minus_one, REG_B, HS_INTEGER_SUB);
+      }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_POW)
+    {
+      hs_int r;
+      CHECK_ABC;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT &&
+          !int_pow(HS_AS_INT(REG_B), HS_AS_INT(REG_C), &r))
+        SET_INT(REG_A, r);
+      else
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_POW);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_FLOAT_ADD) FLOAT_BINOP(+);
+    HS_VM_CASE(HS_OP_FLOAT_SUB) FLOAT_BINOP(-);
+    HS_VM_CASE(HS_OP_FLOAT_MUL) FLOAT_BINOP(*);
+    HS_VM_CASE(HS_OP_FLOAT_DIV) FLOAT_BINOP(/);
+
+    HS_VM_CASE(HS_OP_FLOAT_SQRT) FLOAT_UNARY(sqrtf);
+    HS_VM_CASE(HS_OP_FLOAT_EXP)  FLOAT_UNARY(expf);
+    HS_VM_CASE(HS_OP_FLOAT_LOG2) FLOAT_UNARY(log2f);
+    HS_VM_CASE(HS_OP_FLOAT_LOG)  FLOAT_UNARY(log10f);
+    HS_VM_CASE(HS_OP_FLOAT_LN)   FLOAT_UNARY(logf);
+    HS_VM_CASE(HS_OP_FLOAT_SIN)  FLOAT_UNARY(sinf);
+    HS_VM_CASE(HS_OP_FLOAT_COS)  FLOAT_UNARY(cosf);
+    HS_VM_CASE(HS_OP_FLOAT_TAN)  FLOAT_UNARY(tanf);
+    HS_VM_CASE(HS_OP_FLOAT_ASIN) FLOAT_UNARY(asinf);
+    HS_VM_CASE(HS_OP_FLOAT_ACOS) FLOAT_UNARY(acosf);
+    HS_VM_CASE(HS_OP_FLOAT_ATAN) FLOAT_UNARY(atanf);
+    HS_VM_CASE(HS_OP_FLOAT_NEG)  FLOAT_UNARY(-);
+
+    HS_VM_CASE(HS_OP_FLOAT_POW)
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_FLOAT);
+      EXPECT(REG_C, HS_OBJECT_FLOAT);
+      SET_FLOAT(REG_A, powf(HS_AS_FLOAT(REG_B), HS_AS_FLOAT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_FLOAT_ATAN2)
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_FLOAT);
+      EXPECT(REG_C, HS_OBJECT_FLOAT);
+      SET_FLOAT(REG_A, atan2f(HS_AS_FLOAT(REG_B), HS_AS_FLOAT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_FLOAT_CMP)
+      CHECK_ABC;
+      EXPECT(REG_B, HS_OBJECT_FLOAT);
+      EXPECT(REG_C, HS_OBJECT_FLOAT);
+      SET_INT(REG_A, CMP(HS_AS_FLOAT(REG_B), HS_AS_FLOAT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_BOOL2INT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_BOOLEAN);
+      SET_INT(REG_A, HS_AS_INT(REG_B));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT2BOOL)
+      CHECK_AB;
+      EXPECT_INTEGER(REG_B);
+      SET_BOOL(REG_A, INTEGRAL_SIGN(REG_B));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT2FLOAT)
+      CHECK_AB;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT)
+        SET_FLOAT(REG_A, (hs_float)HS_AS_INT(REG_B));
+      else
+      {
+        EXPECT(REG_B, HS_OBJECT_BIGINT);
+        SET_FLOAT(REG_A, hs_integer_to_float(REG_B));
+      }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_FLOAT2INT)
+    {
+      hs_float f;
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FLOAT);
+      f = HS_AS_FLOAT(REG_B);
+      /* converting a float outside the range of hs_int is undefined */
+      if (!(f > -2147483648.0f && f < 2147483648.0f))
+      { error_code = HS_VM_ERROR_TYPE; goto fail; }
+      SET_INT(REG_A, (hs_int)f);
+      HS_VM_NEXT();
+    }
+
+    HS_VM_CASE(HS_OP_NEW_TRY_CONTEXT)
+      CHECK_TARGET(IMM);
+      HS_SET_INT(value, IMM);
+      goto do_try;
+
+    HS_VM_CASE(HS_OP_NEW_TRY_CONTEXT_INDIRECT)
+      CHECK_A;
+      EXPECT(REG_A, HS_OBJECT_FIXINT);
+      CHECK_TARGET((uint32_t)HS_AS_INT(REG_A));
+      value = REG_A;
+      goto do_try;
+
+    HS_VM_CASE(HS_OP_NEW_TRY_CONTEXT_NO_FINAL)
+      HS_SET_NULL(value);
+      goto do_try;
+
+    HS_VM_CASE(HS_OP_ADD_CATCH)
+      CHECK_A;
+      value = REG_A;
+      HS_SET_INT(callee, IMM);
+      goto do_catch;
+
+    HS_VM_CASE(HS_OP_ADD_CATCH_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      value  = REG_A;
+      callee = REG_B;
+      goto do_catch;
+
+    HS_VM_CASE(HS_OP_THROW)
+      CHECK_A;
+      value = REG_A;
+      goto do_throw;
+
+    HS_VM_CASE(HS_OP_END_TRY_CONTEXT)
+      if (state->tries_size <= frame->tries)
+      { error_code = HS_VM_ERROR_STACK; goto fail; }
+      state->tries_size -= 1;
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_INC) INT_STEP(ADD);
+    HS_VM_CASE(HS_OP_INT_DEC) INT_STEP(SUB);
+
+    HS_VM_CASE(HS_OP_FLOAT_INC)
+      CHECK_A;
+      EXPECT(REG_A, HS_OBJECT_FLOAT);
+      SET_FLOAT(REG_A, HS_AS_FLOAT(REG_A) + 1);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_FLOAT_DEC)
+      CHECK_A;
+      EXPECT(REG_A, HS_OBJECT_FLOAT);
+      SET_FLOAT(REG_A, HS_AS_FLOAT(REG_A) - 1);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_DECLARE_FUNCTION)
+      CHECK_A;
+      dst = ins->a;
+      i   = IMM;
+      goto do_declare;
+
+    HS_VM_CASE(HS_OP_DECLARE_FUNCTION_INDIRECT)
+      CHECK_AB;
+      EXPECT(REG_B, HS_OBJECT_FIXINT);
+      dst = ins->a;
+      i   = (uint32_t)HS_AS_INT(REG_B);
+      goto do_declare;
+
+    /* Superinstructions, created by fuse_function() */
+
+    HS_VM_CASE(HS_OP_LOCAL_INT_INC) LOCAL_INT_STEP(ADD);
+    HS_VM_CASE(HS_OP_LOCAL_INT_DEC) LOCAL_INT_STEP(SUB);
+
+    HS_VM_CASE(HS_OP_INT_JUMP_EQ) INT_JUMP(==);
+    HS_VM_CASE(HS_OP_INT_JUMP_NE) INT_JUMP(!=);
+    HS_VM_CASE(HS_OP_INT_JUMP_LT) INT_JUMP(<);
+    HS_VM_CASE(HS_OP_INT_JUMP_LE) INT_JUMP(<=);
+    HS_VM_CASE(HS_OP_INT_JUMP_GT) INT_JUMP(>);
+    HS_VM_CASE(HS_OP_INT_JUMP_GE) INT_JUMP(>=);
+
+    /* Unchecked forms, chosen by verify_function() */
+
+    HS_VM_CASE(HS_OP_INT_ADD_UNCHECKED) INT_ARITH_UNCHECKED(ADD);
+    HS_VM_CASE(HS_OP_INT_SUB_UNCHECKED) INT_ARITH_UNCHECKED(SUB);
+    HS_VM_CASE(HS_OP_INT_MUL_UNCHECKED) INT_ARITH_UNCHECKED(MUL);
+    HS_VM_CASE(HS_OP_INT_AND_UNCHECKED) INT_BINOP_UNCHECKED(&);
+    HS_VM_CASE(HS_OP_INT_OR_UNCHECKED)  INT_BINOP_UNCHECKED(|);
+    HS_VM_CASE(HS_OP_INT_XOR_UNCHECKED) INT_BINOP_UNCHECKED(^);
+
+    HS_VM_CASE(HS_OP_INT_CMP_UNCHECKED)
+      SET_INT(REG_A, CMP(HS_AS_INT(REG_B), HS_AS_INT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_INT_INC_UNCHECKED) INT_STEP_UNCHECKED(ADD);
+    HS_VM_CASE(HS_OP_INT_DEC_UNCHECKED) INT_STEP_UNCHECKED(SUB);
+
+    HS_VM_CASE(HS_OP_FLOAT_ADD_UNCHECKED) FLOAT_BINOP_UNCHECKED(+);
+    HS_VM_CASE(HS_OP_FLOAT_SUB_UNCHECKED) FLOAT_BINOP_UNCHECKED(-);
+    HS_VM_CASE(HS_OP_FLOAT_MUL_UNCHECKED) FLOAT_BINOP_UNCHECKED(*);
+    HS_VM_CASE(HS_OP_FLOAT_DIV_UNCHECKED) FLOAT_BINOP_UNCHECKED(/);
+
+    HS_VM_CASE(HS_OP_JUMP_EQ_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(==);
+    HS_VM_CASE(HS_OP_JUMP_NE_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(!=);
+    HS_VM_CASE(HS_OP_JUMP_LT_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(<);
+    HS_VM_CASE(HS_OP_JUMP_LE_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(<=);
+    HS_VM_CASE(HS_OP_JUMP_GT_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(>);
+    HS_VM_CASE(HS_OP_JUMP_GE_ZERO_UNCHECKED) JUMP_ZERO_UNCHECKED(>=);
+
+    HS_VM_CASE(HS_OP_INT_JUMP_EQ_UNCHECKED) INT_JUMP_UNCHECKED(==);
+    HS_VM_CASE(HS_OP_INT_JUMP_NE_UNCHECKED) INT_JUMP_UNCHECKED(!=);
+    HS_VM_CASE(HS_OP_INT_JUMP_LT_UNCHECKED) INT_JUMP_UNCHECKED(<);
+    HS_VM_CASE(HS_OP_INT_JUMP_LE_UNCHECKED) INT_JUMP_UNCHECKED(<=);
+    HS_VM_CASE(HS_OP_INT_JUMP_GT_UNCHECKED) INT_JUMP_UNCHECKED(>);
+    HS_VM_CASE(HS_OP_INT_JUMP_GE_UNCHECKED) INT_JUMP_UNCHECKED(>=);
+
+    HS_VM_CASE(HS_OP_STACK_POP_UNCHECKED)
+      REG_A = state->stack[--state->stack_size];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_STACK_PEEK_UNCHECKED)
+      REG_A = state->stack[state->stack_size - 1];
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_LOCAL_LOAD_CALL)
+    {
+      hs_object *slot;
+      CHECK_AB;
+      slot = context_slot(frame->context, IMM);
+      if (!slot) { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      REG_B  = *slot;
+      self   = frame->module;
+      callee = REG_B;
+      dst    = ins->a;
+      pc    += 1;
+      goto do_call;
+    }
+
+    HS_VM_CASE(HS_OP_FIELD_CALL)
+      CHECK_AB;
+      if ((uint32_t)IMM >= frame->function->module->constant_count)
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      self = frame->self;
+      if (HS_TAG(self) != HS_OBJECT_INSTANCE)
+      { error_code = HS_VM_ERROR_TYPE; goto fail; }
+      key = frame->function->module->constants[IMM];
+      cached_get(state, ins->cache, HS_AS_INSTANCE(self), key, &REG_B);
+      callee = REG_B;
+      dst    = ins->a;
+      pc    += 1;
+      goto do_call;
+
+    /* Generic arithmetic, quickened by the operand types it sees */
+
+    HS_VM_CASE(HS_OP_ADD) GENERIC_BINOP(ADD, +);
+    HS_VM_CASE(HS_OP_SUB) GENERIC_BINOP(SUB, -);
+    HS_VM_CASE(HS_OP_MUL) GENERIC_BINOP(MUL, *);
+
+    HS_VM_CASE(HS_OP_DIV)
+      CHECK_ABC;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT)
+      {
+        QUICKEN(HS_OP_DIV_INT);
+        INT_DIV_TO(REG_A, REG_B, REG_C);
+      }
+      else if (HS_TAG(REG_B) == HS_OBJECT_FLOAT &&
+               HS_TAG(REG_C) == HS_OBJECT_FLOAT)
+      {
+        QUICKEN(HS_OP_DIV_FLOAT);
+        SET_FLOAT(REG_A, HS_AS_FLOAT(REG_B) / HS_AS_FLOAT(REG_C));
+      }
+      else if (IS_INTEGER(REG_B) && IS_INTEGER(REG_C))
+      {
+        /* A BIGINT is never zero, it would be a FIXINT */
+        if (HS_TAG(REG_C) == HS_OBJECT_FIXINT && HS_AS_INT(REG_C) == 0)
+        { error_code = HS_VM_ERROR_ZERO_DIVISION; goto fail; }
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_DIV);
+      }
+      else if (IS_NUMBER(REG_B) && IS_NUMBER(REG_C))
+        SET_FLOAT(REG_A, AS_FLOAT(REG_B) / AS_FLOAT(REG_C));
+      else
+      { error_code = HS_VM_ERROR_TYPE; goto fail; }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_CMP)
+      CHECK_ABC;
+      if (HS_TAG(REG_B) == HS_OBJECT_FIXINT &&
+          HS_TAG(REG_C) == HS_OBJECT_FIXINT)
+      {
+        QUICKEN(HS_OP_CMP_INT);
+        SET_INT(REG_A, CMP(HS_AS_INT(REG_B), HS_AS_INT(REG_C)));
+      }
+      else if (HS_TAG(REG_B) == HS_OBJECT_FLOAT &&
+               HS_TAG(REG_C) == HS_OBJECT_FLOAT)
+      {
+        QUICKEN(HS_OP_CMP_FLOAT);
+        SET_INT(REG_A, CMP(HS_AS_FLOAT(REG_B), HS_AS_FLOAT(REG_C)));
+      }
+      else if (IS_INTEGER(REG_B) && IS_INTEGER(REG_C))
+        INTEGER_OP(REG_A, REG_B, REG_C, HS_INTEGER_CMP);
+      else if (IS_NUMBER(REG_B) && IS_NUMBER(REG_C))
+        SET_INT(REG_A, CMP(AS_FLOAT(REG_B), AS_FLOAT(REG_C)));
+      else
+      { error_code = HS_VM_ERROR_TYPE; goto fail; }
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_ADD_INT)   QUICK_INT_ARITH(ADD);
+    HS_VM_CASE(HS_OP_ADD_FLOAT) QUICK_FLOAT_BINOP(+);
+    HS_VM_CASE(HS_OP_SUB_INT)   QUICK_INT_ARITH(SUB);
+    HS_VM_CASE(HS_OP_SUB_FLOAT) QUICK_FLOAT_BINOP(-);
+    HS_VM_CASE(HS_OP_MUL_INT)   QUICK_INT_ARITH(MUL);
+    HS_VM_CASE(HS_OP_MUL_FLOAT) QUICK_FLOAT_BINOP(*);
+    HS_VM_CASE(HS_OP_DIV_FLOAT) QUICK_FLOAT_BINOP(/);
+
+    HS_VM_CASE(HS_OP_DIV_INT)
+      GUARD(HS_OBJECT_FIXINT);
+      INT_DIV_TO(REG_A, REG_B, REG_C);
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_CMP_INT)
+      GUARD(HS_OBJECT_FIXINT);
+      SET_INT(REG_A, CMP(HS_AS_INT(REG_B), HS_AS_INT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_CASE(HS_OP_CMP_FLOAT)
+      GUARD(HS_OBJECT_FLOAT);
+      SET_INT(REG_A, CMP(HS_AS_FLOAT(REG_B), HS_AS_FLOAT(REG_C)));
+      HS_VM_NEXT();
+
+    HS_VM_DEFAULT
+      error_code = HS_VM_ERROR_OPCODE;
+      goto fail;
+
+#if HS_VM_DISPATCH == HS_VM_DISPATCH_GOTO
+  }
+#else
+    }
+  }
+#endif
+
+deopt:
+  /* A quickened guard failed: go back to the generic opcode and run it */
+  {
+    hs_instruction *quick   = (hs_instruction *)ins;
+    uint16_t        generic = HS_OP_ADD + (quick->opcode - HS_OP_ADD_INT) / 2;
+    quick->opcode  = generic;
+    quick->handler = HANDLER(generic);
+    if (quick->deopts < HS_MAX_DEOPTS) quick->deopts += 1;
+    pc = ins;
+  }
+  HS_VM_NEXT();
+
+do_reserve:
+  /* Each block starts with the previous base, so blocks can be nested */
+  if (grow_buffer((void **)&state->registers, &state->registers_capa,
+                  state->registers_size + 1 + (uint32_t)HS_AS_INT(value),
+                  sizeof(hs_object)))
+  { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+  SYNC_REGS();
+  SET_INT(state->registers[state->registers_size], (hs_int)state->args_base);
+  state->registers_size += 1;
+  state->args_base       = state->registers_size;
+  for (i = 0; i < (uint32_t)HS_AS_INT(value); ++i)
+  {
+    HS_SET_NULL(state->registers[state->registers_size++]);
+  }
+  HS_VM_NEXT();
+
+do_call:
+  /* The argument block becomes the bottom of the window, as it is */
+  call_bottom = state->registers_size;
+  arg0        = state->registers_size;
+  argc        = 0;
+  if (state->args_base > frame->base)
+  {
+    arg0        = state->args_base;
+    argc        = state->registers_size - arg0;
+    call_bottom = arg0 - 1;
+    state->args_base = (size_t)HS_AS_INT(state->registers[arg0 - 1]);
+  }
+  goto do_invoke;
+
+do_tail_call:
+  SAFEPOINT();
+  if (HS_TAG(callee) != HS_OBJECT_CODE_FUNCTION ||
+      state->tries_size > frame->tries ||
+      handler_find(frame->function, ins - frame->function->instructions, NULL))
+  {
+    /* A native function has no frame to reuse, and the handlers of the
+     * frame must catch what the callee throws: call, then return */
+    frame->tail = 1;
+    dst = 0;
+    goto do_call;
+  }
+  {
+    /* The callee takes over the frame, the arguments move to its base.
+     * Everything that can fail is done before the frame changes. */
+    hs_closure *closure = HS_AS_CLOSURE(callee);
+    size_t      need    = closure->function->registers;
+    arg0 = state->registers_size;
+    argc = 0;
+    if (state->args_base > frame->base)
+    {
+      arg0 = state->args_base;
+      argc = state->registers_size - arg0;
+    }
+    if (need < argc) need = argc;
+    if (grow_buffer((void **)&state->registers, &state->registers_capa,
+                    frame->base + need, sizeof(hs_object)))
+    { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+    if (frame->context->escaped)
+    {
+      /* A closure owns the context, the callee needs a buffer of its own */
+      hs_context *ctx = malloc(sizeof(hs_context) +
+                               closure->function->locals * sizeof(hs_object));
+      if (!ctx) { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      frame->context      = ctx;
+      frame->context_capa = closure->function->locals;
+    }
+    if (context_take(frame, closure->context, closure->function->locals))
+    { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+    if (argc)
+      state->args_base = (size_t)HS_AS_INT(state->registers[arg0 - 1]);
+    memmove(state->registers + frame->base, state->registers + arg0,
+            argc * sizeof(hs_object));
+    frame->function  = closure->function;
+    frame->self      = self;
+    frame->args_base = state->args_base;
+    /* The register stack already has room, so this can't fail */
+    window_open(state, frame, frame->base, argc);
+    pc = frame->function->instructions;
+    SYNC_REGS();
+  }
+  goto do_enter;
+
+do_site_call:
+  /* The arguments stay on the registers where the caller computed them */
+  call_bottom = state->registers_size;
+  arg0        = frame->base + site->args;
+  argc        = site->argc;
+  if (site->names && HS_TAG(callee) == HS_OBJECT_CODE_FUNCTION)
+  {
+    const hs_function *target = HS_AS_CLOSURE(callee)->function;
+    if (site->resolved != target && site_resolve(site, target))
+    { error_code = HS_VM_ERROR_INDEX; goto fail; }
+    if (!site->in_place)
+    {
+      /* Each argument goes to its parameter, on top of the stack */
+      if (grow_buffer((void **)&state->registers, &state->registers_capa,
+                      call_bottom + site->width, sizeof(hs_object)))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      SYNC_REGS();
+      for (i = 0; i < site->width; ++i)
+      {
+        HS_SET_NULL(state->registers[call_bottom + i]);
+      }
+      for (i = 0; i < argc; ++i)
+      {
+        state->registers[call_bottom + site->slots[i]] =
+          state->registers[arg0 + i];
+      }
+      arg0 = call_bottom;
+      argc = site->width;
+      goto do_invoke;
+    }
+  }
+  if (call_bottom != frame->base + frame->size)
+  {
+    /* An argument block is open above the window, the callee can't take
+     * the registers under it */
+    if (grow_buffer((void **)&state->registers, &state->registers_capa,
+                    call_bottom + argc, sizeof(hs_object)))
+    { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+    SYNC_REGS();
+    memcpy(state->registers + call_bottom, state->registers + arg0,
+           argc * sizeof(hs_object));
+    arg0 = call_bottom;
+  }
+
+do_invoke:
+  /* The arguments are the argc registers from arg0, and the register
+   * stack goes back to call_bottom when the call returns */
+  SAFEPOINT();
+  if (HS_TAG(callee) == HS_OBJECT_NATIVE_FUNCTION)
+  {
+    size_t native_args = state->native_args;
+    size_t native_argc = state->native_argc;
+    int    failed;
+    /* The native function may run code, which finds the caller here */
+    frame->pc = pc;
+    state->native_args = arg0;
+    state->native_argc = argc;
+    HS_SET_NULL(value);
+    failed = HS_AS_NATIVE_FN(callee)(state, &value);
+    state->native_args = native_args;
+    state->native_argc = native_argc;
+    if (failed)
+    {
+      value = state->error;
+      goto do_throw;
+    }
+    if (frame->tail) goto do_leave;
+    state->registers_size = call_bottom;
+    /* The native function may run code, and grow the register stack */
+    SYNC_REGS();
+    regs[dst] = value;
+    HS_VM_NEXT();
+  }
+  if (HS_TAG(callee) != HS_OBJECT_CODE_FUNCTION)
+  { error_code = HS_VM_ERROR_TYPE; goto fail; }
+  callee_frame = frame_push(state, frame, HS_AS_CLOSURE(callee)->function,
+                            HS_AS_CLOSURE(callee)->context);
+  if (!callee_frame) { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+  callee_frame->self   = self;
+  callee_frame->module = frame->module;
+  callee_frame->result = dst;
+  callee_frame->tries  = state->tries_size;
+  callee_frame->bottom = call_bottom;
+  if (window_open(state, callee_frame, arg0, argc))
+  {
+    frame_pop(state);
+    error_code = HS_VM_ERROR_MEMORY;
+    goto fail;
+  }
+  frame->pc    = pc;
+  frame        = callee_frame;
+  state->frame = frame;
+  pc           = frame->function->instructions;
+  SYNC_REGS();
+
+do_enter:
+  /* A call starts, on machine code when the function has it */
+  {
+    hs_function *entered = frame->function;
+    if (!entered->jit_entry && entered->jit_calls < state->jit_threshold &&
+        ++entered->jit_calls == state->jit_threshold)
+      hs_function_jit(entered);
+    if (!entered->jit_entry) HS_VM_NEXT();
+    entry = entered->jit_entry;
+    at    = 0;
+  }
+
+do_jit:
+  {
+    uint32_t from = (uint32_t)at;
+    int      how  = entry(regs, &value, &from, &state->safepoint);
+    ins = frame->function->instructions + from;
+    if (how == HS_JIT_RETURN) goto do_return;
+    if (how == HS_JIT_SAFEPOINT)
+    {
+      if (safepoint_reached(state, ins)) goto interrupt;
+      at = from;
+      goto do_jit;
+    }
+    /* The loop was entered with other types, its back-edge stops counting */
+    if (how == HS_JIT_DEOPT) edge->hits = state->osr_threshold;
+    /* The interpreter runs what the machine code could not */
+    pc = ins;
+  }
+  HS_VM_NEXT();
+
+do_osr:
+  /* A loop got hot, ins is its back-edge and at its header */
+  {
+    hs_function *running = frame->function;
+    pc = running->instructions + at;
+    if ( ( !running->osr_entry || running->osr_at != at ) &&
+         hs_function_osr(running, (uint32_t)at, regs) )
+      HS_VM_NEXT();
+    /* Later calls move to the same code on their first back-edge */
+    edge = (hs_instruction *)ins;
+    edge->hits -= 1;
+    entry = running->osr_entry;
+  }
+  goto do_jit;
+
+do_return:
+  SAFEPOINT();
+
+do_leave:
+  /* Frames left after a tail call return on the same poll */
+  state->tries_size     = frame->tries;
+  state->registers_size = frame->bottom;
+  if (frame->parent == base) goto finish;
+  {
+    hs_frame *parent = frame->parent;
+    dst = frame->result;
+    frame_pop(state);
+    frame        = parent;
+    state->frame = frame;
+    if (frame->tail) goto do_leave;
+    SYNC_REGS();
+    regs[dst] = value;
+    pc = frame->pc;
+  }
+  HS_VM_NEXT();
+
+do_try:
+  if (grow_buffer((void **)&state->tries, &state->tries_capa,
+                  state->tries_size + 1, sizeof(hs_try)))
+  { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+  {
+    hs_try *t = state->tries + state->tries_size++;
+    t->landing    = HS_TAG(value) == HS_OBJECT_NULL ? NULL :
+                    frame->function->instructions + (uint32_t)HS_AS_INT(value);
+    t->stack_size = state->stack_size;
+    t->registers_size = state->registers_size;
+    t->args_base      = state->args_base;
+    t->catches    = 0;
+  }
+  HS_VM_NEXT();
+
+do_catch:
+  /* value holds the type, callee the handler */
+  if (state->tries_size <= frame->tries)
+  { error_code = HS_VM_ERROR_STACK; goto fail; }
+  {
+    hs_try *t = state->tries + state->tries_size - 1;
+    if (t->catches >= HS_MAX_CATCHES)
+    { error_code = HS_VM_ERROR_INDEX; goto fail; }
+    CHECK_TARGET((uint32_t)HS_AS_INT(callee));
+    t->types[t->catches]    = value;
+    t->handlers[t->catches] = frame->function->instructions +
+                              (uint32_t)HS_AS_INT(callee);
+    t->catches += 1;
+  }
+  HS_VM_NEXT();
+
+do_range_get:
+  /* b holds a range, indexed by an integer or sliced by a range of them */
+  {
+    const hs_range *r = &HS_AS_BOX(REG_B)->value.as_range;
+    hs_range        slice;
+    if (HS_TAG(REG_C) == HS_OBJECT_RANGE)
+    {
+      if (hs_range_slice(&slice, r, &HS_AS_BOX(REG_C)->value.as_range))
+      { error_code = HS_VM_ERROR_INDEX; goto fail; }
+      if (hs_range_new(&state->area, &REG_A, &slice))
+      { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+      HS_VM_NEXT();
+    }
+    EXPECT(REG_C, HS_OBJECT_FIXINT);
+    if (HS_AS_INT(REG_C) < 0 || HS_AS_INT(REG_C) >= r->size)
+    { error_code = HS_VM_ERROR_INDEX; goto fail; }
+    SET_INT(REG_A, (hs_int)( r->first + HS_AS_INT(REG_C) * r->step ));
+  }
+  HS_VM_NEXT();
+
+do_get_field:
+  /* self holds the object, key the name of the property */
+  if (HS_TAG(self) != HS_OBJECT_INSTANCE)
+  { error_code = HS_VM_ERROR_TYPE; goto fail; }
+  cached_get(state, ins->cache, HS_AS_INSTANCE(self), key, regs + dst);
+  HS_VM_NEXT();
+
+do_set_field:
+  /* self holds the object, key the name of the property, value its value */
+  if (HS_TAG(self) != HS_OBJECT_INSTANCE)
+  { error_code = HS_VM_ERROR_TYPE; goto fail; }
+  if (!cached_slot(state, ins->cache, HS_AS_INSTANCE(self)->shape, key, &i))
+    HS_AS_INSTANCE(self)->slots[i] = value;
+  else if (hs_instance_set(HS_AS_INSTANCE(self), key, value))
+  { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+  HS_VM_NEXT();
+
+do_declare:
+  if (i >= frame->function->module->function_count)
+  { error_code = HS_VM_ERROR_INDEX; goto fail; }
+  {
+    hs_closure *closure = malloc(sizeof(hs_closure));
+    if (!closure) { error_code = HS_VM_ERROR_MEMORY; goto fail; }
+    closure->function = frame->function->module->functions + i;
+    closure->context  = frame->context;
+    closure->next     = state->closures;
+    state->closures   = closure;
+    context_escape(state, frame->context);
+    HS_SET_CLOSURE(regs[dst], closure);
+  }
+  HS_VM_NEXT();
+
+fail:
+  SET_INT(value, error_code);
+
+do_throw:
+  /* Each frame, from the top, gets a chance to catch the value: first with
+   * the try contexts it opened, then with its exception table */
+  at = (size_t)(ins - frame->function->instructions);
+  for (;;)
+  {
+    const hs_instruction *landing = NULL;
+    while (!landing && state->tries_size > frame->tries)
+    {
+      hs_try *t = state->tries + state->tries_size - 1;
+      landing = t->landing;
+      for (i = 0; i < t->catches; ++i)
+      {
+        if (catch_matches(t->types + i, &value))
+        {
+          landing = t->handlers[i];
+          break;
+        }
+      }
+      state->tries_size -= 1;
+      if (landing)
+      {
+        state->stack_size     = t->stack_size;
+        state->registers_size = t->registers_size;
+        state->args_base      = t->args_base;
+      }
+    }
+    if (!landing)
+    {
+      const hs_handler *h = handler_find(frame->function, at, &value);
+      if (h)
+      {
+        landing = frame->function->instructions + h->target;
+        if (state->stack_size > frame->stack_base + h->stack)
+          state->stack_size = frame->stack_base + h->stack;
+        state->registers_size = frame->base + frame->size;
+        state->args_base      = frame->args_base;
+      }
+    }
+    if (landing)
+    {
+      state->frame = frame;
+      frame->tail  = 0;
+      SYNC_REGS();
+      regs[0] = value;
+      pc = landing;
+      HS_VM_NEXT();
+    }
+    if (frame->parent == base) break;
+    frame = frame->parent;
+    frame_pop(state);
+    /* The parent threw from the call it was running */
+    at = (size_t)(frame->pc - frame->function->instructions) - 1;
+  }
+  frame_pop(state);
+  state->frame          = base;
+  state->registers_size = bottom;
+  state->error          = value;
+  return 1;
+
+finish:
+  while (frame != base)
+  {
+    frame = frame->parent;
+    frame_pop(state);
+  }
+  state->frame          = base;
+  state->tries_size     = tries_base;
+  state->registers_size = bottom;
+  if (result) *result = value;
+  return 0;
+
+interrupt:
+  /* A stop is not thrown, no handler can catch it */
+  while (frame != base)
+  {
+    frame = frame->parent;
+    frame_pop(state);
+  }
+  state->frame          = base;
+  state->tries_size     = tries_base;
+  state->registers_size = bottom;
+  SET_INT(state->error, HS_VM_ERROR_INTERRUPTED);
+  return 1;
+}
+
+#undef REG_A
+#undef REG_B
+#undef REG_C
+#undef IMM